@@ -0,0 +1,204 @@
+﻿#include "Autotuner.h"
+
+//
+// コンピュートシェーダのワークグループのサイズの自動調整
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+// 記録を保存するファイル名
+constexpr char recordFile[] = "autotune.txt";
+
+// 記録がないときに自動調整するなら true
+bool Autotuner::enabled(true);
+
+// 記録 (キーとワークグループのサイズ)
+static std::map<std::string, std::array<GLint, 2>> &getRecords()
+{
+  static std::map<std::string, std::array<GLint, 2>> records;
+  static bool loaded(false);
+
+  // 最初に使うときにキャッシュのディレクトリから読み込む
+  if (!loaded && !ProgramCache::getDirectory().empty())
+  {
+    std::ifstream file(std::filesystem::path(ProgramCache::getDirectory()) / recordFile);
+    std::string line;
+    while (std::getline(file, line))
+    {
+      // "ドライバ ソースファイル マクロ定義 解像度 幅 高さ"
+      std::istringstream stream(line);
+      std::string driver, comp, defines, resolution;
+      std::array<GLint, 2> size;
+      if (stream >> driver >> comp >> defines >> resolution >> size[0] >> size[1])
+      {
+        records[driver + " " + comp + " " + defines + " " + resolution] = size;
+      }
+    }
+    loaded = true;
+  }
+
+  return records;
+}
+
+// 記録をキャッシュのディレクトリに保存する
+static void saveRecords()
+{
+  if (ProgramCache::getDirectory().empty()) return;
+
+  std::error_code error;
+  std::filesystem::create_directories(ProgramCache::getDirectory(), error);
+  std::ofstream file(std::filesystem::path(ProgramCache::getDirectory()) / recordFile);
+  for (const auto &record : getRecords())
+  {
+    file << record.first << " " << record.second[0] << " " << record.second[1] << "\n";
+  }
+}
+
+// 記録のキーを作る
+static std::string makeKey(const Compute &base, int width, int height)
+{
+  // マクロ定義は "名前=値,名前=値" にする (なければ "-")
+  std::string list;
+  for (const auto &define : base.getDefines())
+  {
+    if (!list.empty()) list += ",";
+    list += define.first + "=" + define.second;
+  }
+  if (list.empty()) list = "-";
+
+  return ProgramCache::getDriverId() + " " + std::filesystem::path(base.getSource()).filename().string() + " " + list
+    + " " + std::to_string(width) + "x" + std::to_string(height);
+}
+
+// ワークグループのサイズを埋め込んだシェーダを作る (base の代わりに使えなければ nullptr)
+static std::shared_ptr<Compute> makeVariant(const Compute &base, const std::array<GLint, 2> &size)
+{
+  Compute::Defines variant(base.getDefines());
+  variant["LOCAL_SIZE_X"] = std::to_string(size[0]);
+  variant["LOCAL_SIZE_Y"] = std::to_string(size[1]);
+  std::shared_ptr<Compute> compute(Compute::share(base.getSource().c_str(), variant));
+  return compute->inherit(base) ? compute : nullptr;
+}
+
+// コンストラクタ
+Autotuner::Autotuner(std::shared_ptr<Compute> &shader, const std::vector<std::array<GLint, 2>> &sizes,
+  int width, int height)
+  : key(makeKey(*shader, width, height))
+  , runs(0)
+  , query{ 0, 0 }
+  , pending(false)
+{
+  // 記録があればそのシェーダを使う
+  const auto &records(getRecords());
+  const auto record(records.find(key));
+  if (record != records.end())
+  {
+    std::shared_ptr<Compute> compute(makeVariant(*shader, record->second));
+    if (compute) shader = compute;
+    return;
+  }
+
+  // 自動調整しなければ元のシェーダを使う
+  if (!enabled) return;
+
+  // 一つのワークグループのスレッド数の上限
+  GLint maxInvocations(0);
+  glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+
+  // 候補のシェーダを作る (作れないものや元のシェーダの代わりに使えないものは除く)
+  for (const auto &size : sizes)
+  {
+    if (size[0] * size[1] > maxInvocations) continue;
+    std::shared_ptr<Compute> compute(makeVariant(*shader, size));
+    if (compute) candidates.push_back(Candidate{ size, compute, 0, 0 });
+  }
+
+  // 比べる候補があれば計測に使うクエリを作る
+  if (candidates.size() > 1)
+    glGenQueries(2, query);
+  else
+    candidates.clear();
+}
+
+// デストラクタ
+Autotuner::~Autotuner()
+{
+  if (query[0] != 0) glDeleteQueries(2, query);
+}
+
+// 次の実行に使う候補のシェーダを設定して計測を開始する
+bool Autotuner::begin(std::shared_ptr<Compute> &shader)
+{
+  // 調整を終えていれば何もしない
+  if (candidates.empty()) return false;
+
+  // 前の実行の計測結果を取り出す (前のフレームのものなのでほとんど待たない)
+  if (pending)
+  {
+    GLuint64 start, stop;
+    glGetQueryObjectui64v(query[0], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(query[1], GL_QUERY_RESULT, &stop);
+    pending = false;
+
+    // 最初の何回かは計測に含めない
+    Candidate &candidate(candidates[(runs - 1) % candidates.size()]);
+    if ((runs - 1) / static_cast<int>(candidates.size()) >= warmup)
+    {
+      candidate.time += stop - start;
+      ++candidate.samples;
+    }
+  }
+
+  // すべての候補を計測し終えたら一番速いものを選ぶ
+  if (runs >= static_cast<int>(candidates.size()) * (warmup + samples))
+  {
+    finish(shader);
+    return false;
+  }
+
+  // 候補を順に切り替えて計測を開始する (負荷の変動の影響を均すために交互に実行する)
+  shader = candidates[runs % candidates.size()].compute;
+  glQueryCounter(query[0], GL_TIMESTAMP);
+  return true;
+}
+
+// 計測を終了する
+void Autotuner::end()
+{
+  if (candidates.empty()) return;
+  glQueryCounter(query[1], GL_TIMESTAMP);
+  pending = true;
+  ++runs;
+}
+
+// 一番速かった候補を選んで記録する
+void Autotuner::finish(std::shared_ptr<Compute> &shader)
+{
+  const auto best(std::min_element(candidates.begin(), candidates.end(),
+    [](const Candidate &a, const Candidate &b) { return a.time * b.samples < b.time * a.samples; }));
+  shader = best->compute;
+
+  // 記録して保存する
+  getRecords()[key] = best->size;
+  saveRecords();
+
+#if defined(_DEBUG)
+  std::cerr << "Autotuned: " << key << " -> " << best->size[0] << "x" << best->size[1]
+    << " (" << best->time * 1.0e-6 / best->samples << " ms)\n";
+#endif
+
+  // 他の候補は使わない
+  candidates.clear();
+}
+
+// 記録がないときに自動調整するかどうかを設定する
+void Autotuner::setEnabled(bool enabled)
+{
+  Autotuner::enabled = enabled;
+}
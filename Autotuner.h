@@ -0,0 +1,87 @@
+﻿#pragma once
+
+//
+// コンピュートシェーダのワークグループのサイズの自動調整
+//
+//   候補のワークグループのサイズのシェーダを実際のデータで順に実行して一番速いものを選び,
+//   ドライバとソースファイルと解像度ごとにキャッシュのディレクトリに記録して次からはそれを使う
+//
+
+// 画像処理
+#include "Compute.h"
+
+// 標準ライブラリ
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Autotuner
+{
+  // 候補のシェーダ
+  struct Candidate
+  {
+    // ワークグループのサイズ
+    std::array<GLint, 2> size;
+
+    // シェーダ
+    std::shared_ptr<Compute> compute;
+
+    // 計測した時間の合計 (ns)
+    GLuint64 time;
+
+    // 計測した回数
+    int samples;
+  };
+
+  // 記録のキー
+  const std::string key;
+
+  // 候補のシェーダ (空なら調整を終えている)
+  std::vector<Candidate> candidates;
+
+  // 実行した回数
+  int runs;
+
+  // 実行の開始と終了の時刻を計測するクエリ
+  GLuint query[2];
+
+  // 計測結果を取り出していなければ true
+  bool pending;
+
+  // 一つの候補について計測せずに実行する回数と計測する回数
+  static constexpr int warmup = 2, samples = 6;
+
+  // 自動調整するなら true
+  static bool enabled;
+
+  // 一番速かった候補を選んで記録する
+  void finish(std::shared_ptr<Compute> &shader);
+
+public:
+
+  // コンストラクタ
+  //   shader は width x height の領域に対して実行するシェーダ
+  //   記録があればそのワークグループのサイズのシェーダを shader に設定する
+  //   記録がなく自動調整するなら sizes のワークグループのサイズを候補にする
+  Autotuner(std::shared_ptr<Compute> &shader, const std::vector<std::array<GLint, 2>> &sizes, int width, int height);
+
+  // デストラクタ
+  virtual ~Autotuner();
+
+  // コピーコンストラクタを封じる
+  Autotuner(const Autotuner &) = delete;
+
+  // 代入演算子を封じる
+  Autotuner &operator=(const Autotuner &) = delete;
+
+  // 次の実行に使う候補のシェーダを shader に設定して計測を開始する
+  //   調整を終えていれば一番速かったシェーダを shader に設定して false を返す
+  bool begin(std::shared_ptr<Compute> &shader);
+
+  // 計測を終了する
+  void end();
+
+  // 記録がないときに自動調整するかどうかを設定する
+  static void setEnabled(bool enabled);
+};
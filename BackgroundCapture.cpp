@@ -0,0 +1,202 @@
+﻿#include "BackgroundCapture.h"
+
+//
+// 透明人間の背景画像のキャプチャ
+//
+
+// OpenCV
+#include <opencv2/highgui/highgui.hpp>
+#ifdef _WIN32
+#  define CV_VERSION_STR CVAUX_STR(CV_MAJOR_VERSION) CVAUX_STR(CV_MINOR_VERSION) CVAUX_STR(CV_SUBMINOR_VERSION)
+#  ifdef _DEBUG
+#    define CV_EXT_STR "d.lib"
+#  else
+#    define CV_EXT_STR ".lib"
+#  endif
+#  pragma comment(lib, "opencv_core" CV_VERSION_STR CV_EXT_STR)
+#  pragma comment(lib, "opencv_highgui" CV_VERSION_STR CV_EXT_STR)
+#  pragma comment(lib, "opencv_videoio" CV_VERSION_STR CV_EXT_STR)
+#endif
+
+// 標準ライブラリ
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+// コンストラクタ
+BackgroundCapture::BackgroundCapture(int device, size_t slots)
+  : camera(new cv::VideoCapture)
+  , texture(0)
+  , slot(std::max(slots, size_t(2)))
+  , latest(slot.size())
+  , quit(false)
+  , captured(0)
+  , uploaded(0)
+  , dropped(0)
+{
+  // カメラを開く
+  if (!camera->open(device))
+  {
+    throw std::runtime_error("ビデオカメラが見つかりません");
+  }
+
+  // 背景画像のサイズ
+  width = GLsizei(camera->get(cv::CAP_PROP_FRAME_WIDTH));
+  height = GLsizei(camera->get(cv::CAP_PROP_FRAME_HEIGHT));
+
+  // 背景画像のテクスチャを作る
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+  // 背景画像一枚分のサイズ
+  const GLsizeiptr size(GLsizeiptr(width) * height * 3);
+
+  // すべてのスロットについて
+  for (size_t i = 0; i < slot.size(); ++i)
+  {
+    // 永続的にマップできるピクセルバッファオブジェクトを作成する
+    Slot &s(slot[i]);
+    glGenBuffers(1, &s.buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr,
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+
+    // キャプチャスレッドから書き込めるようにマップしたままにする
+    s.data = static_cast<GLubyte *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+      GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT));
+    s.fence = nullptr;
+
+    // 最初はすべてのスロットに書き込める
+    vacant.push_back(i);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  // キャプチャスレッドを起動する
+  capturer = std::thread([this]() { capture(); });
+}
+
+// デストラクタ
+BackgroundCapture::~BackgroundCapture()
+{
+  // キャプチャスレッドを止める
+  quit = true;
+  capturer.join();
+
+  // すべてのスロットを削除する
+  for (auto &s : slot)
+  {
+    if (s.fence) glDeleteSync(s.fence);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s.buffer);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glDeleteBuffers(1, &s.buffer);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  // テクスチャを削除する
+  glDeleteTextures(1, &texture);
+}
+
+// キャプチャスレッドの処理
+void BackgroundCapture::capture()
+{
+  // キャプチャした画像 (サイズが変わらなければ同じメモリを使い続ける)
+  cv::Mat frame;
+
+  while (!quit)
+  {
+    // 背景画像をキャプチャする
+    if (!camera->read(frame))
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      continue;
+    }
+    ++captured;
+
+    // サイズや形式の違う画像は使わない
+    if (frame.cols != width || frame.rows != height || frame.type() != CV_8UC3)
+    {
+      ++dropped;
+      continue;
+    }
+
+    // 書き込めるスロットを取り出す
+    size_t i;
+    {
+      std::lock_guard<std::mutex> lock(slotMutex);
+
+      // 書き込めるスロットがなければ捨てる
+      if (vacant.empty())
+      {
+        ++dropped;
+        continue;
+      }
+
+      i = vacant.front();
+      vacant.pop_front();
+    }
+
+    // マップしたピクセルバッファオブジェクトに直接書き込む (上下は反転しない)
+    cv::Mat target(height, width, CV_8UC3, slot[i].data);
+    frame.copyTo(target);
+
+    // 最新の背景画像にする
+    std::lock_guard<std::mutex> lock(slotMutex);
+
+    // 前のものがテクスチャに転送されていなければ捨てる
+    if (latest < slot.size())
+    {
+      vacant.push_back(latest);
+      ++dropped;
+    }
+    latest = i;
+  }
+}
+
+// キャプチャした最新の背景画像をテクスチャに転送する
+bool BackgroundCapture::update()
+{
+  // テクスチャへの転送が完了したスロットをキャプチャスレッドに返す
+  while (!uploading.empty())
+  {
+    Slot &s(slot[uploading.front()]);
+    const GLenum status(glClientWaitSync(s.fence, 0, 0));
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+    glDeleteSync(s.fence);
+    s.fence = nullptr;
+
+    std::lock_guard<std::mutex> lock(slotMutex);
+    vacant.push_back(uploading.front());
+    uploading.pop_front();
+  }
+
+  // 最新の背景画像のスロットを取り出す
+  size_t i;
+  {
+    std::lock_guard<std::mutex> lock(slotMutex);
+    i = latest;
+    latest = slot.size();
+  }
+
+  // 新しい背景画像がなければ何もしない
+  if (i >= slot.size()) return false;
+
+  // ピクセルバッファオブジェクトからテクスチャに転送する
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot[i].buffer);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  // 転送が完了したらキャプチャスレッドに返す
+  slot[i].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  uploading.push_back(i);
+  ++uploaded;
+
+  return true;
+}
@@ -0,0 +1,119 @@
+﻿#pragma once
+
+//
+// 透明人間の背景画像のキャプチャ
+//
+
+// 補助プログラム
+#include "gg.h"
+using namespace gg;
+
+// 標準ライブラリ
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// OpenCV のビデオキャプチャ
+namespace cv
+{
+  class VideoCapture;
+}
+
+class BackgroundCapture
+{
+  // 背景画像の転送に使うピクセルバッファオブジェクトのスロット
+  struct Slot
+  {
+    // 背景画像を格納するピクセルバッファオブジェクト
+    GLuint buffer;
+
+    // 永続的にマップしたピクセルバッファオブジェクトの先頭
+    GLubyte *data;
+
+    // テクスチャへの転送の完了を待つフェンス
+    GLsync fence;
+  };
+
+  // 背景画像をキャプチャする OpenCV のビデオキャプチャ
+  std::unique_ptr<cv::VideoCapture> camera;
+
+  // 背景画像の幅と高さ
+  GLsizei width, height;
+
+  // 背景画像のテクスチャ
+  GLuint texture;
+
+  // 背景画像の転送に使うスロット
+  std::vector<Slot> slot;
+
+  // キャプチャスレッドが書き込めるスロット
+  std::deque<size_t> vacant;
+
+  // キャプチャスレッドが最後に書き込んだスロット (なければ slot.size())
+  size_t latest;
+
+  // テクスチャに転送中のスロット
+  std::deque<size_t> uploading;
+
+  // キャプチャスレッドとの排他制御
+  std::mutex slotMutex;
+
+  // キャプチャスレッドを止めるなら true
+  std::atomic<bool> quit;
+
+  // キャプチャスレッド
+  std::thread capturer;
+
+  // キャプチャしたフレーム数, テクスチャに転送したフレーム数, 転送する前に捨てたフレーム数
+  std::atomic<unsigned long long> captured, uploaded, dropped;
+
+  // キャプチャスレッドの処理
+  void capture();
+
+public:
+
+  // コンストラクタ
+  //   device OpenCV のビデオキャプチャに使うカメラ番号
+  //   slots 背景画像の転送に使うスロットの数
+  //   カメラが開けなければ std::runtime_error を投げる
+  BackgroundCapture(int device, size_t slots = 3);
+
+  // コピーコンストラクタ (コピー禁止)
+  BackgroundCapture(const BackgroundCapture &c) = delete;
+
+  // 代入 (代入禁止)
+  BackgroundCapture &operator=(const BackgroundCapture &c) = delete;
+
+  // デストラクタ
+  virtual ~BackgroundCapture();
+
+  // キャプチャした最新の背景画像をテクスチャに転送する (転送しなければ false)
+  bool update();
+
+  // 背景画像のテクスチャを得る (上下は反転していないので refraction.frag で反転する)
+  GLuint getTexture() const
+  {
+    return texture;
+  }
+
+  // キャプチャしたフレーム数を得る
+  unsigned long long getCaptured() const
+  {
+    return captured;
+  }
+
+  // テクスチャに転送したフレーム数を得る
+  unsigned long long getUploaded() const
+  {
+    return uploaded;
+  }
+
+  // テクスチャに転送する前に捨てたフレーム数を得る
+  unsigned long long getDropped() const
+  {
+    return dropped;
+  }
+};
@@ -0,0 +1,167 @@
+﻿#include "Compute.h"
+
+//
+// 画像処理（コンピュートシェーダ版）
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <iostream>
+
+// プログラムオブジェクトの資源の名前を得る
+static std::string getResourceName(GLuint program, GLenum interface, GLuint index)
+{
+  GLint length(0);
+  const GLenum property(GL_NAME_LENGTH);
+  glGetProgramResourceiv(program, interface, index, 1, &property, 1, nullptr, &length);
+  std::vector<GLchar> name(std::max(length, 1));
+  glGetProgramResourceName(program, interface, index, static_cast<GLsizei>(name.size()), nullptr, name.data());
+  return name.data();
+}
+
+// 古いプログラムの uniform 変数が新しいプログラムでも同じ場所にあれば true
+static bool compatible(GLuint oldProgram, GLuint newProgram)
+{
+  GLint count(0);
+  glGetProgramInterfaceiv(oldProgram, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+  for (GLint i = 0; i < count; ++i)
+  {
+    const std::string name(getResourceName(oldProgram, GL_UNIFORM, i));
+    const GLint location(glGetProgramResourceLocation(oldProgram, GL_UNIFORM, name.c_str()));
+    if (location >= 0 && glGetProgramResourceLocation(newProgram, GL_UNIFORM, name.c_str()) != location) return false;
+  }
+  return true;
+}
+
+// 古いプログラムの Shader Storage Block と Uniform Block の結合ポイントを新しいプログラムに引き継ぐ
+static void copyBindings(GLuint oldProgram, GLuint newProgram)
+{
+  for (const GLenum interface : { GL_SHADER_STORAGE_BLOCK, GL_UNIFORM_BLOCK })
+  {
+    GLint count(0);
+    glGetProgramInterfaceiv(oldProgram, interface, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; ++i)
+    {
+      GLint binding(0);
+      const GLenum property(GL_BUFFER_BINDING);
+      glGetProgramResourceiv(oldProgram, interface, i, 1, &property, 1, nullptr, &binding);
+      const std::string name(getResourceName(oldProgram, interface, i));
+      const GLuint index(glGetProgramResourceIndex(newProgram, interface, name.c_str()));
+      if (index == GL_INVALID_INDEX) continue;
+      if (interface == GL_UNIFORM_BLOCK)
+        glUniformBlockBinding(newProgram, index, binding);
+      else
+        glShaderStorageBlockBinding(newProgram, index, binding);
+    }
+  }
+}
+
+// コンストラクタ
+Compute::Compute(const char *comp, const Defines &defines)
+  : comp(comp)
+  , defines(defines)
+  , program(0)
+  , workGroupSize{ 1, 1, 1 }
+{
+  // ソースファイルの更新時刻を記録してからシェーダプログラムを作成する
+  std::error_code error;
+  modified = std::filesystem::last_write_time(comp, error);
+  setProgram(ProgramCache::loadCompute(comp, defines));
+
+  // 使用中のシェーダに加える
+  getInstances().push_back(this);
+}
+
+// デストラクタ
+Compute::~Compute()
+{
+  // 使用中のシェーダから外す
+  auto &instances(getInstances());
+  instances.erase(std::remove(instances.begin(), instances.end(), this), instances.end());
+
+  // シェーダプログラムを削除する
+  glDeleteProgram(program);
+}
+
+// 使用中のすべてのシェーダ
+std::vector<Compute *> &Compute::getInstances()
+{
+  static std::vector<Compute *> instances;
+  return instances;
+}
+
+// シェーダプログラムを設定する
+void Compute::setProgram(GLuint newProgram)
+{
+  program = newProgram;
+
+  // ワークグループのサイズはシェーダに書かれたものを使う
+  if (program != 0) glGetProgramiv(program, GL_COMPUTE_WORK_GROUP_SIZE, workGroupSize);
+}
+
+// ソースファイルが更新されていれば読み込み直す
+bool Compute::update()
+{
+  // ソースファイルの更新時刻が変わっていなければ何もしない
+  std::error_code error;
+  const auto time(std::filesystem::last_write_time(comp, error));
+  if (error || time == modified) return false;
+  modified = time;
+
+  // 新しいシェーダプログラムを作成する (コンパイルに失敗したら元のものを使い続ける)
+  const GLuint newProgram(ProgramCache::loadCompute(comp.c_str(), defines));
+  if (newProgram == 0) return false;
+
+  // uniform 変数の場所は使う側が覚えているので, 変わってしまえば入れ替えられない
+  if (program != 0 && !compatible(program, newProgram))
+  {
+#if defined(_DEBUG)
+    std::cerr << "Warning: Uniform locations changed, restart to use: " << comp << std::endl;
+#endif
+    glDeleteProgram(newProgram);
+    return false;
+  }
+
+  // Shader Storage Block と Uniform Block の結合ポイントを引き継いで入れ替える
+  if (program != 0) copyBindings(program, newProgram);
+  glDeleteProgram(program);
+  setProgram(newProgram);
+
+#if defined(_DEBUG)
+  std::cerr << "Reloaded: " << comp << " (" << workGroupSize[0] << "x" << workGroupSize[1] << ")" << std::endl;
+#endif
+  return true;
+}
+
+// base と uniform 変数の場所が同じなら Shader Storage Block と Uniform Block の結合ポイントを引き継ぐ
+bool Compute::inherit(const Compute &base)
+{
+  if (program == 0 || base.program == 0 || !compatible(base.program, program)) return false;
+  copyBindings(base.program, program);
+  return true;
+}
+
+// 同じソースファイルとマクロ定義のシェーダプログラムを共有する
+std::shared_ptr<Compute> Compute::share(const char *comp, const Defines &defines)
+{
+  // 作成したシェーダプログラム
+  static std::map<std::pair<std::string, Defines>, std::weak_ptr<Compute>> programs;
+
+  // まだ使われていれば同じものを返す
+  std::weak_ptr<Compute> &program(programs[std::make_pair(std::string(comp), defines)]);
+  std::shared_ptr<Compute> compute(program.lock());
+  if (!compute) program = compute = std::make_shared<Compute>(comp, defines);
+
+  return compute;
+}
+
+// ソースファイルが更新されたシェーダを読み込み直す
+int Compute::reload()
+{
+  int count(0);
+  for (Compute *const compute : getInstances())
+  {
+    if (compute->update()) ++count;
+  }
+  return count;
+}
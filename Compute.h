@@ -8,28 +8,74 @@
 #include "gg.h"
 using namespace gg;
 
+// シェーダプログラムのバイナリのキャッシュ
+#include "ProgramCache.h"
+
 // 標準ライブラリ
+#include <filesystem>
 #include <vector>
+#include <map>
+#include <memory>
+#include <string>
 
 class Compute
 {
+public:
+
+  // シェーダに埋め込むマクロ定義 (名前と値)
+  using Defines = ProgramCache::Defines;
+
+private:
+
+  // ソースファイル名
+  const std::string comp;
+
+  // このシェーダに埋め込むマクロ定義
+  const Defines defines;
+
   // 計算用のシェーダプログラム
-  const GLuint program;
+  GLuint program;
+
+  // ワークグループのサイズ
+  GLint workGroupSize[3];
+
+  // 読み込んだときのソースファイルの更新時刻
+  std::filesystem::file_time_type modified;
+
+  // 使用中のすべてのシェーダ
+  static std::vector<Compute *> &getInstances();
+
+  // シェーダプログラムを設定する
+  void setProgram(GLuint newProgram);
+
+  // ソースファイルが更新されていれば読み込み直す
+  bool update();
 
 public:
 
   // コンストラクタ
-  Compute(const char *comp)
-    : program(ggLoadComputeShader(comp))
-  {
-  }
+  //   defines はソースファイルの #version の次の行に #define として埋め込む
+  Compute(const char *comp, const Defines &defines = Defines());
 
   // デストラクタ
-  virtual ~Compute()
-  {
-    // シェーダプログラムを削除する
-    glDeleteShader(program);
-  }
+  virtual ~Compute();
+
+  // コピーコンストラクタを封じる
+  Compute(const Compute &) = delete;
+
+  // 代入演算子を封じる
+  Compute &operator=(const Compute &) = delete;
+
+  // 同じソースファイルとマクロ定義のシェーダプログラムを共有する (使っているものがなくなれば削除する)
+  static std::shared_ptr<Compute> share(const char *comp, const Defines &defines = Defines());
+
+  // base と uniform 変数の場所が同じなら Shader Storage Block と Uniform Block の結合ポイントを引き継いで true を返す
+  //   同じソースファイルのマクロ定義の違うシェーダを base の代わりに使うときに呼び出す
+  bool inherit(const Compute &base);
+
+  // ソースファイルが更新されたシェーダを読み込み直して読み込み直した数を返す
+  //   コンパイルに失敗したときや uniform 変数の場所が変わったときは元のシェーダを使い続ける
+  static int reload();
 
   // シェーダプログラムを得る
   GLuint get() const
@@ -37,6 +83,24 @@ public:
     return program;
   }
 
+  // ソースファイル名を得る
+  const std::string &getSource() const
+  {
+    return comp;
+  }
+
+  // このシェーダに埋め込んだマクロ定義を得る
+  const Defines &getDefines() const
+  {
+    return defines;
+  }
+
+  // ワークグループのサイズを得る
+  const GLint *getWorkGroupSize() const
+  {
+    return workGroupSize;
+  }
+
   // 計算用のシェーダプログラムの使用を開始する
   void use() const
   {
@@ -48,4 +112,10 @@ public:
   {
     glDispatchCompute((width + local_size_x - 1) / local_size_x, (height + local_size_y - 1) / local_size_y, 1);
   }
+
+  // ワークグループのサイズから近傍の分 apron_x, apron_y を除いた領域ごとに計算を実行する
+  void dispatch(GLuint width, GLuint height, GLuint apron_x = 0, GLuint apron_y = 0) const
+  {
+    execute(width, height, workGroupSize[0] - apron_x, workGroupSize[1] - apron_y);
+  }
 };
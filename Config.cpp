@@ -0,0 +1,342 @@
+﻿#include "Config.h"
+
+//
+// 実行時の設定
+//
+
+// 標準ライブラリ
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// 設定ファイルを指定しなかったときに読み込むファイル
+constexpr char defaultFile[] = "getdepth.cfg";
+
+// 文字列の前後の空白を取り除く
+static std::string trim(const std::string &s)
+{
+  const auto first(s.find_first_not_of(" \t\r\n"));
+  if (first == std::string::npos) return std::string();
+  const auto last(s.find_last_not_of(" \t\r\n"));
+  return s.substr(first, last - first + 1);
+}
+
+// 不正な設定の例外を投げる
+[[noreturn]] static void invalid(const std::string &key, const std::string &value)
+{
+  throw std::runtime_error("設定が不正です: " + key + " = " + value);
+}
+
+// 整数を読み取る
+static int toInt(const std::string &key, const std::string &value)
+{
+  size_t n(0);
+  int i(0);
+  try { i = std::stoi(value, &n); } catch (const std::exception &) { invalid(key, value); }
+  if (n != value.size()) invalid(key, value);
+  return i;
+}
+
+// 実数を読み取る
+static float toFloat(const std::string &key, const std::string &value)
+{
+  size_t n(0);
+  float f(0.0f);
+  try { f = std::stof(value, &n); } catch (const std::exception &) { invalid(key, value); }
+  if (n != value.size()) invalid(key, value);
+  return f;
+}
+
+// 真理値を読み取る
+static bool toBool(const std::string &key, const std::string &value)
+{
+  if (value == "1" || value == "true" || value == "yes" || value == "on") return true;
+  if (value == "0" || value == "false" || value == "no" || value == "off") return false;
+  invalid(key, value);
+}
+
+// "名前=値 名前=値 ..." のマクロ定義を読み取る (値を省略すれば 1)
+static void toDefines(const std::string &key, const std::string &value, std::map<std::string, std::string> &defines)
+{
+  defines.clear();
+  std::istringstream stream(value);
+  std::string item;
+  while (stream >> item)
+  {
+    const auto equal(item.find('='));
+    const std::string name(item.substr(0, equal));
+
+    // 名前は英字か _ で始まる英数字と _ でなければならない
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name.front()))) invalid(key, value);
+    for (const unsigned char c : name) if (!std::isalnum(c) && c != '_') invalid(key, value);
+
+    defines[name] = equal == std::string::npos ? "1" : item.substr(equal + 1);
+  }
+}
+
+// "幅x高さ@フレームレート" を読み取る (フレームレートは省略できる)
+static void toMode(const std::string &key, const std::string &value, int &width, int &height, int &fps)
+{
+  const auto x(value.find('x'));
+  if (x == std::string::npos) invalid(key, value);
+  const auto at(value.find('@', x));
+
+  // 部分を整数として読み取る (不正なら値全体を示す)
+  const auto number([&](const std::string &s)
+  {
+    try { return toInt(key, s); } catch (const std::runtime_error &) { invalid(key, value); }
+  });
+
+  width = number(value.substr(0, x));
+  height = number(value.substr(x + 1, at == std::string::npos ? std::string::npos : at - x - 1));
+  if (at != std::string::npos) fps = number(value.substr(at + 1));
+  if (width <= 0 || height <= 0 || fps <= 0) invalid(key, value);
+}
+
+// "幅x高さ+左+上" を読み取る
+static void toRoi(const std::string &key, const std::string &value, int *roi)
+{
+  const auto x(value.find('x'));
+  const auto plus(value.find('+', x));
+  const auto second(plus == std::string::npos ? std::string::npos : value.find('+', plus + 1));
+  if (x == std::string::npos || second == std::string::npos) invalid(key, value);
+
+  // 部分を整数として読み取る (不正なら値全体を示す)
+  const auto number([&](const std::string &s)
+  {
+    try { return toInt(key, s); } catch (const std::runtime_error &) { invalid(key, value); }
+  });
+
+  roi[2] = number(value.substr(0, x));
+  roi[3] = number(value.substr(x + 1, plus - x - 1));
+  roi[0] = number(value.substr(plus + 1, second - plus - 1));
+  roi[1] = number(value.substr(second + 1));
+  if (roi[0] < 0 || roi[1] < 0 || roi[2] < 0 || roi[3] < 0) invalid(key, value);
+}
+
+// コンストラクタ
+Config::Config(int argc, const char *const *argv)
+  : counted(false)
+  , count(3)
+  , shader(true)
+  , refraction(false)
+  , capture(2)
+  , deviation1(2.0f)
+  , deviation2(10.0f)
+  , benchmark(0)
+  , pacing(false)
+  , cache("shadercache")
+  , reload(false)
+  , autotune(true)
+  , batch(true)
+  , foreground(false)
+  , culling(true)
+  , streambenchmark(0)
+{
+  // 設定ファイルが指定されていればそれを読み込む
+  bool loaded(false);
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg(argv[i]);
+    if (arg.compare(0, 9, "--config=") == 0)
+    {
+      load(arg.substr(9));
+      loaded = true;
+    }
+  }
+
+  // 指定されていなければデフォルトの設定ファイルがあればそれを読み込む
+  if (!loaded && std::ifstream(defaultFile)) load(defaultFile);
+
+  // コマンドライン引数の設定で上書きする
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg(argv[i]);
+    const auto equal(arg.find('='));
+    if (arg.compare(0, 2, "--") != 0 || equal == std::string::npos)
+    {
+      throw std::runtime_error("コマンドライン引数が不正です: " + arg);
+    }
+    const std::string key(arg.substr(2, equal - 2)), value(arg.substr(equal + 1));
+    if (key == "config") continue;
+
+    // --sensorN.キー=値 ならセンサ N の設定にする
+    const auto dot(key.find('.'));
+    if (key.compare(0, 6, "sensor") == 0 && dot != std::string::npos)
+    {
+      const int n(toInt(key, key.substr(6, dot - 6)));
+      if (n < 0) invalid(key, value);
+      set(static_cast<size_t>(n), key.substr(dot + 1), value);
+    }
+    else
+    {
+      set(key, value);
+    }
+  }
+
+  // センサの数が指定されていなければ [sensor] の数にする
+  if (!counted && !overrides.empty()) count = static_cast<int>(overrides.size());
+}
+
+// 設定ファイルを読み込む
+void Config::load(const std::string &file)
+{
+  std::ifstream stream(file);
+  if (!stream)
+  {
+    throw std::runtime_error("設定ファイルが開けません: " + file);
+  }
+
+  // [sensor] の中なら true
+  bool section(false);
+
+  // 一行ずつ読み込む
+  std::string line;
+  while (std::getline(stream, line))
+  {
+    // コメントと前後の空白を取り除く
+    line = trim(line.substr(0, line.find_first_of("#;")));
+    if (line.empty()) continue;
+
+    // [sensor] から後は新しいセンサの設定にする
+    if (line.front() == '[')
+    {
+      if (line != "[sensor]")
+      {
+        throw std::runtime_error("設定ファイルの節が不正です: " + line);
+      }
+      overrides.emplace_back();
+      section = true;
+      continue;
+    }
+
+    // キー = 値
+    const auto equal(line.find('='));
+    if (equal == std::string::npos)
+    {
+      throw std::runtime_error("設定ファイルの行が不正です: " + line);
+    }
+    const std::string key(trim(line.substr(0, equal))), value(trim(line.substr(equal + 1)));
+    if (section)
+      set(overrides.size() - 1, key, value);
+    else
+      set(key, value);
+  }
+}
+
+// 全体の設定の項目を設定する
+void Config::set(const std::string &key, const std::string &value)
+{
+  if (key == "count")
+  {
+    count = toInt(key, value);
+    if (count <= 0) invalid(key, value);
+    counted = true;
+  }
+  else if (key == "shader") shader = toBool(key, value);
+  else if (key == "refraction") refraction = toBool(key, value);
+  else if (key == "capture") capture = toInt(key, value);
+  else if (key == "deviation1") deviation1 = toFloat(key, value);
+  else if (key == "deviation2") deviation2 = toFloat(key, value);
+  else if (key == "pacing") pacing = toBool(key, value);
+  else if (key == "cache") cache = value;
+  else if (key == "defines") toDefines(key, value, defines);
+  else if (key == "reload") reload = toBool(key, value);
+  else if (key == "autotune") autotune = toBool(key, value);
+  else if (key == "batch") batch = toBool(key, value);
+  else if (key == "foreground") foreground = toBool(key, value);
+  else if (key == "culling") culling = toBool(key, value);
+  else if (key == "objbenchmark") objbenchmark = value;
+  else if (key == "streambenchmark")
+  {
+    streambenchmark = toInt(key, value);
+    if (streambenchmark < 0) invalid(key, value);
+  }
+  else if (key == "benchmark")
+  {
+    benchmark = toInt(key, value);
+    if (benchmark < 0) invalid(key, value);
+  }
+  else if (!set(defaults, key, value))
+  {
+    throw std::runtime_error("設定の項目が不正です: " + key);
+  }
+}
+
+// センサ i の設定の項目を記録する
+void Config::set(size_t i, const std::string &key, const std::string &value)
+{
+  // 値が不正ならここでエラーにする
+  SensorConfig sensor(defaults);
+  if (!set(sensor, key, value))
+  {
+    throw std::runtime_error("センサの設定の項目が不正です: " + key);
+  }
+
+  if (i >= overrides.size()) overrides.resize(i + 1);
+  overrides[i].emplace_back(key, value);
+}
+
+// センサの設定の項目を設定する
+bool Config::set(SensorConfig &sensor, const std::string &key, const std::string &value)
+{
+  if (key == "backend") sensor.backend = value;
+  else if (key == "depth") toMode(key, value, sensor.depthWidth, sensor.depthHeight, sensor.depthFps);
+  else if (key == "color") toMode(key, value, sensor.colorWidth, sensor.colorHeight, sensor.colorFps);
+  else if (key == "align") sensor.alignToColor = toBool(key, value);
+  else if (key == "serial") sensor.serial = value;
+  else if (key == "yuyv") sensor.yuyv = toBool(key, value);
+  else if (key == "decimation")
+  {
+    sensor.decimation = toInt(key, value);
+    if (sensor.decimation < 1 || sensor.decimation > 8) invalid(key, value);
+  }
+  else if (key == "spatial") sensor.spatial = toBool(key, value);
+  else if (key == "temporal") sensor.temporal = toBool(key, value);
+  else if (key == "holes")
+  {
+    if (value == "off") sensor.holeFilling = -1;
+    else if (value == "left") sensor.holeFilling = 0;
+    else if (value == "farest") sensor.holeFilling = 1;
+    else if (value == "nearest") sensor.holeFilling = 2;
+    else invalid(key, value);
+  }
+  else if (key == "units")
+  {
+    sensor.depthUnits = toFloat(key, value);
+    if (sensor.depthUnits < 0.0f) invalid(key, value);
+  }
+  else if (key == "preset") sensor.preset = value;
+  else if (key == "smoothing") sensor.smoothing = toBool(key, value);
+  else if (key == "roi") toRoi(key, value, sensor.roi);
+  else if (key == "near")
+  {
+    sensor.nearClip = toFloat(key, value);
+    if (sensor.nearClip < 0.0f) invalid(key, value);
+  }
+  else if (key == "far")
+  {
+    sensor.farClip = toFloat(key, value);
+    if (sensor.farClip < 0.0f) invalid(key, value);
+  }
+  else if (key == "model")
+  {
+    if (value == "ds311" || value == "0") sensor.model = 0;
+    else if (value == "ds325" || value == "1") sensor.model = 1;
+    else invalid(key, value);
+  }
+  else return false;
+  return true;
+}
+
+// センサ i の設定を得る
+SensorConfig Config::getSensor(int i) const
+{
+  SensorConfig sensor(defaults);
+  if (i >= 0 && static_cast<size_t>(i) < overrides.size())
+  {
+    for (const auto &item : overrides[i]) set(sensor, item.first, item.second);
+  }
+  return sensor;
+}
@@ -0,0 +1,153 @@
+﻿#pragma once
+
+//
+// 実行時の設定
+//
+
+// 標準ライブラリ
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+
+// センサごとの設定
+struct SensorConfig
+{
+  // 使用するセンサの種類 ("rs400", "kinectv1", "kinectv2", "ds325")
+  std::string backend = "rs400";
+
+  // デプスセンサの幅と高さとフレームレート
+  int depthWidth = 1280, depthHeight = 720, depthFps = 30;
+
+  // カラーセンサの幅と高さとフレームレート
+  int colorWidth = 1920, colorHeight = 1080, colorFps = 30;
+
+  // デプスデータをカラーデータに合わせるなら true
+  bool alignToColor = false;
+
+  // カラーデータを YUYV で受け取ってシェーダで RGB に変換するなら true (RealSense のみ)
+  bool yuyv = false;
+
+  // DepthSense の種類 (0: DS311, 1: DS325)
+  int model = 1;
+
+  // 使用するデバイスのシリアル番号 (空なら使われていないもの, RealSense のみ)
+  std::string serial;
+
+  // 以下は RealSense のデプスデータの後処理
+
+  // 間引きの倍率 (1 なら間引かない)
+  int decimation = 1;
+
+  // 空間フィルタと時間フィルタをかけるなら true
+  bool spatial = false, temporal = false;
+
+  // 穴埋めの方法 (-1 なら穴埋めしない, 0: 左から, 1: 周囲の最遠点, 2: 周囲の最近点)
+  int holeFilling = -1;
+
+  // デプスの単位 (m, 0 ならデバイスのデフォルト)
+  float depthUnits = 0.0f;
+
+  // ビジュアルプリセットの名前 (空ならデバイスのデフォルト)
+  std::string preset;
+
+  // 頂点位置の生成のときにバイラテラルフィルタをかけるなら true
+  bool smoothing = true;
+
+  // 頂点位置を生成して描画するデプスデータの領域 (左上の位置と幅と高さ, 幅か高さが 0 なら全体)
+  int roi[4] = { 0, 0, 0, 0 };
+
+  // これより近いか遠いデプス値を計測不能点にする距離 (m, 0 なら切り取らない)
+  float nearClip = 0.0f, farClip = 0.0f;
+};
+
+//
+// 設定ファイルとコマンドライン引数から設定を読み込む
+//
+//   設定ファイルは "キー = 値" の行からなり, [sensor] の行から後は一つのセンサの設定になる
+//   コマンドライン引数は --キー=値 で, --sensor0.キー=値 のようにするとセンサごとの設定になる
+//
+class Config
+{
+  // センサに共通の設定
+  SensorConfig defaults;
+
+  // センサごとに指定された設定の項目
+  std::vector<std::vector<std::pair<std::string, std::string>>> overrides;
+
+  // センサの数が指定されていれば true
+  bool counted;
+
+  // 設定ファイルを読み込む
+  void load(const std::string &file);
+
+  // 全体の設定の項目を設定する
+  void set(const std::string &key, const std::string &value);
+
+  // センサ i の設定の項目を記録する
+  void set(size_t i, const std::string &key, const std::string &value);
+
+  // センサの設定の項目を設定する (センサの設定の項目でなければ false)
+  static bool set(SensorConfig &sensor, const std::string &key, const std::string &value);
+
+public:
+
+  // 使用するセンサの数 (起動できたものまで使う)
+  int count;
+
+  // 頂点位置の生成をシェーダで行うなら true
+  bool shader;
+
+  // 透明人間にするなら true
+  bool refraction;
+
+  // OpenCV によるビデオキャプチャに使うカメラ
+  int capture;
+
+  // バイラテラルフィルタのデフォルトの位置の標準偏差
+  float deviation1;
+
+  // バイラテラルフィルタのデフォルトの明度の標準偏差
+  float deviation2;
+
+  // 性能を計測するフレーム数 (0 なら計測しない)
+  int benchmark;
+
+  // 新しいフレームが届くか視点が変わったときだけ描画するなら true
+  bool pacing;
+
+  // シェーダプログラムのバイナリのキャッシュを保存するディレクトリ (空ならキャッシュしない)
+  std::string cache;
+
+  // すべてのシェーダに埋め込むマクロ定義 (名前と値)
+  std::map<std::string, std::string> defines;
+
+  // シェーダのソースファイルが更新されたら読み込み直すなら true
+  bool reload;
+
+  // 記録がなければコンピュートシェーダのワークグループのサイズを自動調整するなら true
+  bool autotune;
+
+  // 透明人間にしないときにすべてのセンサを一回の呼び出しで描画するなら true
+  bool batch;
+
+  // 背景を学習して前景だけを描画・書き出し・送信するなら true
+  bool foreground;
+
+  // 境界ボックスが視錐台の外にあるセンサや行を描かないなら true
+  bool culling;
+
+  // 読み込みの性能を計測する OBJ ファイル (空でなければ計測して終了する)
+  std::string objbenchmark;
+
+  // 配信を受け取って復号の性能を計測するフレーム数 (0 でなければ計測して終了する)
+  int streambenchmark;
+
+  // コンストラクタ
+  //   --config=ファイル名 がなければ getdepth.cfg があればそれを読み込む
+  //   不正な設定があれば std::runtime_error を投げる
+  Config(int argc, const char *const *argv);
+
+  // センサ i の設定を得る
+  SensorConfig getSensor(int i) const;
+};
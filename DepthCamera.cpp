@@ -1,49 +1,77 @@
 ﻿#include "DepthCamera.h"
-#include <iostream>
+
 //
 // デプスセンサ関連の基底クラス
 //
 
+// 標準ライブラリ
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
 // コンストラクタ
 DepthCamera::DepthCamera()
 : message(nullptr)
-, depthTexture(0), pointTexture(0), colorTexture(0)
-, uvmapBuffer(0), weightBuffer(0), normalBuffer(0)
+, weight(nullptr), normalBuffer(0)
+, modelTexture(0), foregroundTexture(0), foregroundFrame(0)
+, rowBuffer(0), commandBuffer(0), boxBuffer(0), boxData(nullptr), boxFence(nullptr)
+, box{}, boxValid(false), boundsFrame(0)
+, yuyvTexture(0)
+, depthTexture(0), depthFrame(0), pointFrame(0), normalFrame(0)
+, colorTexture(0), pointTexture(0)
+, uvmapBuffer(0), weightBuffer(0), parameterBuffer(0)
+, roi{ 0, 0, 0, 0 }
+, statistics{ 0, 0, 0, 0 }
 {
-  // まだシェーダが作られていなかったら
-  if (normal.get() == nullptr)
-  {
-    // 法線ベクトル算出用のシェーダを作成する
-    normal.reset(new Compute("normal.comp"));
-
-    // カメラ座標のイメージユニットの uniform 変数の場所を求める
-    pointLoc = glGetUniformLocation(normal->get(), "point");
+  // 法線ベクトル算出用のシェーダを作成する
+  normal = Compute::share("normal.comp");
 
-    // 法線ベクトルのバッファオブジェクトを参照する結合ポイントを指定する
-    const GLuint normalIndex(glGetProgramResourceIndex(normal->get(), GL_SHADER_STORAGE_BLOCK, "Normal"));
-    glShaderStorageBlockBinding(normal->get(), normalIndex, NormalBinding);
-  }
+  // カメラ座標のイメージユニットの uniform 変数の場所を求める
+  pointLoc = glGetUniformLocation(normal->get(), "point");
 
-  // まだメッシュが作られていなかったら
-  if (mesh.get() == nullptr)
-  {
-    // 描画用のメッシュを作成する
-    mesh.reset(new Mesh);
-  }
+  // 法線ベクトルのバッファオブジェクトを参照する結合ポイントを指定する
+  const GLuint normalIndex(glGetProgramResourceIndex(normal->get(), GL_SHADER_STORAGE_BLOCK, "Normal"));
+  glShaderStorageBlockBinding(normal->get(), normalIndex, NormalBinding);
 }
 
 // デストラクタ
 DepthCamera::~DepthCamera()
 {
-  // テクスチャを削除する
-  if (depthTexture > 0) glDeleteTextures(1, &depthTexture);
-  if (pointTexture > 0) glDeleteTextures(1, &pointTexture);
-  if (colorTexture > 0) glDeleteTextures(1, &colorTexture);
+  // テクスチャとバッファオブジェクトを資源プールに返却する
+  for (const GLuint texture : textures) ResourcePool::releaseTexture(texture);
+  for (const GLuint buffer : buffers) ResourcePool::releaseBuffer(buffer);
 
-  // バッファオブジェクトを削除する
-  if (uvmapBuffer > 0) glDeleteBuffers(1, &uvmapBuffer);
-  if (normalBuffer > 0) glDeleteBuffers(1, &normalBuffer);
+  // 資源プールを使わないバッファオブジェクトを削除する
   if (weightBuffer > 0) glDeleteBuffers(1, &weightBuffer);
+  if (parameterBuffer > 0) glDeleteBuffers(1, &parameterBuffer);
+  if (boxBuffer > 0) glDeleteBuffers(1, &boxBuffer);
+  if (boxFence) glDeleteSync(boxFence);
+}
+
+// 資源プールからテクスチャを取り出す
+GLuint DepthCamera::acquireTexture(GLenum format, GLsizei width, GLsizei height)
+{
+  const GLuint texture(ResourcePool::acquireTexture(format, width, height));
+  textures.push_back(texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  return texture;
+}
+
+// 資源プールからバッファオブジェクトを取り出す
+GLuint DepthCamera::acquireBuffer(GLsizeiptr size, GLbitfield flags)
+{
+  const GLuint buffer(ResourcePool::acquireBuffer(size, flags));
+  buffers.push_back(buffer);
+  return buffer;
+}
+
+// 資源プールから取り出したテクスチャとバッファオブジェクトのメモリ量を得る
+GLsizeiptr DepthCamera::getMemory() const
+{
+  GLsizeiptr size(0);
+  for (const GLuint texture : textures) size += ResourcePool::getTextureSize(texture);
+  for (const GLuint buffer : buffers) size += ResourcePool::getBufferSize(buffer);
+  return size;
 }
 
 // テクスチャとバッファオブジェクトを作成してポイント数を返す
@@ -52,103 +80,430 @@ int DepthCamera::makeTexture()
   // カラーデータの境界色
   static const GLfloat border[] = { 0.5f, 0.5f, 0.5f, 0.0f };
 
-  // デプスデータを格納するテクスチャを準備する
-  glGenTextures(1, &depthTexture);
-  glBindTexture(GL_TEXTURE_2D, depthTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, depthWidth, depthHeight, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, NULL);
+  // デプスデータを格納するテクスチャを準備する (整数テクスチャなので補間しない)
+  depthTexture = acquireTexture(GL_R16UI, depthWidth, depthHeight);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
   // デプスデータから求めたカメラ座標を格納するテクスチャを準備する
-  glGenTextures(1, &pointTexture);
-  glBindTexture(GL_TEXTURE_2D, pointTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, depthWidth, depthHeight, 0, GL_RGB, GL_FLOAT, NULL);
+  pointTexture = acquireTexture(GL_RGBA32F, depthWidth, depthHeight);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-  // カラーデータを格納するテクスチャを準備する
-  glGenTextures(1, &colorTexture);
-  glBindTexture(GL_TEXTURE_2D, colorTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, colorWidth, colorHeight, 0, GL_BGRA, GL_UNSIGNED_BYTE, NULL);
+  // カラーデータを格納するテクスチャを準備する (YUYV から変換するときはイメージとして書き込む)
+  colorTexture = acquireTexture(GL_RGBA8, colorWidth, colorHeight);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
 
+  // 領域の外のカメラ座標は求めないので計測不能点 (原点) にしておく (資源プールから再利用したものも初期化する)
+  glClearTexImage(pointTexture, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+  // デプスセンサの解像度の描画用のメッシュを用意する
+  mesh = Mesh::share(depthWidth, depthHeight);
+
+  // 最初は全体を処理する
+  setRoi(0, 0, 0, 0);
+
   // ポイント数を求める
   const int depthCount(depthWidth * depthHeight);
 
   // デプスデータの画素位置のカラーのテクスチャ座標を格納するバッファオブジェクトを準備する
-  glGenBuffers(1, &uvmapBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, uvmapBuffer);
-  glBufferData(GL_ARRAY_BUFFER, depthCount * sizeof (Uvmap), NULL, GL_DYNAMIC_DRAW);
+  //   CPU で求めたものは glBufferSubData() で転送するかマップして書き込む
+  uvmapBuffer = acquireBuffer(depthCount * sizeof (Uvmap), GL_DYNAMIC_STORAGE_BIT | GL_MAP_WRITE_BIT);
 
-  // カメラ座標の法線ベクトルを格納するバッファオブジェクトを準備する
-  glGenBuffers(1, &normalBuffer);
-  glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-  glBufferData(GL_ARRAY_BUFFER, depthCount * sizeof (Normal), nullptr, GL_DYNAMIC_DRAW);
+  // カメラ座標の法線ベクトルを格納するバッファオブジェクトを準備する (GPU でしか読み書きしない)
+  normalBuffer = acquireBuffer(depthCount * sizeof (Normal), 0);
 
-  // バイラテラルフィルタの重みを格納するバッファオブジェクトを準備する
+  // バイラテラルフィルタの重みを格納するバッファオブジェクトを準備して常にマップしておく
+  constexpr GLbitfield flags(GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
   glGenBuffers(1, &weightBuffer);
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, weightBuffer);
-  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof (Weight), NULL, GL_STATIC_DRAW);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof (Weight), nullptr, flags);
+  weight = static_cast<Weight *>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof (Weight), flags));
+
+  // 法線ベクトルを計算するシェーダのワークグループのサイズをこの解像度で自動調整する
+  static const std::vector<std::array<GLint, 2>> normalSizes
+  {
+    { 1, 1 }, { 8, 8 }, { 16, 4 }, { 16, 16 }, { 32, 8 }, { 64, 4 }
+  };
+  normalTuner.reset(new Autotuner(normal, normalSizes, depthWidth, depthHeight));
 
   // ポイント数を返す
   return depthCount;
 }
 
+// YUYV のカラーデータを格納するテクスチャを作成する
+void DepthCamera::makeYuyvTexture()
+{
+  // 一つの画素に横に並んだ二画素分の Y0 U Y1 V を格納する
+  yuyvTexture = acquireTexture(GL_RGBA8UI, colorWidth / 2, colorHeight);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+  // YUYV のカラーデータを RGB に変換するシェーダを用意する
+  decoder = Compute::share("yuyv.comp");
+
+  // シェーダの uniform 変数の場所を調べる
+  yuyvLoc = glGetUniformLocation(decoder->get(), "yuyv");
+  colorLoc = glGetUniformLocation(decoder->get(), "color");
+}
+
+// YUYV のカラーデータをテクスチャに転送して RGB に変換する
+void DepthCamera::setYuyv(const void *data) const
+{
+  // YUYV のカラーデータをテクスチャに転送する (RGB の 2/3 の大きさ)
+  glBindTexture(GL_TEXTURE_2D, yuyvTexture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth / 2, colorHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, data);
+
+  // シェーダで RGB に変換してカラーデータのテクスチャに書き込む
+  decoder->use();
+  glUniform1i(yuyvLoc, YuyvImageUnit);
+  glUniform1i(colorLoc, ColorImageUnit);
+  glBindImageTexture(YuyvImageUnit, yuyvTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+  glBindImageTexture(ColorImageUnit, colorTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+  decoder->dispatch(colorWidth / 2, colorHeight);
+
+  // 描画やテクスチャの読み出しの前に書き込みを完了する
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+  // 呼び出し側と同じようにカラーデータのテクスチャを指定しておく
+  glBindTexture(GL_TEXTURE_2D, colorTexture);
+}
+
+// カメラ座標を求めて描画する領域を設定する
+void DepthCamera::setRoi(int left, int top, int width, int height)
+{
+  // 幅か高さが 0 なら全体にする
+  if (width <= 0 || height <= 0)
+  {
+    left = top = 0;
+    width = depthWidth;
+    height = depthHeight;
+  }
+
+  // デプスデータからはみ出さないようにする (メッシュにするので少なくとも 2x2 にする)
+  const int x0(std::min(std::max(left, 0), depthWidth - 2));
+  const int y0(std::min(std::max(top, 0), depthHeight - 2));
+  const int x1(std::min(std::max(left + width, x0 + 2), depthWidth));
+  const int y1(std::min(std::max(top + height, y0 + 2), depthHeight));
+
+  // カメラ座標のテクスチャは上下が反転しているので下端の位置を求める
+  roi[0] = x0;
+  roi[1] = depthHeight - y1;
+  roi[2] = x1 - x0;
+  roi[3] = y1 - y0;
+}
+
+// カメラ座標を求めるシェーダのワークグループのサイズを自動調整する
+void DepthCamera::tunePosition(std::shared_ptr<Compute> &shader)
+{
+  // 一度に処理する領域の幅と高さの組み合わせを候補にする (高さにはフィルタのはみ出し分を加える)
+  std::vector<std::array<GLint, 2>> sizes;
+  for (const GLint width : { 8, 16, 32 })
+  {
+    for (const GLint height : { 4, 8, 16 })
+    {
+      sizes.push_back({ width, height + static_cast<GLint>(filterApron) });
+    }
+  }
+  positionTuner.reset(new Autotuner(shader, sizes, roi[2], roi[3]));
+}
+
+// カメラ座標を求めるシェーダに埋め込むフィルタのサイズ
+const Compute::Defines &DepthCamera::getFilterDefines()
+{
+  // シェーダの filterSize.x は rowWeight の, filterSize.y は columnWeight の要素数
+  static const Compute::Defines defines
+  {
+    { "FILTER_WIDTH", std::to_string(filterSize[1]) },
+    { "FILTER_HEIGHT", std::to_string(filterSize[0]) }
+  };
+  return defines;
+}
+
+// デプスデータが更新されていればカメラ座標を求めたことにする
+bool DepthCamera::updatePoint()
+{
+  // 前にカメラ座標を求めたときからデプスデータが変わっていなければ求め直さない
+  if (pointFrame == depthFrame)
+  {
+    ++statistics.positionSkipped;
+    return false;
+  }
+
+  // このデプスデータからカメラ座標を求める
+  pointFrame = depthFrame;
+  ++statistics.positionExecuted;
+  return true;
+}
+
 // 法線ベクトルの計算
-GLuint DepthCamera::getNormal() const
+GLuint DepthCamera::getNormal()
 {
+  // 前に法線ベクトルを求めたときからカメラ座標が変わっていなければ求め直さない
+  if (normalFrame == pointFrame)
+  {
+    ++statistics.normalSkipped;
+    return normalBuffer;
+  }
+
+  // このカメラ座標から法線ベクトルを求める
+  normalFrame = pointFrame;
+  ++statistics.normalExecuted;
+
+  // 自動調整中なら候補のシェーダに切り替えて計測する
+  if (normalTuner && !normalTuner->begin(normal)) normalTuner.reset();
+
   normal->use();
   glUniform1i(pointLoc, PointImageUnit);
   glBindImageTexture(PointImageUnit, pointTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NormalBinding, normalBuffer);
-  normal->execute(depthWidth, depthHeight);
+  normal->dispatch(depthWidth, depthHeight);
+  if (normalTuner) normalTuner->end();
 
   return normalBuffer;
 }
 
+// 背景モデルによる前景の抽出を有効にする
+void DepthCamera::enableForeground()
+{
+  // すでに有効なら何もしない
+  if (modelTexture > 0) return;
+
+  // 背景モデルと前景を格納するテクスチャを準備する (イメージとしてしか使わない)
+  modelTexture = acquireTexture(GL_RGBA32F, depthWidth, depthHeight);
+  foregroundTexture = acquireTexture(GL_R32F, depthWidth, depthHeight);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  resetBackground();
+
+  // 背景モデルを更新して前景を求めるシェーダを用意する
+  background = Compute::share("background.comp");
+  backgroundPointLoc = glGetUniformLocation(background->get(), "point");
+  modelLoc = glGetUniformLocation(background->get(), "model");
+  foregroundLoc = glGetUniformLocation(background->get(), "foreground");
+}
+
+// 背景モデルを更新して前景を求める
+GLuint DepthCamera::getForeground()
+{
+  // 有効でないか前に前景を求めたときからカメラ座標が変わっていなければ求め直さない
+  if (modelTexture == 0 || foregroundFrame == pointFrame) return foregroundTexture;
+  foregroundFrame = pointFrame;
+
+  // カメラ座標の書き込みの完了を待つ
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+  background->use();
+  glUniform1i(backgroundPointLoc, PointImageUnit);
+  glUniform1i(modelLoc, ModelImageUnit);
+  glUniform1i(foregroundLoc, ForegroundImageUnit);
+  glBindImageTexture(PointImageUnit, pointTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+  glBindImageTexture(ModelImageUnit, modelTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+  glBindImageTexture(ForegroundImageUnit, foregroundTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  background->dispatch(depthWidth, depthHeight);
+
+  return foregroundTexture;
+}
+
+// 背景モデルを捨てて学習し直す
+void DepthCamera::resetBackground()
+{
+  // 学習したフレーム数を 0 にすれば最初から学習し直す (資源プールから再利用したものも初期化する)
+  if (modelTexture > 0) glClearTexImage(modelTexture, 0, GL_RGBA, GL_FLOAT, nullptr);
+  if (foregroundTexture > 0) glClearTexImage(foregroundTexture, 0, GL_RED, GL_FLOAT, nullptr);
+}
+
+// 境界ボックスによる視錐台カリングを有効にする
+void DepthCamera::enableCulling()
+{
+  // すでに有効なら何もしない
+  if (commandBuffer > 0) return;
+
+  // 行の組ごとの境界ボックスを格納するバッファオブジェクトを準備する (GPU でしか読み書きしない)
+  rowBuffer = acquireBuffer(depthHeight * sizeof (GLfloat[8]), 0);
+
+  // 行の組ごとの描画コマンドを格納するバッファオブジェクトを準備する (最初はすべての行を描く)
+  std::vector<std::array<GLuint, 4>> commands(roi[3] - 1);
+  for (size_t i = 0; i < commands.size(); ++i)
+  {
+    commands[i] = { static_cast<GLuint>(roi[2] * 2), 1, static_cast<GLuint>(roi[0] * 2), static_cast<GLuint>(roi[1] + i) };
+  }
+  commandBuffer = acquireBuffer(depthHeight * sizeof commands[0], GL_DYNAMIC_STORAGE_BIT);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof commands[0], commands.data());
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  // 全体の境界ボックスを読み出すバッファオブジェクトを準備して常にマップしておく
+  constexpr GLbitfield flags(GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+  glGenBuffers(1, &boxBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, boxBuffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof (GLuint[8]), nullptr, flags);
+  boxData = static_cast<const GLuint *>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof (GLuint[8]), flags));
+
+  // 境界ボックスを求めるシェーダを用意する
+  bounds = Compute::share("bounds.comp");
+  boundsPointLoc = glGetUniformLocation(bounds->get(), "point");
+  boundsRoiLoc = glGetUniformLocation(bounds->get(), "roi");
+  const GLuint rowIndex(glGetProgramResourceIndex(bounds->get(), GL_SHADER_STORAGE_BLOCK, "Rows"));
+  glShaderStorageBlockBinding(bounds->get(), rowIndex, RowBinding);
+  const GLuint boxIndex(glGetProgramResourceIndex(bounds->get(), GL_SHADER_STORAGE_BLOCK, "Box"));
+  glShaderStorageBlockBinding(bounds->get(), boxIndex, BoxBinding);
+
+  // 行ごとの描画コマンドを作るシェーダを用意する
+  culler = Compute::share("cull.comp");
+  cullerMvpLoc = glGetUniformLocation(culler->get(), "mvp");
+  cullerRoiLoc = glGetUniformLocation(culler->get(), "roi");
+  const GLuint cullerRowIndex(glGetProgramResourceIndex(culler->get(), GL_SHADER_STORAGE_BLOCK, "Rows"));
+  glShaderStorageBlockBinding(culler->get(), cullerRowIndex, RowBinding);
+  const GLuint commandIndex(glGetProgramResourceIndex(culler->get(), GL_SHADER_STORAGE_BLOCK, "Commands"));
+  glShaderStorageBlockBinding(culler->get(), commandIndex, CommandBinding);
+}
+
+// 行ごとと全体の境界ボックスを求める
+void DepthCamera::getBounds()
+{
+  // 有効でないか前に境界ボックスを求めたときからカメラ座標が変わっていなければ求め直さない
+  if (commandBuffer == 0 || boundsFrame == pointFrame) return;
+  boundsFrame = pointFrame;
+
+  // 前のフレームの全体の境界ボックスを求め終わっていれば上書きする前に読み出しておく
+  updateBox();
+
+  // 全体の境界ボックスを空にする
+  static const GLuint empty[] = { 0xffffffffu, 0u };
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, boxBuffer);
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof (GLuint[4]), GL_RED_INTEGER, GL_UNSIGNED_INT, &empty[0]);
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, sizeof (GLuint[4]), sizeof (GLuint[4]), GL_RED_INTEGER, GL_UNSIGNED_INT, &empty[1]);
+
+  // カメラ座標の書き込みの完了を待つ
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // 行の組ごとに一つのワークグループで境界ボックスを求める
+  bounds->use();
+  glUniform1i(boundsPointLoc, PointImageUnit);
+  glUniform4iv(boundsRoiLoc, 1, roi);
+  glBindImageTexture(PointImageUnit, pointTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RowBinding, rowBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BoxBinding, boxBuffer);
+  bounds->execute(1, roi[3] - 1);
+
+  // マップしたメモリから読めるようにして完了を待つフェンスを置く
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  if (boxFence) glDeleteSync(boxFence);
+  boxFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// 求め終わっていれば全体の境界ボックスを読み出す
+void DepthCamera::updateBox()
+{
+  // 求めていないか求め終わっていなければ前のものを使う
+  if (!boxFence || glClientWaitSync(boxFence, 0, 0) == GL_TIMEOUT_EXPIRED) return;
+  glDeleteSync(boxFence);
+  boxFence = nullptr;
+
+  // 大小の順序を保った符号なし整数を実数に戻す
+  for (int i = 0; i < 6; ++i)
+  {
+    const GLuint u(boxData[i < 3 ? i : i + 1]);
+    const GLuint bits((u & 0x80000000u) != 0u ? u & 0x7fffffffu : ~u);
+    std::memcpy(&box[i], &bits, sizeof bits);
+  }
+  boxValid = true;
+}
+
+// 全体の境界ボックスがクリッピング空間に入っていれば true を返す
+bool DepthCamera::isVisible(const GgMatrix &mvp)
+{
+  // 求め終わった最新の境界ボックスを使う (まだなければ見えることにする)
+  updateBox();
+  if (!boxValid) return true;
+
+  // 境界ボックスの頂点がクリッピング座標系の各平面の外側にある数を数える
+  int below[3] = { 0, 0, 0 }, above[3] = { 0, 0, 0 };
+  for (int k = 0; k < 8; ++k)
+  {
+    const GgVector c(mvp * GgVector{ box[(k & 1) * 3], box[((k >> 1) & 1) * 3 + 1], box[((k >> 2) & 1) * 3 + 2], 1.0f });
+    for (int j = 0; j < 3; ++j)
+    {
+      if (c[j] < -c[3]) ++below[j];
+      if (c[j] > c[3]) ++above[j];
+    }
+  }
+
+  // すべての頂点が一つの平面の外側にあれば見えない
+  for (int j = 0; j < 3; ++j) if (below[j] == 8 || above[j] == 8) return false;
+  return true;
+}
+
+// 全体が見えなければ false を返し, 見えれば見える行だけを描く描画コマンドを作る
+bool DepthCamera::cull(const GgMatrix &mvp)
+{
+  // 有効でなければすべて描く
+  if (commandBuffer == 0) return true;
+
+  // 全体が見えなければ描かない
+  if (!isVisible(mvp)) return false;
+
+  // 行の組ごとの境界ボックスの書き込みの完了を待つ
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // 行の組ごとに見えるかどうか調べて描画コマンドを作る
+  culler->use();
+  glUniformMatrix4fv(cullerMvpLoc, 1, GL_FALSE, mvp.get());
+  glUniform4iv(cullerRoiLoc, 1, roi);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, RowBinding, rowBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CommandBinding, commandBuffer);
+  culler->dispatch(roi[3] - 1, 1);
+
+  // 描画コマンドとして読めるようにする
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+  return true;
+}
+
 // バイラテラルフィルタの分散を設定する
 void DepthCamera::setVariance(float columnVariance, float rowVariance, float valueVariance) const
 {
-  // バイラテラルフィルタの距離に対する重み
-  Weight weight;
+  // 重みのバッファオブジェクトがまだなければ何もしない
+  if (!weight) return;
 
   // バイラテラルフィルタの距離に対する桁方向の重みを求める
-  const float offset1x(0.5f * static_cast<float>(weight.columnWeight.size() - 1));
-  for (size_t i = 0; i < weight.columnWeight.size(); ++i)
+  //   マップしたバッファオブジェクトに直接書き込むので転送は要らない
+  //   描画中に書き換えても重みがずれるのはそのフレームだけなので同期はとらない
+  const float offset1x(0.5f * static_cast<float>(weight->columnWeight.size() - 1));
+  for (size_t i = 0; i < weight->columnWeight.size(); ++i)
   {
     const float d(static_cast<float>(i) - offset1x);
-    weight.columnWeight[i] = exp(-0.5f * d * d / columnVariance);
+    weight->columnWeight[i] = exp(-0.5f * d * d / columnVariance);
   }
 
   // バイラテラルフィルタの距離に対する行方向の重みを求める
-  const float offset1y(0.5f * static_cast<float>(weight.rowWeight.size() - 1));
-  for (size_t i = 0; i < weight.rowWeight.size(); ++i)
+  const float offset1y(0.5f * static_cast<float>(weight->rowWeight.size() - 1));
+  for (size_t i = 0; i < weight->rowWeight.size(); ++i)
   {
     const float d(static_cast<float>(i) - offset1y);
-    weight.rowWeight[i] = exp(-0.5f * d * d / rowVariance);
+    weight->rowWeight[i] = exp(-0.5f * d * d / rowVariance);
   }
 
   // バイラテラルフィルタの値に対する分散を設定する
-  weight.variance = valueVariance;
-
-  // バイラテラルフィルタの距離に対する重みと値に対する分散を転送する
-  glBindBuffer(GL_SHADER_STORAGE_BUFFER, weightBuffer);
-  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof weight, &weight);
+  weight->variance = valueVariance;
 }
 
-// カメラ座標を計算するシェーダ
-std::unique_ptr<Compute> DepthCamera::normal(nullptr);
-
-// 描画するメッシュ
-std::unique_ptr<Mesh> DepthCamera::mesh(nullptr);
-
-// 法線ベクトルを求めるカメラ座標のイメージユニットの uniform 変数 point の場所
-GLuint DepthCamera::pointLoc;
+// 変わらないパラメータを格納した Uniform Buffer Object を作成する
+GLuint DepthCamera::makeParameter(const void *data, GLsizeiptr size)
+{
+  // 作成後は書き換えないので CPU からはアクセスできないようにする
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferStorage(GL_UNIFORM_BUFFER, size, data, 0);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  return buffer;
+}
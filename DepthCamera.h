@@ -8,14 +8,19 @@
 #include "gg.h"
 using namespace gg;
 
-// 計算用のシェーダ
+// 計算用のシェーダとワークグループのサイズの自動調整
 #include "Compute.h"
+#include "Autotuner.h"
 
 // メッシュの描画
 #include "Mesh.h"
 
+// テクスチャとバッファオブジェクトの資源プール
+#include "ResourcePool.h"
+
 // 標準ライブラリ
 #include <memory>
+#include <vector>
 
 class DepthCamera
 {
@@ -33,14 +38,79 @@ class DepthCamera
     float variance;
   };
 
+  // バイラテラルフィルタの重みのバッファオブジェクトをマップしたポインタ
+  Weight *weight;
+
+  // 資源プールから取り出したテクスチャとバッファオブジェクト (デストラクタで返却する)
+  std::vector<GLuint> textures, buffers;
+
   // カメラ座標における法線ベクトルを格納するバッファオブジェクト
   GLuint normalBuffer;
 
   // 法線ベクトルを計算するシェーダ
-  static std::unique_ptr<Compute> normal;
+  std::shared_ptr<Compute> normal;
 
   // 法線ベクトルを求めるカメラ座標のイメージユニットの uniform 変数 point の場所
-  static GLuint pointLoc;
+  GLint pointLoc;
+
+  // 法線ベクトルを計算するシェーダのワークグループのサイズの自動調整
+  std::unique_ptr<Autotuner> normalTuner;
+
+  // 背景モデルを更新して前景を求めるシェーダ
+  std::shared_ptr<Compute> background;
+
+  // 背景モデルを更新して前景を求めるシェーダの uniform 変数 point, model, foreground の場所
+  GLint backgroundPointLoc, modelLoc, foregroundLoc;
+
+  // 画素ごとの背景モデル (奥行きの平均と分散と学習したフレーム数) を格納するテクスチャ
+  GLuint modelTexture;
+
+  // 前景のカメラ座標の z 成分 (背景は 0) を格納するテクスチャ
+  GLuint foregroundTexture;
+
+  // 前景を求めたカメラ座標のフレーム数
+  unsigned long long foregroundFrame;
+
+  // 境界ボックスを求めるシェーダと行ごとの描画コマンドを作るシェーダ
+  std::shared_ptr<Compute> bounds, culler;
+
+  // 境界ボックスを求めるシェーダの uniform 変数 point, roi の場所
+  GLint boundsPointLoc, boundsRoiLoc;
+
+  // 行ごとの描画コマンドを作るシェーダの uniform 変数 mvp, roi の場所
+  GLint cullerMvpLoc, cullerRoiLoc;
+
+  // 行の組ごとの境界ボックスと描画コマンドを格納するバッファオブジェクト
+  GLuint rowBuffer, commandBuffer;
+
+  // 全体の境界ボックスを CPU に読み出すバッファオブジェクトとそれをマップしたメモリ (常にマップしておく)
+  GLuint boxBuffer;
+  const GLuint *boxData;
+
+  // 全体の境界ボックスを求め終わったことを調べるフェンス
+  GLsync boxFence;
+
+  // 最後に読み出した全体の境界ボックス (最小値と最大値, まだ読み出していなければ空)
+  std::array<GLfloat, 6> box;
+  bool boxValid;
+
+  // 境界ボックスを求めたカメラ座標のフレーム数
+  unsigned long long boundsFrame;
+
+  // 求め終わっていれば全体の境界ボックスを読み出す
+  void updateBox();
+
+  // カメラ座標を求めるシェーダのワークグループのサイズの自動調整
+  std::unique_ptr<Autotuner> positionTuner;
+
+  // YUYV のカラーデータを格納するテクスチャ
+  GLuint yuyvTexture;
+
+  // YUYV のカラーデータを RGB に変換するシェーダ
+  std::shared_ptr<Compute> decoder;
+
+  // YUYV のカラーデータを RGB に変換するシェーダの uniform 変数 yuyv と color の場所
+  GLint yuyvLoc, colorLoc;
 
 protected:
 
@@ -68,6 +138,15 @@ protected:
   // デプスデータを格納するテクスチャ
   GLuint depthTexture;
 
+  // 受け取ったデプスデータのフレーム数 (新しいデプスデータを受け取るたびに増やす)
+  unsigned long long depthFrame;
+
+  // カメラ座標を求めたデプスデータのフレーム数
+  unsigned long long pointFrame;
+
+  // 法線ベクトルを求めたカメラ座標のフレーム数
+  unsigned long long normalFrame;
+
   // カラーセンサのサイズ
   int colorWidth, colorHeight;
 
@@ -80,14 +159,77 @@ protected:
   // カメラ座標に対応したテクスチャ座標を格納するバッファオブジェクト
   GLuint uvmapBuffer;
 
-  // バイラテラルフィルタの距離に対する重みを格納する Shader Storage Buffer Object
+  // バイラテラルフィルタの距離に対する重みを格納する Shader Storage Buffer Object (常にマップしておく)
   GLuint weightBuffer;
 
+  // カメラ座標を求めるシェーダに渡す変わらないパラメータの Uniform Buffer Object
+  GLuint parameterBuffer;
+
+  // 変わらないパラメータを格納した Uniform Buffer Object を作成する
+  static GLuint makeParameter(const void *data, GLsizeiptr size);
+
   // テクスチャとバッファオブジェクトを作成してポイント数を返す
   int makeTexture();
 
-  // 描画するメッシュ
-  static std::unique_ptr<Mesh> mesh;
+  // 資源プールからテクスチャを取り出す (デストラクタで返却する)
+  GLuint acquireTexture(GLenum format, GLsizei width, GLsizei height);
+
+  // 資源プールからバッファオブジェクトを取り出す (デストラクタで返却する)
+  GLuint acquireBuffer(GLsizeiptr size, GLbitfield flags);
+
+  // 描画するメッシュ (デプスセンサの解像度ごとに共有する)
+  std::shared_ptr<Mesh> mesh;
+
+  // カメラ座標を求めて描画する領域 (カメラ座標のテクスチャ上の左下の位置と幅と高さ)
+  GLint roi[4];
+
+  // カメラ座標を求めて描画する領域をデプスデータ上の左上の位置と幅と高さで設定する (makeTexture() の後で呼ぶ)
+  //   幅か高さが 0 なら全体にする, デプスデータからはみ出さないようにする
+  void setRoi(int left, int top, int width, int height);
+
+  // デプスデータが更新されていればカメラ座標を求めたことにして true を返す (更新されていなければ false)
+  bool updatePoint();
+
+  // YUYV のカラーデータを格納するテクスチャを作成する (makeTexture() の後で呼ぶ)
+  void makeYuyvTexture();
+
+  // YUYV のカラーデータをテクスチャに転送して RGB に変換する
+  void setYuyv(const void *data) const;
+
+  // カメラ座標を求めるシェーダに埋め込むフィルタのサイズ
+  static const Compute::Defines &getFilterDefines();
+
+  // カメラ座標を求めるシェーダのワークグループの高さのうちフィルタのはみ出し分
+  static constexpr GLuint filterApron = filterSize[0] / 2 * 2;
+
+  // カメラ座標を求めるシェーダのワークグループのサイズを自動調整する (makeTexture() と setRoi() の後で呼ぶ)
+  void tunePosition(std::shared_ptr<Compute> &shader);
+
+  // 自動調整中ならカメラ座標を求めるシェーダを候補に切り替えて計測を開始する
+  void beginPosition(std::shared_ptr<Compute> &shader)
+  {
+    if (positionTuner && !positionTuner->begin(shader)) positionTuner.reset();
+  }
+
+  // 自動調整中ならカメラ座標を求めるシェーダの計測を終了する
+  void endPosition()
+  {
+    if (positionTuner) positionTuner->end();
+  }
+
+public:
+
+  // カメラ座標と法線ベクトルの計算を実行した回数と省略した回数
+  struct Statistics
+  {
+    unsigned long long positionExecuted, positionSkipped;
+    unsigned long long normalExecuted, normalSkipped;
+  };
+
+private:
+
+  // カメラ座標と法線ベクトルの計算を実行した回数と省略した回数
+  Statistics statistics;
 
 public:
 
@@ -102,7 +244,19 @@ public:
   {
     DepthImageUnit = 0,
     PointImageUnit,
-    MapperImageUnit
+    MapperImageUnit,
+
+    // Rs400 でデプスデータをカラーデータに合わせるときに使う
+    RawImageUnit,
+    AlignImageUnit,
+
+    // YUYV のカラーデータの変換に使う
+    YuyvImageUnit,
+    ColorImageUnit,
+
+    // 前景の抽出に使う
+    ModelImageUnit,
+    ForegroundImageUnit
   };
 
   // 結合ポイント
@@ -111,7 +265,36 @@ public:
     // 0, 1 は GgSimpleShader で使っている
     UvmapBinding = 2,
     WeightBinding,
-    NormalBinding
+    NormalBinding,
+
+    // VoxelHash で使う
+    TableBinding,
+    VoxelBinding,
+
+    // PointExporter で使う
+    ExportBinding,
+
+    // SensorBatch で使う
+    InstanceBinding,
+
+    // 視錐台カリングに使う
+    RowBinding,
+    BoxBinding,
+    CommandBinding,
+
+    // MeshExtractor で使う
+    VolumeBinding,
+    CellBinding,
+    VertexOffsetBinding,
+    TriangleOffsetBinding,
+    TotalBinding,
+    ScanBinding,
+    SumBinding,
+    MeshVertexBinding,
+    MeshIndexBinding,
+
+    // センサごとの変わらないパラメータの Uniform Buffer Object に使う
+    ParameterBinding
   };
 
   // コンストラクタ
@@ -132,6 +315,18 @@ public:
     return message == nullptr;
   }
 
+  // 受け取ったデプスデータのフレーム数を得る (変わっていなければカメラ座標も変わらない)
+  unsigned long long getDepthFrame() const
+  {
+    return depthFrame;
+  }
+
+  // カメラ座標と法線ベクトルの計算を実行した回数と省略した回数を得る
+  const Statistics &getStatistics() const
+  {
+    return statistics;
+  }
+
   // デプスセンサのサイズを得る
   void getDepthResolution(int *width, int *height) const
   {
@@ -176,8 +371,39 @@ public:
     return normalBuffer;
   }
 
-  // 法線ベクトルの計算
-  GLuint getNormal() const;
+  // 法線ベクトルの計算 (カメラ座標が更新されていなければ何もしない)
+  GLuint getNormal();
+
+  // 資源プールから取り出したテクスチャとバッファオブジェクトのメモリ量 (バイト) を得る
+  GLsizeiptr getMemory() const;
+
+  // 背景モデルによる前景の抽出を有効にする (makeTexture() の後で呼ぶ)
+  void enableForeground();
+
+  // 背景モデルを更新して前景を求める (有効でないかカメラ座標が更新されていなければ何もしない)
+  GLuint getForeground();
+
+  // 背景モデルを捨てて学習し直す
+  void resetBackground();
+
+  // 境界ボックスによる視錐台カリングを有効にする (makeTexture() と setRoi() の後で呼ぶ)
+  void enableCulling();
+
+  // 行ごとと全体の境界ボックスを求める (有効でないかカメラ座標が更新されていなければ何もしない)
+  void getBounds();
+
+  // 全体の境界ボックスがクリッピング空間に入っていれば true を返す (mvp はモデルビュー投影変換行列)
+  //   GPU を待たないように読み出し終わった最新の境界ボックスを使い, まだなければ true を返す
+  bool isVisible(const GgMatrix &mvp);
+
+  // 全体が見えなければ false を返し, 見えれば見える行だけを描く描画コマンドを作って true を返す
+  bool cull(const GgMatrix &mvp);
+
+  // 前景のカメラ座標の z 成分 (背景は 0) を格納するテクスチャを得る (有効でなければ 0)
+  GLuint getForegroundTexture() const
+  {
+    return foregroundTexture;
+  }
 
   // バイラテラルフィルタの分散を設定する
   void setVariance(float columnVariance, float rowVariance, float valueVariance) const;
@@ -185,10 +411,26 @@ public:
   // デプスセンサの姿勢
   GgMatrix attitude;
 
-  // 目種の描画
+  // 目種の描画 (カメラ座標を求める領域だけを描き, cull() を呼んでいれば見える行だけを描く)
   void draw()
   {
-    mesh->draw(depthWidth, depthHeight);
+    if (commandBuffer > 0)
+      mesh->draw(commandBuffer, roi[3] - 1);
+    else
+      mesh->draw(roi);
+  }
+
+  // カメラ座標を求めて描画する領域 (カメラ座標のテクスチャ上の左下の位置と幅と高さ) を得る
+  const GLint *getRoi() const
+  {
+    return roi;
+  }
+
+  // 疑似カラー処理の範囲を得る
+  virtual const GLfloat *getRange() const
+  {
+    static constexpr GLfloat range[2] = { 0.3f, 5.0f };
+    return range;
   }
 
   // デプスデータを取得する
@@ -0,0 +1,1017 @@
+﻿//
+// 点群のネットワーク配信
+//
+
+// ソケット
+#ifdef _WIN32
+#  include <winsock2.h>
+#  include <ws2tcpip.h>
+#  pragma comment(lib, "ws2_32.lib")
+#else
+#  include <netdb.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/select.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <unistd.h>
+#endif
+
+#include "DepthStream.h"
+
+// OpenCV
+#include <opencv2/imgcodecs.hpp>
+#ifdef _WIN32
+#  define CV_VERSION_STR CVAUX_STR(CV_MAJOR_VERSION) CVAUX_STR(CV_MINOR_VERSION) CVAUX_STR(CV_SUBMINOR_VERSION)
+#  ifdef _DEBUG
+#    define CV_EXT_STR "d.lib"
+#  else
+#    define CV_EXT_STR ".lib"
+#  endif
+#  pragma comment(lib, "opencv_imgcodecs" CV_VERSION_STR CV_EXT_STR)
+#endif
+
+// 標準ライブラリ
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+// ソケットの違いを吸収する
+#ifdef _WIN32
+using socklen_t = int;
+static void closeSocket(std::intptr_t s) { closesocket(static_cast<SOCKET>(s)); }
+static void shutdownSocket(std::intptr_t s) { shutdown(static_cast<SOCKET>(s), SD_BOTH); }
+#else
+static void closeSocket(std::intptr_t s) { close(static_cast<int>(s)); }
+static void shutdownSocket(std::intptr_t s) { shutdown(static_cast<int>(s), SHUT_RDWR); }
+#endif
+#ifndef MSG_NOSIGNAL
+#  define MSG_NOSIGNAL 0
+#endif
+
+// 無効なソケット
+constexpr std::intptr_t invalidSocket(-1);
+
+// パケットの識別子
+static constexpr char streamMagic[4] = { 'G', 'D', 'S', 'T' };
+
+// Rice 符号のブロックの要素数
+constexpr int riceBlock(64);
+
+// Rice 符号のパラメータのビット数
+constexpr int riceParameterBits(5);
+
+// すべて 0 のブロックを表す Rice 符号のパラメータ
+constexpr int riceZeroBlock((1 << riceParameterBits) - 1);
+
+// Rice 符号の商がこれ以上なら値をそのまま書く
+constexpr int riceEscape(24);
+
+// そのまま書く値のビット数 (16bit の差分のジグザグ符号)
+constexpr int riceRawBits(17);
+
+// 受け取るパケットのデータのバイト数の上限
+constexpr std::uint32_t maxPacketSize(1 << 28);
+
+// 受け取るパケットのセンサの番号の上限
+constexpr std::uint32_t maxSensors(256);
+
+// 送り直すカラーのタイルの画素あたりの差の平均の閾値
+constexpr double tileThreshold(2.0);
+
+// ソケットの初期化
+static void startup()
+{
+#ifdef _WIN32
+  WSADATA data;
+  WSAStartup(MAKEWORD(2, 2), &data);
+#endif
+}
+
+// ソケットの後始末
+static void cleanup()
+{
+#ifdef _WIN32
+  WSACleanup();
+#endif
+}
+
+// 指定したバイト数をすべて送る
+static bool sendAll(std::intptr_t s, const void *data, size_t size)
+{
+  const char *p(static_cast<const char *>(data));
+  while (size > 0)
+  {
+    const int n(static_cast<int>(::send(s, p, static_cast<int>(std::min(size, size_t(1 << 20))), MSG_NOSIGNAL)));
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+//
+// ビット列の書き込み (下位ビットから詰める)
+//
+class BitWriter
+{
+  // 書き込み先
+  std::vector<std::uint8_t> &out;
+
+  // まだ書き出していないビット
+  std::uint64_t bits;
+
+  // まだ書き出していないビット数
+  int count;
+
+public:
+
+  // コンストラクタ
+  BitWriter(std::vector<std::uint8_t> &out)
+    : out(out)
+    , bits(0)
+    , count(0)
+  {
+  }
+
+  // 値 v の下位 n ビット (n <= 32) を書き込む
+  void put(std::uint32_t v, int n)
+  {
+    bits |= static_cast<std::uint64_t>(v) << count;
+    count += n;
+    while (count >= 8)
+    {
+      out.push_back(static_cast<std::uint8_t>(bits));
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+
+  // 残りのビットを書き出す
+  void flush()
+  {
+    if (count > 0) out.push_back(static_cast<std::uint8_t>(bits));
+    bits = 0;
+    count = 0;
+  }
+};
+
+//
+// ビット列の読み出し (下位ビットから取り出す)
+//
+class BitReader
+{
+  // 読み出し位置と終端
+  const std::uint8_t *p, *const end;
+
+  // まだ取り出していないビット
+  std::uint64_t bits;
+
+  // まだ取り出していないビット数
+  int count;
+
+public:
+
+  // コンストラクタ
+  BitReader(const std::uint8_t *data, size_t size)
+    : p(data)
+    , end(data + size)
+    , bits(0)
+    , count(0)
+  {
+  }
+
+  // n ビット (n <= 32) を取り出す
+  std::uint32_t get(int n)
+  {
+    while (count < n)
+    {
+      bits |= static_cast<std::uint64_t>(p < end ? *p++ : 0) << count;
+      count += 8;
+    }
+    const std::uint32_t v(static_cast<std::uint32_t>(bits & ((std::uint64_t(1) << n) - 1)));
+    bits >>= n;
+    count -= n;
+    return v;
+  }
+};
+
+// 差分をジグザグ符号にする
+static std::uint32_t zigzag(int r)
+{
+  return (static_cast<std::uint32_t>(r) << 1) ^ static_cast<std::uint32_t>(r >> 31);
+}
+
+// ジグザグ符号を差分に戻す
+static int unzigzag(std::uint32_t v)
+{
+  return static_cast<int>(v >> 1) ^ -static_cast<int>(v & 1);
+}
+
+// 値の並びをブロックごとに適応的な Rice 符号で書き込む
+static void riceEncode(const std::uint32_t *v, size_t n, BitWriter &writer)
+{
+  for (size_t b = 0; b < n; b += riceBlock)
+  {
+    const size_t m(std::min(n - b, size_t(riceBlock)));
+
+    // ブロックの合計
+    std::uint64_t sum(0);
+    for (size_t i = 0; i < m; ++i) sum += v[b + i];
+
+    // すべて 0 ならパラメータだけを書く
+    if (sum == 0)
+    {
+      writer.put(riceZeroBlock, riceParameterBits);
+      continue;
+    }
+
+    // 平均値に近い 2 のべき乗をパラメータにする
+    int k(0);
+    while (k < riceRawBits - 1 && (static_cast<std::uint64_t>(m) << (k + 1)) <= sum) ++k;
+    writer.put(k, riceParameterBits);
+
+    // 商を unary 符号で, 余りをそのまま書く
+    for (size_t i = 0; i < m; ++i)
+    {
+      const std::uint32_t q(v[b + i] >> k);
+      if (q < riceEscape)
+      {
+        writer.put((1u << q) - 1, static_cast<int>(q) + 1);
+        writer.put(v[b + i] & ((1u << k) - 1), k);
+      }
+      else
+      {
+        writer.put((1u << riceEscape) - 1, riceEscape);
+        writer.put(v[b + i], riceRawBits);
+      }
+    }
+  }
+}
+
+// ブロックごとに適応的な Rice 符号を読み出す
+static void riceDecode(BitReader &reader, std::uint32_t *v, size_t n)
+{
+  for (size_t b = 0; b < n; b += riceBlock)
+  {
+    const size_t m(std::min(n - b, size_t(riceBlock)));
+
+    // すべて 0 のブロック
+    const int k(static_cast<int>(reader.get(riceParameterBits)));
+    if (k == riceZeroBlock)
+    {
+      std::fill(v + b, v + b + m, 0u);
+      continue;
+    }
+
+    for (size_t i = 0; i < m; ++i)
+    {
+      // unary 符号の商
+      std::uint32_t q(0);
+      while (q < riceEscape && reader.get(1)) ++q;
+
+      v[b + i] = q < riceEscape ? (q << k) | reader.get(k) : reader.get(riceRawBits);
+    }
+  }
+}
+
+// 受け取ったヘッダの内容が互いに矛盾していなければ true
+static bool checkHeader(const DepthStreamHeader &h)
+{
+  // データのバイト数とセンサの番号とカラーのサイズの上限
+  if (h.size > maxPacketSize || h.depthSize > h.size || h.sensor >= maxSensors
+    || size_t(h.colorWidth) * h.colorHeight * 3 > maxPacketSize) return false;
+
+  // 符号化したデプスで表せる画素数より多ければ壊れている (すべて 0 のブロックでも 1 ブロックにパラメータを書く)
+  const size_t count(size_t(h.depthWidth) * h.depthHeight);
+  if (count > (size_t(h.depthSize) * 8 / riceParameterBits + 1) * riceBlock) return false;
+
+  // タイルがなければ残りのデータはないはず
+  if (h.tileCount == 0) return h.depthSize == h.size;
+
+  // タイルの数はカラーを分割した数以下で, タイルごとに位置とサイズと 1 バイト以上のデータがあるはず
+  if (h.tileSize == 0 || h.colorWidth == 0 || h.colorHeight == 0) return false;
+  const size_t tiles(size_t((h.colorWidth + h.tileSize - 1) / h.tileSize) * ((h.colorHeight + h.tileSize - 1) / h.tileSize));
+  const size_t record(2 * sizeof (std::uint16_t) + sizeof (std::uint32_t) + 1);
+  return h.tileCount <= tiles && size_t(h.size - h.depthSize) >= h.tileCount * record;
+}
+
+// センサごとの状態のコンストラクタ
+DepthStream::Channel::Channel(int depthWidth, int depthHeight, int colorWidth, int colorHeight, size_t slots)
+  : depthWidth(depthWidth)
+  , depthHeight(depthHeight)
+  , colorWidth(colorWidth)
+  , colorHeight(colorHeight)
+  , slot(slots)
+  , next(0)
+  , frame(0)
+  , keyRequest(true)
+{
+  // ピクセルバッファオブジェクトのサイズ
+  const GLsizeiptr depthSize(depthWidth * depthHeight * sizeof (GLfloat));
+  const GLsizeiptr colorSize(colorWidth * colorHeight * 3);
+
+  // 永続的にマップする
+  constexpr GLbitfield flags(GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+
+  for (auto &s : slot)
+  {
+    glGenBuffers(1, &s.depthBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.depthBuffer);
+    glBufferStorage(GL_PIXEL_PACK_BUFFER, depthSize, nullptr, flags);
+    s.depth = static_cast<const GLfloat *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, depthSize, flags));
+
+    glGenBuffers(1, &s.colorBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.colorBuffer);
+    glBufferStorage(GL_PIXEL_PACK_BUFFER, colorSize, nullptr, flags);
+    s.color = static_cast<const GLubyte *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, colorSize, flags));
+
+    s.fence = nullptr;
+    s.busy = false;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// センサごとの状態のデストラクタ
+DepthStream::Channel::~Channel()
+{
+  for (auto &s : slot)
+  {
+    if (s.fence) glDeleteSync(s.fence);
+    for (const GLuint buffer : { s.depthBuffer, s.colorBuffer })
+    {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glDeleteBuffers(1, &buffer);
+    }
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// コンストラクタ (TCP)
+DepthStream::DepthStream(int port, GLfloat depthScale, GLfloat maxDistance,
+  std::uint32_t keyInterval, int tileSize, int quality, size_t maxQueue, size_t slots)
+  : depthScale(depthScale)
+  , maxDistance(maxDistance)
+  , keyInterval(std::max(keyInterval, std::uint32_t(1)))
+  , tileSize(std::max(tileSize, 8))
+  , quality(quality)
+  , maxQueue(std::max(maxQueue, size_t(1)))
+  , slots(std::max(slots, size_t(2)))
+  , listener(invalidSocket)
+  , quit(false)
+  , captured(0)
+  , sent(0)
+  , dropped(0)
+{
+  startup();
+
+  // 待ち受けソケットを作る
+  listener = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  const int yes(1);
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&yes), sizeof yes);
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(static_cast<unsigned short>(port));
+  if (listener == invalidSocket
+    || bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof address) != 0)
+  {
+    if (listener != invalidSocket) closeSocket(listener);
+    cleanup();
+    throw std::runtime_error("配信用のポートが開けません");
+  }
+
+  start();
+}
+
+#ifndef _WIN32
+// コンストラクタ (Unix ドメインソケット)
+DepthStream::DepthStream(const std::string &path, GLfloat depthScale, GLfloat maxDistance,
+  std::uint32_t keyInterval, int tileSize, int quality, size_t maxQueue, size_t slots)
+  : depthScale(depthScale)
+  , maxDistance(maxDistance)
+  , keyInterval(std::max(keyInterval, std::uint32_t(1)))
+  , tileSize(std::max(tileSize, 8))
+  , quality(quality)
+  , maxQueue(std::max(maxQueue, size_t(1)))
+  , slots(std::max(slots, size_t(2)))
+  , listener(invalidSocket)
+  , path(path)
+  , quit(false)
+  , captured(0)
+  , sent(0)
+  , dropped(0)
+{
+  // 待ち受けソケットを作る
+  listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof address.sun_path - 1);
+  unlink(path.c_str());
+  if (listener == invalidSocket
+    || bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof address) != 0)
+  {
+    if (listener != invalidSocket) closeSocket(listener);
+    throw std::runtime_error("配信用のソケットが開けません");
+  }
+
+  start();
+}
+#endif
+
+// デストラクタ
+DepthStream::~DepthStream()
+{
+  // スレッドを止める
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    quit = true;
+  }
+  queueCondition.notify_one();
+  encoder.join();
+  acceptor.join();
+
+  // すべてのクライアントを切断する
+  for (auto &client : clients)
+  {
+    {
+      std::lock_guard<std::mutex> lock(client->mutex);
+      client->alive = false;
+    }
+    client->condition.notify_one();
+
+    // 読み出さないクライアントへの送信で止まっていても戻るようにする
+    shutdownSocket(client->socket);
+    client->sender.join();
+    closeSocket(client->socket);
+  }
+
+  // 待ち受けソケットを閉じる
+  closeSocket(listener);
+#ifndef _WIN32
+  if (!path.empty()) unlink(path.c_str());
+#endif
+  cleanup();
+}
+
+// 待ち受けを開始してスレッドを起動する
+void DepthStream::start()
+{
+  listen(listener, SOMAXCONN);
+  encoder = std::thread([this]() { encode(); });
+  acceptor = std::thread([this]() { accept(); });
+}
+
+// センサ id のデプスとカラーの読み出しを開始する
+bool DepthStream::capture(const DepthCamera &sensor, int id)
+{
+  // デプスセンサとカラーセンサのサイズ
+  int depthWidth, depthHeight, colorWidth, colorHeight;
+  sensor.getDepthResolution(&depthWidth, &depthHeight);
+  sensor.getColorResolution(&colorWidth, &colorHeight);
+
+  // センサの状態がなければ作る (使用中のスロットがあれば作り直さない)
+  if (id >= static_cast<int>(channel.size())) channel.resize(id + 1);
+  if (!channel[id])
+  {
+    channel[id].reset(new Channel(depthWidth, depthHeight, colorWidth, colorHeight, slots));
+  }
+  else if (channel[id]->depthWidth != depthWidth || channel[id]->depthHeight != depthHeight
+    || channel[id]->colorWidth != colorWidth || channel[id]->colorHeight != colorHeight)
+  {
+    if (std::any_of(channel[id]->slot.begin(), channel[id]->slot.end(),
+      [](const Slot &s) { return s.fence || s.busy; })) return false;
+    channel[id].reset(new Channel(depthWidth, depthHeight, colorWidth, colorHeight, slots));
+  }
+
+  // 次に使うスロット
+  Channel &c(*channel[id]);
+  Slot &slot(c.slot[c.next]);
+
+  // スロットがまだ読み出し中か符号化中なら描画を止めないようにこのフレームは捨てる
+  if (slot.fence || slot.busy) return false;
+
+  // シェーダが書き込んだテクスチャを読み出せるようにする
+  glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+  // カメラ座標の z 成分を読み出す (前景を抽出していれば前景だけにする)
+  const GLuint foreground(sensor.getForegroundTexture());
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.depthBuffer);
+  glBindTexture(GL_TEXTURE_2D, foreground != 0 ? foreground : sensor.getPointTexture());
+  glGetTexImage(GL_TEXTURE_2D, 0, foreground != 0 ? GL_RED : GL_BLUE, GL_FLOAT, nullptr);
+
+  // カラーを読み出す
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.colorBuffer);
+  glBindTexture(GL_TEXTURE_2D, sensor.getColorTexture());
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+  // 読み出しの完了を待つフェンスを置く
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.attitude = sensor.attitude;
+
+  // 読み出し中のスロットに加える
+  pending.push_back(Job{ id, &c, &slot });
+  c.next = (c.next + 1) % c.slot.size();
+  ++captured;
+
+  return true;
+}
+
+// 読み出しの完了したスロットを符号化スレッドに渡す
+void DepthStream::update()
+{
+  while (!pending.empty())
+  {
+    // GPU 側の処理が終わっていなければ待たずに戻る
+    Slot &slot(*pending.front().slot);
+    const GLenum status(glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0));
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+    // フェンスを削除する
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    // 符号化スレッドに渡す
+    slot.busy = true;
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      queue.push_back(pending.front());
+    }
+    queueCondition.notify_one();
+    pending.pop_front();
+  }
+}
+
+// 接続しているクライアントの数を得る
+size_t DepthStream::getClientCount()
+{
+  std::lock_guard<std::mutex> lock(clientMutex);
+  return std::count_if(clients.begin(), clients.end(),
+    [](const std::unique_ptr<Client> &c) { return c->alive.load(); });
+}
+
+// 符号化スレッドの処理
+void DepthStream::encode()
+{
+  for (;;)
+  {
+    // 仕事を取り出す
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueCondition.wait(lock, [this]() { return quit || !queue.empty(); });
+      if (quit) return;
+      job = queue.front();
+      queue.pop_front();
+    }
+
+    // 接続しているクライアントがなければ符号化しない
+    if (getClientCount() == 0)
+    {
+      job.slot->busy = false;
+      continue;
+    }
+
+    // パケットにする
+    const Packet packet(pack(job));
+
+    // すべてのクライアントに送る
+    const auto *header(reinterpret_cast<const DepthStreamHeader *>(packet->data()));
+    broadcast(job, header->keyframe != 0, packet);
+
+    // スロットを空ける (これより後はセンサの状態が作り直されることがあるので触らない)
+    job.slot->busy = false;
+  }
+}
+
+// スロットの内容をパケットにする
+DepthStream::Packet DepthStream::pack(const Job &job)
+{
+  // このスロットのセンサの状態 (使用中のスロットがある間は作り直されない)
+  Channel &c(*job.channel);
+  const Slot &slot(*job.slot);
+  const size_t count(c.depthWidth * c.depthHeight);
+
+  // キーフレームにするかどうか
+  const bool keyframe(c.keyRequest.exchange(false) || c.frame % keyInterval == 0 || c.depth.size() != count);
+
+  // パケット
+  auto packet(std::make_shared<std::vector<std::uint8_t>>(sizeof (DepthStreamHeader)));
+  packet->reserve(count);
+
+  // ヘッダ
+  DepthStreamHeader header{};
+  memcpy(header.magic, streamMagic, sizeof header.magic);
+  header.sensor = job.id;
+  header.frame = c.frame++;
+  header.keyframe = keyframe ? 1 : 0;
+  header.depthWidth = c.depthWidth;
+  header.depthHeight = c.depthHeight;
+  header.colorWidth = c.colorWidth;
+  header.colorHeight = c.colorHeight;
+  header.depthScale = depthScale;
+  memcpy(header.attitude, slot.attitude.get(), sizeof header.attitude);
+  header.tileSize = tileSize;
+
+  // デプスを量子化する (計測範囲外は 0)
+  std::vector<std::uint16_t> depth(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const GLfloat z(-slot.depth[i]);
+    depth[i] = z > 0.0f && z < maxDistance
+      ? static_cast<std::uint16_t>(std::min(z / depthScale + 0.5f, 65535.0f)) : 0;
+  }
+
+  // キーフレームなら左 (行頭は上) の画素, そうでなければ直前のフレームとの差分を求める
+  std::vector<std::uint32_t> residual(count);
+  if (keyframe)
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      const int p(i % c.depthWidth > 0 ? depth[i - 1] : i >= size_t(c.depthWidth) ? depth[i - c.depthWidth] : 0);
+      residual[i] = zigzag(depth[i] - p);
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < count; ++i) residual[i] = zigzag(depth[i] - c.depth[i]);
+  }
+
+  // 差分を符号化する
+  BitWriter writer(*packet);
+  riceEncode(residual.data(), count, writer);
+  writer.flush();
+  header.depthSize = static_cast<std::uint32_t>(packet->size() - sizeof header);
+  c.depth.swap(depth);
+
+  // 変化したカラーのタイルを JPEG で圧縮する
+  if (c.colorWidth > 0 && c.colorHeight > 0)
+  {
+    const cv::Mat color(c.colorHeight, c.colorWidth, CV_8UC3, const_cast<GLubyte *>(slot.color));
+    if (keyframe || c.color.size() != color.size()) c.color = cv::Mat::zeros(color.size(), CV_8UC3);
+
+    const std::vector<int> params{ cv::IMWRITE_JPEG_QUALITY, quality };
+    std::vector<std::uint8_t> jpeg;
+    for (int y = 0; y < c.colorHeight; y += tileSize)
+    {
+      for (int x = 0; x < c.colorWidth; x += tileSize)
+      {
+        // タイルの領域
+        const cv::Rect rect(x, y, std::min(tileSize, c.colorWidth - x), std::min(tileSize, c.colorHeight - y));
+        const cv::Mat tile(color(rect)), last(c.color(rect));
+
+        // 直前に送ったタイルからあまり変化していなければ送らない
+        if (!keyframe && cv::norm(tile, last, cv::NORM_L1) <= tileThreshold * tile.total() * 3) continue;
+
+        // タイルを圧縮する
+        cv::imencode(".jpg", tile, jpeg, params);
+        tile.copyTo(last);
+
+        // タイルの位置とサイズと圧縮したデータ
+        const std::uint16_t position[] = { static_cast<std::uint16_t>(x / tileSize), static_cast<std::uint16_t>(y / tileSize) };
+        const std::uint32_t size(static_cast<std::uint32_t>(jpeg.size()));
+        const auto *p(reinterpret_cast<const std::uint8_t *>(position));
+        const auto *s(reinterpret_cast<const std::uint8_t *>(&size));
+        packet->insert(packet->end(), p, p + sizeof position);
+        packet->insert(packet->end(), s, s + sizeof size);
+        packet->insert(packet->end(), jpeg.begin(), jpeg.end());
+        ++header.tileCount;
+      }
+    }
+  }
+
+  // ヘッダを書き込む
+  header.size = static_cast<std::uint32_t>(packet->size() - sizeof header);
+  memcpy(packet->data(), &header, sizeof header);
+
+  return packet;
+}
+
+// パケットをすべてのクライアントの送信待ちに加える
+void DepthStream::broadcast(const Job &job, bool keyframe, const Packet &packet)
+{
+  const int id(job.id);
+
+  std::lock_guard<std::mutex> lock(clientMutex);
+  bool delivered(false);
+
+  for (auto &client : clients)
+  {
+    std::lock_guard<std::mutex> clientLock(client->mutex);
+    if (!client->alive) continue;
+
+    // このセンサのキーフレームをまだ受け取っていなければ差分は送れないのでキーフレームを要求する
+    if (id >= static_cast<int>(client->synchronized.size())) client->synchronized.resize(id + 1, false);
+    if (!client->synchronized[id] && !keyframe)
+    {
+      job.channel->keyRequest = true;
+      continue;
+    }
+
+    // 送信待ちがあふれたら捨てて次のキーフレームから送り直す
+    if (client->queue.size() >= maxQueue)
+    {
+      client->synchronized[id] = false;
+      job.channel->keyRequest = true;
+      ++dropped;
+      continue;
+    }
+
+    client->synchronized[id] = true;
+    client->queue.push_back(packet);
+    client->condition.notify_one();
+    delivered = true;
+  }
+
+  if (delivered) ++sent;
+}
+
+// 接続受付スレッドの処理
+void DepthStream::accept()
+{
+  while (!quit)
+  {
+    // 接続要求を待つ (終了を確認するためにタイムアウトする)
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(listener, &readable);
+    timeval timeout{ 0, 100000 };
+    if (select(static_cast<int>(listener + 1), &readable, nullptr, nullptr, &timeout) > 0)
+    {
+      // 接続を受け付ける
+      const std::intptr_t s(::accept(listener, nullptr, nullptr));
+      if (s != invalidSocket)
+      {
+        // 小さなヘッダを待たせない
+        const int yes(1);
+        if (path.empty()) setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&yes), sizeof yes);
+
+        // クライアントを追加して送信スレッドを起動する
+        std::unique_ptr<Client> client(new Client);
+        client->socket = s;
+        client->alive = true;
+        client->sender = std::thread(send, client.get());
+
+        std::lock_guard<std::mutex> lock(clientMutex);
+        clients.emplace_back(std::move(client));
+      }
+    }
+
+    // 切断されたクライアントを取り除く
+    std::lock_guard<std::mutex> lock(clientMutex);
+    for (auto c = clients.begin(); c != clients.end();)
+    {
+      if ((*c)->alive)
+      {
+        ++c;
+        continue;
+      }
+      (*c)->sender.join();
+      closeSocket((*c)->socket);
+      c = clients.erase(c);
+    }
+  }
+}
+
+// 送信スレッドの処理
+void DepthStream::send(Client *client)
+{
+  for (;;)
+  {
+    // 送信待ちのパケットを取り出す
+    Packet packet;
+    {
+      std::unique_lock<std::mutex> lock(client->mutex);
+      client->condition.wait(lock, [client]() { return !client->alive || !client->queue.empty(); });
+      if (!client->alive) return;
+      packet = client->queue.front();
+      client->queue.pop_front();
+    }
+
+    // 送れなければ切断されている
+    if (!sendAll(client->socket, packet->data(), packet->size()))
+    {
+      std::lock_guard<std::mutex> lock(client->mutex);
+      client->alive = false;
+      client->queue.clear();
+      return;
+    }
+  }
+}
+
+// コンストラクタ (TCP)
+DepthStreamClient::DepthStreamClient(const std::string &host, int port)
+  : socket(invalidSocket)
+  , received(0)
+  , decodeTime(0.0)
+{
+  startup();
+
+  // ホストのアドレスを求める
+  addrinfo hints{}, *result;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) return;
+
+  // 接続できるまで順に試す
+  for (const addrinfo *a = result; a; a = a->ai_next)
+  {
+    const std::intptr_t s(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+    if (s == invalidSocket) continue;
+    if (connect(s, a->ai_addr, static_cast<socklen_t>(a->ai_addrlen)) == 0)
+    {
+      socket = s;
+      break;
+    }
+    closeSocket(s);
+  }
+  freeaddrinfo(result);
+}
+
+#ifndef _WIN32
+// コンストラクタ (Unix ドメインソケット)
+DepthStreamClient::DepthStreamClient(const std::string &path)
+  : socket(::socket(AF_UNIX, SOCK_STREAM, 0))
+  , received(0)
+  , decodeTime(0.0)
+{
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof address.sun_path - 1);
+  if (socket != invalidSocket
+    && connect(socket, reinterpret_cast<const sockaddr *>(&address), sizeof address) != 0)
+  {
+    closeSocket(socket);
+    socket = invalidSocket;
+  }
+}
+#endif
+
+// デストラクタ
+DepthStreamClient::~DepthStreamClient()
+{
+  if (socket != invalidSocket) closeSocket(socket);
+#ifdef _WIN32
+  cleanup();
+#endif
+}
+
+// 接続していれば true を返す
+bool DepthStreamClient::isConnected() const
+{
+  return socket != invalidSocket;
+}
+
+// 指定したバイト数を受け取る
+bool DepthStreamClient::receive(void *data, size_t size)
+{
+  char *p(static_cast<char *>(data));
+  while (size > 0)
+  {
+    const int n(static_cast<int>(recv(socket, p, static_cast<int>(std::min(size, size_t(1 << 20))), 0)));
+    if (n <= 0) return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+// 次のフレームを受け取って復号する
+bool DepthStreamClient::read(Frame &frame)
+{
+  if (socket == invalidSocket) return false;
+
+  for (;;)
+  {
+    // ヘッダとデータを受け取る
+    DepthStreamHeader header;
+    if (!receive(&header, sizeof header) || memcmp(header.magic, streamMagic, sizeof header.magic) != 0) return false;
+    if (!checkHeader(header)) return false;
+    packet.resize(header.size);
+    if (!receive(packet.data(), packet.size())) return false;
+    const std::uint8_t *const end(packet.data() + packet.size());
+    received += sizeof header + header.size;
+
+    // 復号にかかる時間を計る
+    const auto start(std::chrono::steady_clock::now());
+
+    // センサごとの直前のフレーム
+    if (header.sensor >= previous.size()) previous.resize(header.sensor + 1);
+    Frame &p(previous[header.sensor]);
+    const size_t count(size_t(header.depthWidth) * header.depthHeight);
+
+    // キーフレームを受け取るまでは差分を復号できない
+    if (!header.keyframe && p.depth.size() != count) continue;
+
+    // デプスの差分を復号する
+    std::vector<std::uint32_t> residual(count);
+    BitReader reader(packet.data(), header.depthSize);
+    riceDecode(reader, residual.data(), count);
+    if (header.keyframe)
+    {
+      p.depth.resize(count);
+      for (size_t i = 0; i < count; ++i)
+      {
+        const int q(i % header.depthWidth > 0 ? p.depth[i - 1] : i >= header.depthWidth ? p.depth[i - header.depthWidth] : 0);
+        p.depth[i] = static_cast<std::uint16_t>(q + unzigzag(residual[i]));
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < count; ++i) p.depth[i] = static_cast<std::uint16_t>(p.depth[i] + unzigzag(residual[i]));
+    }
+
+    // カラーのタイルを復号して直前のフレームに重ねる
+    const cv::Size colorSize(header.colorWidth, header.colorHeight);
+    if (header.keyframe || p.color.size() != colorSize) p.color = cv::Mat::zeros(colorSize, CV_8UC3);
+    const std::uint8_t *t(packet.data() + header.depthSize);
+    for (int i = 0; i < header.tileCount; ++i)
+    {
+      std::uint16_t position[2];
+      std::uint32_t size;
+      if (static_cast<size_t>(end - t) < sizeof position + sizeof size) return false;
+      memcpy(position, t, sizeof position);
+      memcpy(&size, t + sizeof position, sizeof size);
+      t += sizeof position + sizeof size;
+      if (size == 0 || static_cast<size_t>(end - t) < size) return false;
+
+      // タイルの位置がカラーの外なら壊れている
+      const int x(position[0] * header.tileSize), y(position[1] * header.tileSize);
+      if (x >= header.colorWidth || y >= header.colorHeight) return false;
+
+      const cv::Mat tile(cv::imdecode(cv::Mat(1, static_cast<int>(size), CV_8UC1, const_cast<std::uint8_t *>(t)), cv::IMREAD_COLOR));
+      t += size;
+
+      if (!tile.empty() && x + tile.cols <= p.color.cols && y + tile.rows <= p.color.rows)
+      {
+        tile.copyTo(p.color(cv::Rect(x, y, tile.cols, tile.rows)));
+      }
+    }
+
+    // タイルの後にデータが余っていれば壊れている
+    if (t != end) return false;
+
+    // フレームの情報
+    p.sensor = header.sensor;
+    p.frame = header.frame;
+    p.depthScale = header.depthScale;
+    p.attitude.load(header.attitude);
+    p.depthWidth = header.depthWidth;
+    p.depthHeight = header.depthHeight;
+
+    // 復号したフレームを返す
+    frame.sensor = p.sensor;
+    frame.frame = p.frame;
+    frame.depthScale = p.depthScale;
+    frame.attitude = p.attitude;
+    frame.depthWidth = p.depthWidth;
+    frame.depthHeight = p.depthHeight;
+    frame.depth = p.depth;
+    p.color.copyTo(frame.color);
+
+    decodeTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+  }
+}
+
+// 受信と復号の速さを計測する
+bool DepthStreamClient::benchmark(const std::string &host, int port, int frames, std::ostream &out)
+{
+  if (frames < 1) frames = 1;
+
+  DepthStreamClient client(host, port);
+  if (!client.isConnected()) return false;
+
+  // 最初のフレームは接続とキーフレームを待つので計測しない
+  Frame frame;
+  if (!client.read(frame)) return false;
+  const unsigned long long bytes(client.getReceived());
+  const double decoded(client.getDecodeTime());
+
+  // frames フレームを受け取って復号する
+  const auto start(std::chrono::steady_clock::now());
+  for (int i = 0; i < frames; ++i) if (!client.read(frame)) return false;
+  const double t(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+  // 受け取ったデータ量と復号の時間
+  const double megabytes((client.getReceived() - bytes) / 1048576.0);
+  const double decode(client.getDecodeTime() - decoded);
+
+  out << "[" << host << ":" << port << "] frames = " << frames
+    << ", depth = " << frame.depthWidth << "x" << frame.depthHeight
+    << ", color = " << frame.color.cols << "x" << frame.color.rows << "\n";
+  out << "received: " << frames / t << " frames/s, " << megabytes / t << " MB/s, "
+    << megabytes * 1024.0 / frames << " KB/frame\n";
+  out << "decode: " << decode / frames << " ms/frame, " << frames * 1000.0 / decode << " frames/s\n";
+
+  return true;
+}
@@ -0,0 +1,372 @@
+﻿#pragma once
+
+//
+// 点群のネットワーク配信
+//
+
+// デプスセンサ関連の基底クラス
+#include "DepthCamera.h"
+
+// OpenCV
+#include <opencv2/core/core.hpp>
+
+// 標準ライブラリ
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 配信するパケットのヘッダ (リトルエンディアン)
+struct DepthStreamHeader
+{
+  // 識別子 "GDST"
+  char magic[4];
+
+  // ヘッダに続くデータのバイト数
+  std::uint32_t size;
+
+  // センサの番号とフレームの番号
+  std::uint32_t sensor, frame;
+
+  // キーフレームなら 1
+  std::uint32_t keyframe;
+
+  // デプスとカラーのサイズ
+  std::uint16_t depthWidth, depthHeight, colorWidth, colorHeight;
+
+  // デプスの量子化の単位 (m)
+  float depthScale;
+
+  // センサの姿勢
+  float attitude[16];
+
+  // 符号化したデプスのバイト数
+  std::uint32_t depthSize;
+
+  // カラーのタイルの数と一辺の画素数
+  std::uint16_t tileCount, tileSize;
+};
+
+//
+// 配信サーバ
+//
+class DepthStream
+{
+  // 配信するパケット
+  using Packet = std::shared_ptr<const std::vector<std::uint8_t>>;
+
+  // 読み出しに使うバッファオブジェクトのスロット
+  struct Slot
+  {
+    // デプスとカラーを読み出すピクセルバッファオブジェクト
+    GLuint depthBuffer, colorBuffer;
+
+    // 永続的にマップしたピクセルバッファオブジェクトの先頭
+    const GLfloat *depth;
+    const GLubyte *color;
+
+    // 読み出し完了を待つフェンス
+    GLsync fence;
+
+    // 読み出したときのセンサの姿勢
+    GgMatrix attitude;
+
+    // 符号化スレッドが使用中なら true
+    std::atomic<bool> busy;
+  };
+
+  // センサごとの状態
+  struct Channel
+  {
+    // デプスとカラーのサイズ
+    const int depthWidth, depthHeight, colorWidth, colorHeight;
+
+    // 読み出しに使うスロット
+    std::vector<Slot> slot;
+
+    // 次に使うスロット
+    size_t next;
+
+    // 送ったフレームの数
+    std::uint32_t frame;
+
+    // 直前に送ったデプスとカラー (符号化スレッドだけが使う)
+    std::vector<std::uint16_t> depth;
+    cv::Mat color;
+
+    // 次のフレームをキーフレームにするなら true
+    std::atomic<bool> keyRequest;
+
+    // コンストラクタ
+    Channel(int depthWidth, int depthHeight, int colorWidth, int colorHeight, size_t slots);
+
+    // デストラクタ
+    ~Channel();
+  };
+
+  // 接続しているクライアント
+  struct Client
+  {
+    // ソケット
+    std::intptr_t socket;
+
+    // 送信待ちのパケット
+    std::deque<Packet> queue;
+
+    // キーフレームを受け取ってデルタを復号できる状態のセンサなら true
+    std::vector<bool> synchronized;
+
+    // 送信スレッドとの排他制御
+    std::mutex mutex;
+
+    // 送信スレッドへの通知
+    std::condition_variable condition;
+
+    // 接続が切れたら false
+    std::atomic<bool> alive;
+
+    // 送信スレッド
+    std::thread sender;
+  };
+
+  // 符号化スレッドに渡す仕事
+  struct Job
+  {
+    int id;
+    Channel *channel;
+    Slot *slot;
+  };
+
+  // デプスの量子化の単位 (m)
+  const GLfloat depthScale;
+
+  // 配信するデプスのセンサからの最大距離
+  const GLfloat maxDistance;
+
+  // キーフレームの間隔
+  const std::uint32_t keyInterval;
+
+  // カラーのタイルの一辺の画素数
+  const int tileSize;
+
+  // カラーのタイルの JPEG の品質
+  const int quality;
+
+  // クライアントごとの送信待ちのパケットの最大数
+  const size_t maxQueue;
+
+  // センサごとのスロットの数
+  const size_t slots;
+
+  // センサごとの状態
+  std::vector<std::unique_ptr<Channel>> channel;
+
+  // GPU 側の処理が完了して符号化を待っているスロット
+  std::deque<Job> pending;
+
+  // 符号化スレッドに渡した仕事
+  std::deque<Job> queue;
+
+  // 符号化スレッドとの排他制御
+  std::mutex queueMutex;
+
+  // 符号化スレッドへの通知
+  std::condition_variable queueCondition;
+
+  // 待ち受けソケット
+  std::intptr_t listener;
+
+  // Unix ドメインソケットのパス
+  const std::string path;
+
+  // 接続しているクライアント
+  std::list<std::unique_ptr<Client>> clients;
+
+  // クライアントのリストの排他制御
+  std::mutex clientMutex;
+
+  // スレッドを止めるなら true
+  std::atomic<bool> quit;
+
+  // 符号化スレッドと接続受付スレッド
+  std::thread encoder, acceptor;
+
+  // 読み出したフレーム数, 送ったフレーム数, 送信が間に合わずに捨てたパケット数
+  std::atomic<unsigned long long> captured, sent, dropped;
+
+  // 待ち受けを開始してスレッドを起動する
+  void start();
+
+  // 符号化スレッドの処理
+  void encode();
+
+  // 接続受付スレッドの処理
+  void accept();
+
+  // 送信スレッドの処理
+  static void send(Client *client);
+
+  // スロットの内容をパケットにする
+  Packet pack(const Job &job);
+
+  // パケットをすべてのクライアントの送信待ちに加える
+  void broadcast(const Job &job, bool keyframe, const Packet &packet);
+
+public:
+
+  // コンストラクタ (TCP)
+  //   port 待ち受けるポート番号
+  //   depthScale デプスの量子化の単位 (m)
+  //   maxDistance 配信するデプスのセンサからの最大距離 (m)
+  //   keyInterval キーフレームの間隔
+  //   tileSize カラーのタイルの一辺の画素数
+  //   quality カラーのタイルの JPEG の品質
+  //   maxQueue クライアントごとの送信待ちのパケットの最大数
+  //   slots センサごとのスロットの数
+  DepthStream(int port, GLfloat depthScale = 0.001f, GLfloat maxDistance = 5.0f,
+    std::uint32_t keyInterval = 30, int tileSize = 64, int quality = 80, size_t maxQueue = 4, size_t slots = 2);
+
+#ifndef _WIN32
+  // コンストラクタ (Unix ドメインソケット)
+  //   path ソケットのパス
+  DepthStream(const std::string &path, GLfloat depthScale = 0.001f, GLfloat maxDistance = 5.0f,
+    std::uint32_t keyInterval = 30, int tileSize = 64, int quality = 80, size_t maxQueue = 4, size_t slots = 2);
+#endif
+
+  // コピーコンストラクタ (コピー禁止)
+  DepthStream(const DepthStream &s) = delete;
+
+  // 代入 (代入禁止)
+  DepthStream &operator=(const DepthStream &s) = delete;
+
+  // デストラクタ
+  virtual ~DepthStream();
+
+  // センサ id のデプスとカラーの読み出しを開始する (空きスロットがなければ捨てて false を返す)
+  bool capture(const DepthCamera &sensor, int id);
+
+  // 読み出しの完了したスロットを符号化スレッドに渡す
+  void update();
+
+  // 接続しているクライアントの数を得る
+  size_t getClientCount();
+
+  // 読み出したフレーム数を得る
+  unsigned long long getCaptured() const
+  {
+    return captured;
+  }
+
+  // 送ったフレーム数を得る
+  unsigned long long getSent() const
+  {
+    return sent;
+  }
+
+  // 送信が間に合わずに捨てたパケット数を得る
+  unsigned long long getDropped() const
+  {
+    return dropped;
+  }
+};
+
+//
+// 配信クライアント
+//
+class DepthStreamClient
+{
+public:
+
+  // 受け取ったフレーム
+  struct Frame
+  {
+    // センサの番号とフレームの番号
+    std::uint32_t sensor, frame;
+
+    // デプスの量子化の単位 (m)
+    float depthScale;
+
+    // センサの姿勢
+    GgMatrix attitude;
+
+    // デプスのサイズ
+    int depthWidth, depthHeight;
+
+    // 量子化したデプス (0 は計測不能)
+    std::vector<std::uint16_t> depth;
+
+    // カラー (RGB)
+    cv::Mat color;
+  };
+
+private:
+
+  // ソケット
+  std::intptr_t socket;
+
+  // 受け取ったパケット
+  std::vector<std::uint8_t> packet;
+
+  // センサごとの直前のフレーム
+  std::vector<Frame> previous;
+
+  // 受け取ったバイト数
+  unsigned long long received;
+
+  // 復号にかかった時間の合計 (ms)
+  double decodeTime;
+
+  // 指定したバイト数を受け取る
+  bool receive(void *data, size_t size);
+
+public:
+
+  // コンストラクタ (TCP)
+  //   host 接続するホスト名
+  //   port 接続するポート番号
+  DepthStreamClient(const std::string &host, int port);
+
+#ifndef _WIN32
+  // コンストラクタ (Unix ドメインソケット)
+  //   path ソケットのパス
+  explicit DepthStreamClient(const std::string &path);
+#endif
+
+  // コピーコンストラクタ (コピー禁止)
+  DepthStreamClient(const DepthStreamClient &c) = delete;
+
+  // 代入 (代入禁止)
+  DepthStreamClient &operator=(const DepthStreamClient &c) = delete;
+
+  // デストラクタ
+  virtual ~DepthStreamClient();
+
+  // 接続していれば true を返す
+  bool isConnected() const;
+
+  // 次のフレームを受け取って復号する (接続が切れたら false)
+  bool read(Frame &frame);
+
+  // 受け取ったバイト数を得る
+  unsigned long long getReceived() const
+  {
+    return received;
+  }
+
+  // 復号にかかった時間の合計 (ms) を得る
+  double getDecodeTime() const
+  {
+    return decodeTime;
+  }
+
+  // host の port に接続して frames フレームを受け取って復号し, 受信と復号の速さを out に出力する
+  //   戻り値 接続して frames フレームを受け取れたら true
+  static bool benchmark(const std::string &host, int port, int frames, std::ostream &out);
+};
@@ -32,6 +32,9 @@ Ds325::Ds325(
   , power_line_frequency(frequency)
   , depthPtr(nullptr)
   , colorPtr(nullptr)
+  , maxDepth(depth_mode == DepthNode::CAMERA_MODE_CLOSE_MODE ? 4000 : 10000)
+  , range{ depth_mode == DepthNode::CAMERA_MODE_CLOSE_MODE ? 0.2f : 0.4f,
+      depth_mode == DepthNode::CAMERA_MODE_CLOSE_MODE ? 1.0f : 6.0f }
 {
   // スレッドが走っていなかったら
   if (!worker.joinable())
@@ -71,37 +74,52 @@ Ds325::Ds325(
   FrameFormat_toResolution(depth_format, &depthWidth, &depthHeight);
   FrameFormat_toResolution(color_format, &colorWidth, &colorHeight);
 
-  // まだシェーダが作られていなかったら
-  if (shader.get() == nullptr)
-  {
-    // カメラ座標算出用のシェーダを作成する
-    shader.reset(new Compute("position_ds.comp"));
+  // カメラ座標算出用のシェーダを用意する
+  shader = Compute::share("position_ds.comp", getFilterDefines());
 
-    // シェーダの uniform 変数の場所を調べる
-    depthLoc = glGetUniformLocation(shader->get(), "depth");
-    pointLoc = glGetUniformLocation(shader->get(), "point");
-    dcLoc = glGetUniformLocation(shader->get(), "dc");
-    dfLoc = glGetUniformLocation(shader->get(), "df");
-    dkLoc = glGetUniformLocation(shader->get(), "dk");
+  // シェーダの uniform 変数の場所を調べる
+  depthLoc = glGetUniformLocation(shader->get(), "depth");
+  pointLoc = glGetUniformLocation(shader->get(), "point");
+  dcLoc = glGetUniformLocation(shader->get(), "dc");
+  dfLoc = glGetUniformLocation(shader->get(), "df");
+  dkLoc = glGetUniformLocation(shader->get(), "dk");
 
-    // シェーダストレージブロックに結合ポイントを割り当てる
-    const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
-    glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
-  }
+  // シェーダストレージブロックに結合ポイントを割り当てる
+  const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
+  glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
 
   // テクスチャとバッファオブジェクトを作成してポイント数を返す
   const int depthCount(makeTexture());
 
+  // カメラ座標を求めるシェーダのワークグループのサイズをこの解像度で自動調整する
+  tunePosition(shader);
+
   // データ転送用のメモリを確保する
   depth.resize(depthCount);
   point.resize(depthCount);
   uvmap.resize(depthCount);
   color.resize(colorWidth * colorHeight);
 
+  // カラーデータが YUY2 ならシェーダで RGB に変換する
+  if (color_compression != COMPRESSION_TYPE_MJPEG)
+  {
+    yuyv.resize(colorWidth * colorHeight * 2);
+    makeYuyvTexture();
+  }
+
   // DepthSense の各ノードを初期化する
   for (Node &node : device.getNodes()) configureNode(node);
 }
 
+// DepthSense の種類に合わせた動作モードで使うコンストラクタ
+Ds325::Ds325(int model)
+  : Ds325(model == DS311 ? ds311_depth_format : capture_depth_format, capture_depth_fps,
+      model == DS311 ? ds311_depth_mode : capture_depth_mode,
+      model == DS311 ? ds311_color_format : capture_color_format, capture_color_fps,
+      model == DS311 ? ds311_color_compression : capture_color_compression)
+{
+}
+
 // デストラクタ
 Ds325::~Ds325()
 {
@@ -304,7 +322,7 @@ void Ds325::onNewDepthSample(DepthNode node, DepthNode::NewSampleReceivedData da
     const int d(data.depthMap[i]);
 
     // デプス値を (計測不能点は maxDepth にして) 転送する
-    if ((sensor->depth[j] = d) > 32000) sensor->depth[j] = maxDepth;
+    if ((sensor->depth[j] = d) > 32000) sensor->depth[j] = sensor->maxDepth;
   }
 
   // デプスデータが更新されたことを記録する
@@ -383,33 +401,8 @@ void Ds325::onNewColorSample(ColorNode node, ColorNode::NewSampleReceivedData da
   }
   else
   {
-    // カラーデータは YUY2 でエンコードされている
-
-    // ITU-R BT.601 / ITU-R BT.709 (1250/50/2:1)
-    //
-    //   R = Y + 1.402 × Cr
-    //   G = Y - 0.344136 × Cb - 0.714136 × Cr
-    //   B = Y + 1.772 × Cb
-
-    // ITU - R BT.709 (1125 / 60 / 2:1)
-    //
-    //   R = Y + 1.5748 × Cr
-    //   G = Y - 0.187324 × Cb - 0.468124 × Cr
-    //   B = Y + 1.8556 × Cb
-
-    for (int i = 0; i < sensor->color.size(); ++i)
-    {
-      const int iy(i * 2), iu((iy & ~3) + 1), iv(iu + 2), j(i * 3);
-      const float y(static_cast<float>(data.colorMap[iy] - 16));
-      const float u(static_cast<float>(data.colorMap[iu] - 128));
-      const float v(static_cast<float>(data.colorMap[iv] - 128));
-      const float r(y + 1.402f * v);
-      const float g(y - 0.344136f * u - 0.714136f * v);
-      const float b(y + 1.772f * u);
-      sensor->color[j][0] = b > 0.0f ? static_cast<GLubyte>(b) : 0;
-      sensor->color[j][1] = g > 0.0f ? static_cast<GLubyte>(g) : 0;
-      sensor->color[j][2] = r > 0.0f ? static_cast<GLubyte>(r) : 0;
-    }
+    // カラーデータは YUY2 でエンコードされているのでそのまま転送してシェーダで RGB に変換する
+    memcpy(sensor->yuyv.data(), data.colorMap, sensor->yuyv.size());
   }
 
   // カラーデータが更新されたことを記録する
@@ -440,6 +433,9 @@ GLuint Ds325::getDepth()
     // 一度送ってしまえば更新されるまで送る必要がないのでデータは不要
     depthPtr = nullptr;
 
+    // 新しいデプスデータを受け取った
+    ++depthFrame;
+
     // デプスデータをアンロックする
     depthMutex.unlock();
   }
@@ -527,6 +523,10 @@ GLuint Ds325::getPoint()
     // 一度送ってしまえば更新されるまで送る必要がないのでデータは不要
     depthPtr = nullptr;
 
+    // 新しいデプスデータを受け取ってカメラ座標を求めた
+    ++depthFrame;
+    updatePoint();
+
     // デプスデータをアンロックする
     depthMutex.unlock();
   }
@@ -537,6 +537,12 @@ GLuint Ds325::getPoint()
 // カメラ座標を算出する
 GLuint Ds325::getPosition()
 {
+  // デプスデータを取得する
+  const GLuint depthTexture(getDepth());
+
+  // デプスデータが更新されていなければカメラ座標は求め直さない
+  if (!updatePoint()) return pointTexture;
+
   // デプスセンサの内部パラメータ
   const float &dcx(depthIntrinsics.cx);
   const float &dcy(depthIntrinsics.cy);
@@ -595,8 +601,10 @@ GLuint Ds325::getPosition()
   // テクスチャ座標をバッファオブジェクトに転送する
   glBufferSubData(GL_ARRAY_BUFFER, 0, uvmap.size() * sizeof uvmap[0], uvmap.data());
 
+  // 自動調整中なら候補のシェーダに切り替えて計測する
+  beginPosition(shader);
+
   // カメラ座標をシェーダで算出する
-  const GLuint depthTexture(getDepth());
   shader->use();
   glUniform1i(depthLoc, DepthImageUnit);
   glUniform1i(pointLoc, PointImageUnit);
@@ -606,7 +614,8 @@ GLuint Ds325::getPosition()
   glBindImageTexture(DepthImageUnit, depthTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R16UI);
   glBindImageTexture(PointImageUnit, pointTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WeightBinding, weightBuffer);
-  shader->execute(depthWidth, depthHeight, 16, 16);
+  shader->dispatch(depthWidth, depthHeight, 0, filterApron);
+  endPosition();
 
   return pointTexture;
 }
@@ -620,8 +629,11 @@ GLuint Ds325::getColor()
   // カラーデータが更新されておりカラーデータの取得中でなければ
   if (colorPtr && colorMutex.try_lock())
   {
-    // カラーデータをテクスチャに転送する
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth, colorHeight, GL_BGR, GL_UNSIGNED_BYTE, colorPtr);
+    // カラーデータをテクスチャに転送する (YUY2 ならシェーダで RGB に変換する)
+    if (yuyv.empty())
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth, colorHeight, GL_BGR, GL_UNSIGNED_BYTE, colorPtr);
+    else
+      setYuyv(yuyv.data());
 
     // 一度送ってしまえば更新されるまで送る必要がないのでデータは不要
     colorPtr = nullptr;
@@ -645,16 +657,4 @@ Context Ds325::context;
 // データ取得用のスレッド
 std::thread Ds325::worker;
 
-// カメラ座標を計算するシェーダ
-std::unique_ptr<Compute> Ds325::shader(nullptr);
-
-// デプスデータのイメージユニットの uniform 変数 depth の場所
-GLint Ds325::depthLoc;
-
-// カメラ座標のイメージユニットの uniform 変数 point の場所
-GLint Ds325::pointLoc;
-
-// カメラパラメータの uniform 変数の場所
-GLint Ds325::dcLoc, Ds325::dfLoc, Ds325::dkLoc;
-
 #endif
@@ -7,10 +7,6 @@
 // DepthSense を使う
 #if !defined(USE_DEPTH_SENSE)
 #  define USE_DEPTH_SENSE 1
-#  ifdef SENSOR
-#    undef SENSOR
-#  endif
-#  define SENSOR Ds325
 #endif
 
 #if USE_DEPTH_SENSE
@@ -36,21 +32,17 @@ using namespace DepthSense;
 #define DS311                   0
 #define DS325                   1
 
-// 使用する DepthSense 
-#define DEPTHSENSE_MODEL        DS325
-
-// DepthSense の動作モード
-#if DEPTHSENSE_MODEL == DS325
+// DepthSense の動作モード (DS325)
 const FrameFormat capture_depth_format(FRAME_FORMAT_QVGA);
 const DepthNode::CameraMode capture_depth_mode(DepthNode::CAMERA_MODE_CLOSE_MODE);
 const FrameFormat capture_color_format(FRAME_FORMAT_VGA);
 const CompressionType capture_color_compression(COMPRESSION_TYPE_MJPEG);
-#else
-const FrameFormat capture_depth_format(FRAME_FORMAT_QQVGA);
-const DepthNode::CameraMode capture_depth_mode(DepthNode::CAMERA_MODE_LONG_RANGE);
-const FrameFormat capture_color_format(FRAME_FORMAT_VGA);
-const CompressionType capture_color_compression(COMPRESSION_TYPE_YUY2);
-#endif
+
+// DepthSense の動作モード (DS311)
+const FrameFormat ds311_depth_format(FRAME_FORMAT_QQVGA);
+const DepthNode::CameraMode ds311_depth_mode(DepthNode::CAMERA_MODE_LONG_RANGE);
+const FrameFormat ds311_color_format(FRAME_FORMAT_VGA);
+const CompressionType ds311_color_compression(COMPRESSION_TYPE_YUY2);
 
 // デプスセンサのフレームレート
 const unsigned int capture_depth_fps(60);
@@ -160,20 +152,23 @@ class Ds325 : public DepthCamera
   // カラーデータ転送用のメモリ
 	std::vector<Color> color;
 
+  // YUY2 のカラーデータ転送用のメモリ (シェーダで RGB に変換する)
+  std::vector<GLubyte> yuyv;
+
 	// 新着のカラーデータ
 	const Color *colorPtr;
 
   // カメラ座標を計算するシェーダ
-  static std::unique_ptr<Compute> shader;
+  std::shared_ptr<Compute> shader;
 
   // デプスデータのイメージユニットの uniform 変数 depth の場所
-  static GLint depthLoc;
+  GLint depthLoc;
 
   // カメラ座標のイメージユニットの uniform 変数 point の場所
-  static GLint pointLoc;
+  GLint pointLoc;
 
   // カメラパラメータの uniform 変数の場所
-  static GLint dcLoc, dfLoc, dkLoc;
+  GLint dcLoc, dfLoc, dkLoc;
 
 public:
 
@@ -188,22 +183,23 @@ public:
     PowerLineFrequency frequency = color_frequency    // 電源周波数
     );
 
+  // DepthSense の種類 (DS311 か DS325) に合わせた動作モードで使うコンストラクタ
+  explicit Ds325(int model);
+
   // デストラクタ
   virtual ~Ds325();
 
-#if DEPTHSENSE_MODEL == DS325
-  // 計測不能点のデフォルト距離 (mm)
-  static constexpr GLushort maxDepth = 4000;
+  // 計測不能点のデフォルト距離 (mm, 近距離モードなら 4000)
+  const GLushort maxDepth;
 
   // 疑似カラー処理の範囲
-  static constexpr GLfloat range[2] = { 0.2f, 1.0f };
-#else
-  // 計測不能点のデフォルト距離
-  static constexpr GLushort maxDepth = 10000;
+  const GLfloat range[2];
 
-  // 疑似カラー処理の範囲
-  static constexpr GLfloat range[2] = { 0.4f, 6.0f };
-#endif
+  // 疑似カラー処理の範囲を得る
+  const GLfloat *getRange() const
+  {
+    return range;
+  }
 
   // デプスデータを取得する
   GLuint getDepth();
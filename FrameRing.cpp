@@ -0,0 +1,275 @@
+﻿#include "FrameRing.h"
+
+//
+// 共有メモリのリングバッファによるフレームの配布
+//
+
+// 共有メモリ
+#ifdef _WIN32
+#  include <Windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+// 標準ライブラリ
+#include <cstring>
+#include <new>
+
+// 共有メモリの識別子
+static constexpr char ringMagic[8] = { 'G', 'D', 'R', 'I', 'N', 'G', '\0', '\0' };
+
+// 共有メモリの形式の版
+constexpr std::uint32_t ringVersion(2);
+
+// スロット内のデータの境界
+constexpr std::uint64_t ringAlignment(64);
+
+// 境界に合わせる
+static std::uint64_t align(std::uint64_t n)
+{
+  return (n + ringAlignment - 1) & ~(ringAlignment - 1);
+}
+
+// カラーデータの 1 画素あたりのバイト数
+static std::uint64_t colorBytes(std::uint32_t format)
+{
+  return format == FrameColorRgb ? 3 : format == FrameColorYuyv ? 2 : 0;
+}
+
+// 共有メモリの名前をプラットフォームの形式にする
+static std::string sharedName(const std::string &name)
+{
+#ifdef _WIN32
+  return "Local\\" + name;
+#else
+  return "/" + name;
+#endif
+}
+
+// コンストラクタ
+FrameRing::FrameRing(const std::string &name)
+  : name(sharedName(name))
+  , memory(nullptr)
+  , size(0)
+  , handle(-1)
+{
+}
+
+// デストラクタ
+FrameRing::~FrameRing()
+{
+  unmap();
+}
+
+// 共有メモリを解放する
+void FrameRing::unmap()
+{
+#ifdef _WIN32
+  if (memory) UnmapViewOfFile(memory);
+  if (handle != -1) CloseHandle(reinterpret_cast<HANDLE>(handle));
+#else
+  if (memory) munmap(memory, size);
+  if (handle != -1) close(static_cast<int>(handle));
+#endif
+  memory = nullptr;
+  handle = -1;
+}
+
+// 書き込む側のコンストラクタ
+FramePublisher::FramePublisher(const std::string &name, const FrameRingHeader &format, std::uint32_t slots)
+  : FrameRing(name)
+  , count(0)
+{
+  // スロットのレイアウト
+  const std::uint64_t depthOffset(align(sizeof (FrameRingSlot)));
+  const std::uint64_t colorOffset(depthOffset + align(std::uint64_t(format.depthWidth) * format.depthHeight * sizeof (std::uint16_t)));
+  const std::uint64_t slotSize(colorOffset + align(std::uint64_t(format.colorWidth) * format.colorHeight * colorBytes(format.colorFormat)));
+  const std::uint64_t slotOffset(align(sizeof (FrameRingHeader)));
+  if (slots < 2) slots = 2;
+  size = static_cast<size_t>(slotOffset + slotSize * slots);
+
+#ifdef _WIN32
+  // 名前付きのファイルマッピングを作る
+  const HANDLE h(CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+    static_cast<DWORD>(std::uint64_t(size) >> 32), static_cast<DWORD>(size), this->name.c_str()));
+  if (h == nullptr) return;
+  handle = reinterpret_cast<std::intptr_t>(h);
+  memory = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+  // 前回異常終了して残っていたら作り直す
+  shm_unlink(this->name.c_str());
+
+  // 共有メモリを作る (読み出す側には読み出しだけを許す)
+  const int fd(shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644));
+  if (fd < 0) return;
+  handle = fd;
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+  {
+    unmap();
+    shm_unlink(this->name.c_str());
+    return;
+  }
+  void *const m(mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+  memory = m == MAP_FAILED ? nullptr : m;
+#endif
+  if (!memory)
+  {
+    unmap();
+    return;
+  }
+
+  // ヘッダを初期化する
+  FrameRingHeader *const header(new (memory) FrameRingHeader);
+  header->version = ringVersion;
+  header->slots = slots;
+  header->depthWidth = format.depthWidth;
+  header->depthHeight = format.depthHeight;
+  header->colorWidth = format.colorWidth;
+  header->colorHeight = format.colorHeight;
+  header->colorFormat = colorBytes(format.colorFormat) > 0 ? format.colorFormat : FrameColorNone;
+  header->depthScale = format.depthScale;
+  header->depthIntrinsics = format.depthIntrinsics;
+  header->colorIntrinsics = format.colorIntrinsics;
+  memcpy(header->extRotation, format.extRotation, sizeof header->extRotation);
+  memcpy(header->extTranslation, format.extTranslation, sizeof header->extTranslation);
+  header->slotOffset = slotOffset;
+  header->slotSize = slotSize;
+  header->depthOffset = depthOffset;
+  header->colorOffset = colorOffset;
+  header->latest.store(0, std::memory_order_relaxed);
+
+  // スロットを初期化する
+  for (std::uint32_t i = 0; i < slots; ++i)
+  {
+    FrameRingSlot *const slot(new (getSlot(i)) FrameRingSlot);
+    slot->sequence.store(0, std::memory_order_relaxed);
+    slot->frame = 0;
+    slot->hasColor = 0;
+  }
+
+  // 識別子は最後に書いて読み出す側が初期化の途中のヘッダを使わないようにする
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(header->magic, ringMagic, sizeof header->magic);
+}
+
+// 書き込む側のデストラクタ
+FramePublisher::~FramePublisher()
+{
+#ifndef _WIN32
+  // 名前を削除する (マップしている読み出し側はそのまま使える)
+  if (memory) shm_unlink(name.c_str());
+#endif
+}
+
+// フレームを書き込む
+void FramePublisher::publish(const std::uint16_t *depth, const std::uint8_t *color, double timestamp, const float *attitude)
+{
+  if (!memory) return;
+  const FrameRingHeader *const header(getHeader());
+
+  // 書き込むスロット
+  const std::uint64_t frame(++count);
+  FrameRingSlot *const slot(getSlot(frame - 1));
+  char *const base(reinterpret_cast<char *>(slot));
+
+  // シーケンス番号を奇数にして書き込み中にする
+  const std::uint64_t sequence(slot->sequence.load(std::memory_order_relaxed));
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  // フレームを書き込む
+  slot->frame = frame;
+  slot->timestamp = timestamp;
+  memcpy(slot->attitude, attitude, sizeof slot->attitude);
+  if (depth) memcpy(base + header->depthOffset, depth, size_t(header->depthWidth) * header->depthHeight * sizeof (std::uint16_t));
+  const size_t colorSize(static_cast<size_t>(std::uint64_t(header->colorWidth) * header->colorHeight * colorBytes(header->colorFormat)));
+  slot->hasColor = color && colorSize > 0 ? 1 : 0;
+  if (slot->hasColor) memcpy(base + header->colorOffset, color, colorSize);
+
+  // シーケンス番号を偶数に戻して最新のフレームにする
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  const_cast<FrameRingHeader *>(header)->latest.store(frame, std::memory_order_release);
+}
+
+// 読み出す側のコンストラクタ
+FrameSubscriber::FrameSubscriber(const std::string &name)
+  : FrameRing(name)
+{
+#ifdef _WIN32
+  // 名前付きのファイルマッピングを読み出し専用で開く
+  const HANDLE h(OpenFileMappingA(FILE_MAP_READ, FALSE, this->name.c_str()));
+  if (h == nullptr) return;
+  handle = reinterpret_cast<std::intptr_t>(h);
+  memory = MapViewOfFile(h, FILE_MAP_READ, 0, 0, 0);
+  MEMORY_BASIC_INFORMATION info;
+  if (memory && VirtualQuery(memory, &info, sizeof info)) size = info.RegionSize;
+#else
+  // 共有メモリを読み出し専用で開く
+  const int fd(shm_open(this->name.c_str(), O_RDONLY, 0));
+  if (fd < 0) return;
+  handle = fd;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof (FrameRingHeader)))
+  {
+    unmap();
+    return;
+  }
+  size = static_cast<size_t>(st.st_size);
+  void *const m(mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0));
+  memory = m == MAP_FAILED ? nullptr : m;
+#endif
+
+  // 形式が違えば使わない
+  const FrameRingHeader *const header(getHeader());
+  if (!memory || memcmp(header->magic, ringMagic, sizeof ringMagic) != 0 || header->version != ringVersion
+    || header->slotOffset + header->slotSize * header->slots > size)
+  {
+    unmap();
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+// 読み出す側のデストラクタ
+FrameSubscriber::~FrameSubscriber()
+{
+}
+
+// after より新しい最新のフレームを参照する
+bool FrameSubscriber::acquire(View &view, std::uint64_t after) const
+{
+  if (!memory) return false;
+  const FrameRingHeader *const header(getHeader());
+
+  // 最新のフレーム
+  const std::uint64_t latest(header->latest.load(std::memory_order_acquire));
+  if (latest == 0 || latest <= after) return false;
+
+  // 書き込み中か既に次の周回で上書きされていれば参照できない
+  const FrameRingSlot *const slot(getSlot(latest - 1));
+  const std::uint64_t sequence(slot->sequence.load(std::memory_order_acquire));
+  if ((sequence & 1) != 0 || slot->frame != latest) return false;
+
+  // 共有メモリ上のデータを参照する
+  const char *const base(reinterpret_cast<const char *>(slot));
+  view.frame = slot->frame;
+  view.timestamp = slot->timestamp;
+  view.attitude = slot->attitude;
+  view.depth = reinterpret_cast<const std::uint16_t *>(base + header->depthOffset);
+  view.color = slot->hasColor ? reinterpret_cast<const std::uint8_t *>(base + header->colorOffset) : nullptr;
+  view.sequence = sequence;
+  view.slot = slot;
+
+  // 参照している間に上書きされていないか確かめる
+  return validate(view);
+}
+
+// 参照したフレームが書き込み側に上書きされていなければ true を返す
+bool FrameSubscriber::validate(const View &view) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return view.slot->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
@@ -0,0 +1,222 @@
+﻿#pragma once
+
+//
+// 共有メモリのリングバッファによるフレームの配布
+//
+
+// 標準ライブラリ
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// 共有メモリ上のカメラの内部パラメータ
+struct FrameIntrinsics
+{
+  // 主点位置
+  float ppx, ppy;
+
+  // 焦点距離
+  float fx, fy;
+
+  // 歪み係数
+  float coeffs[5];
+
+  // 歪みモデル (rs2_distortion)
+  std::int32_t model;
+};
+
+// 共有メモリ上のカラーデータの形式
+enum FrameColorFormat : std::uint32_t
+{
+  FrameColorNone = 0,                                   // カラーデータなし
+  FrameColorRgb,                                        // RGB 各 8bit
+  FrameColorYuyv                                        // YUYV (2 画素で 4 バイト)
+};
+
+// 共有メモリの先頭に置くヘッダ (初期化後は書き換えない)
+struct FrameRingHeader
+{
+  // 識別子 "GDRING"
+  char magic[8];
+
+  // 形式の版
+  std::uint32_t version;
+
+  // リングバッファのスロットの数
+  std::uint32_t slots;
+
+  // デプスとカラーのサイズ
+  std::uint32_t depthWidth, depthHeight, colorWidth, colorHeight;
+
+  // カラーデータの形式 (FrameColorFormat)
+  std::uint32_t colorFormat;
+
+  // デプスの値の単位 (m)
+  float depthScale;
+
+  // デプスセンサとカラーセンサの内部パラメータ
+  FrameIntrinsics depthIntrinsics, colorIntrinsics;
+
+  // カラーセンサに対するデプスセンサの外部パラメータ (列優先)
+  float extRotation[9], extTranslation[3];
+
+  // スロットの先頭のオフセットとスロットのバイト数
+  std::uint64_t slotOffset, slotSize;
+
+  // スロット内のデプスとカラーのオフセット
+  std::uint64_t depthOffset, colorOffset;
+
+  // 最後に書き込みが完了したフレームの番号 (1 から始まる, 0 ならまだない)
+  std::atomic<std::uint64_t> latest;
+};
+
+// 共有メモリ上のスロットのヘッダ
+struct FrameRingSlot
+{
+  // 書き込み中は奇数になるシーケンス番号
+  std::atomic<std::uint64_t> sequence;
+
+  // このスロットのフレームの番号
+  std::uint64_t frame;
+
+  // デバイスのタイムスタンプ (ms)
+  double timestamp;
+
+  // センサの姿勢
+  float attitude[16];
+
+  // このフレームのカラーデータを書き込んでいれば 1
+  std::uint32_t hasColor;
+};
+
+// 共有メモリ上のアトミック変数はロックなしで扱えなければならない
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "64bit atomics must be lock-free");
+
+//
+// 共有メモリのリングバッファの作成と管理 (共通部分)
+//
+class FrameRing
+{
+protected:
+
+  // 共有メモリの名前
+  const std::string name;
+
+  // マップした共有メモリの先頭
+  void *memory;
+
+  // 共有メモリのバイト数
+  size_t size;
+
+  // 共有メモリのハンドル
+  std::intptr_t handle;
+
+  // スロット i の先頭を得る
+  FrameRingSlot *getSlot(std::uint64_t i) const
+  {
+    const FrameRingHeader *const header(getHeader());
+    return reinterpret_cast<FrameRingSlot *>(static_cast<char *>(memory)
+      + header->slotOffset + header->slotSize * (i % header->slots));
+  }
+
+  // コンストラクタ
+  FrameRing(const std::string &name);
+
+  // 共有メモリを解放する
+  void unmap();
+
+public:
+
+  // コピーコンストラクタ (コピー禁止)
+  FrameRing(const FrameRing &r) = delete;
+
+  // 代入 (代入禁止)
+  FrameRing &operator=(const FrameRing &r) = delete;
+
+  // デストラクタ
+  virtual ~FrameRing();
+
+  // 共有メモリが使えれば true を返す
+  bool isOpened() const
+  {
+    return memory != nullptr;
+  }
+
+  // 共有メモリのヘッダを得る
+  const FrameRingHeader *getHeader() const
+  {
+    return static_cast<const FrameRingHeader *>(memory);
+  }
+};
+
+//
+// フレームを書き込む側
+//
+class FramePublisher : public FrameRing
+{
+  // 書き込んだフレームの数
+  std::uint64_t count;
+
+public:
+
+  // コンストラクタ
+  //   name 共有メモリの名前
+  //   format スロット以外のヘッダの内容 (magic, version, slots, オフセット, latest は無視する, colorFormat でカラーデータのバイト数が決まる)
+  //   slots リングバッファのスロットの数
+  FramePublisher(const std::string &name, const FrameRingHeader &format, std::uint32_t slots = 4);
+
+  // デストラクタ
+  virtual ~FramePublisher();
+
+  // フレームを書き込む
+  //   depth デプスデータ (depthWidth × depthHeight の 16bit 整数)
+  //   color カラーデータ (colorWidth × colorHeight の colorFormat の形式, nullptr ならこのフレームはカラーなし)
+  //   timestamp デバイスのタイムスタンプ (ms)
+  //   attitude センサの姿勢
+  void publish(const std::uint16_t *depth, const std::uint8_t *color, double timestamp, const float *attitude);
+};
+
+//
+// フレームを読み出す側
+//
+class FrameSubscriber : public FrameRing
+{
+public:
+
+  // 共有メモリ上のフレームへの参照
+  struct View
+  {
+    // フレームの番号
+    std::uint64_t frame;
+
+    // デバイスのタイムスタンプ (ms)
+    double timestamp;
+
+    // センサの姿勢
+    const float *attitude;
+
+    // デプスデータとカラーデータ (このフレームにカラーデータがなければ color は nullptr)
+    const std::uint16_t *depth;
+    const std::uint8_t *color;
+
+    // 参照したときのスロットのシーケンス番号
+    std::uint64_t sequence;
+
+    // 参照しているスロット
+    const FrameRingSlot *slot;
+  };
+
+  // コンストラクタ
+  //   name 共有メモリの名前
+  explicit FrameSubscriber(const std::string &name);
+
+  // デストラクタ
+  virtual ~FrameSubscriber();
+
+  // after より新しい最新のフレームを参照する (なければ false)
+  //   共有メモリを直接参照するので使い終わったら validate() で上書きされていないか確かめる
+  bool acquire(View &view, std::uint64_t after = 0) const;
+
+  // 参照したフレームが書き込み側に上書きされていなければ true を返す
+  bool validate(const View &view) const;
+};
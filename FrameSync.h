@@ -0,0 +1,184 @@
+﻿#pragma once
+
+//
+// 複数のセンサのフレームのタイムスタンプによる同期
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <vector>
+
+template <typename Frame>
+class FrameSync
+{
+  // タイムスタンプ付きのフレーム
+  struct Entry
+  {
+    double timestamp;
+    Frame frame;
+  };
+
+  // センサごとのフレームの待ち行列
+  std::vector<std::deque<Entry>> queue;
+
+  // センサごとに保持するフレームの最大数
+  const size_t window;
+
+  // 同じ組とみなすタイムスタンプの差の最大値 (ms)
+  const double tolerance;
+
+public:
+
+  // 同期の統計
+  struct Statistics
+  {
+    // 出力したフレームの組の数
+    unsigned long long matched;
+
+    // より新しい組があったので出力しなかったフレームの組の数
+    unsigned long long skipped;
+
+    // 組にならずに捨てたセンサごとのフレームの数
+    std::vector<unsigned long long> dropped;
+
+    // 直前に出力した組のタイムスタンプの差 (ms)
+    double skew;
+
+    // 出力した組のタイムスタンプの差の最大値 (ms)
+    double maxSkew;
+
+    // 出力した組のタイムスタンプの差の合計 (ms)
+    double totalSkew;
+
+    // 出力した組のタイムスタンプの差の平均 (ms)
+    double meanSkew() const
+    {
+      return matched > 0 ? totalSkew / matched : 0.0;
+    }
+  };
+
+private:
+
+  // 同期の統計
+  Statistics statistics;
+
+  // 最も古い組を取り出す
+  bool matchOldest(std::vector<Frame> &set, double &skew)
+  {
+    for (;;)
+    {
+      // 空の待ち行列があれば組は作れない
+      for (const auto &q : queue) if (q.empty()) return false;
+
+      // 先頭のフレームのタイムスタンプの最大値を基準にする
+      double reference(-std::numeric_limits<double>::max());
+      for (const auto &q : queue) reference = std::max(reference, q.front().timestamp);
+
+      // 基準より tolerance 以上古いフレームは組にならないので捨てる
+      bool discarded(false);
+      for (size_t i = 0; i < queue.size(); ++i)
+      {
+        while (!queue[i].empty() && queue[i].front().timestamp < reference - tolerance)
+        {
+          queue[i].pop_front();
+          ++statistics.dropped[i];
+          discarded = true;
+        }
+      }
+
+      // 捨てたフレームがあれば基準を求め直す
+      if (discarded) continue;
+
+      // センサごとに基準以前で基準に最も近いフレームを選ぶ
+      double lower(std::numeric_limits<double>::max()), upper(-lower);
+      for (size_t i = 0; i < queue.size(); ++i)
+      {
+        auto &q(queue[i]);
+        auto best(q.begin());
+        for (auto e = q.begin(); e != q.end() && e->timestamp <= reference; ++e) best = e;
+
+        // 選んだフレームより古いフレームは捨てる
+        lower = std::min(lower, best->timestamp);
+        upper = std::max(upper, best->timestamp);
+        set.emplace_back(std::move(best->frame));
+        statistics.dropped[i] += best - q.begin();
+        q.erase(q.begin(), best + 1);
+      }
+
+      // 組のタイムスタンプの差
+      skew = upper - lower;
+      return true;
+    }
+  }
+
+public:
+
+  // コンストラクタ
+  //   count センサの数
+  //   tolerance 同じ組とみなすタイムスタンプの差の最大値 (ms)
+  //   window センサごとに保持するフレームの最大数
+  FrameSync(size_t count, double tolerance, size_t window = 4)
+    : queue(count)
+    , window(std::max(window, size_t(1)))
+    , tolerance(tolerance)
+    , statistics{ 0, 0, std::vector<unsigned long long>(count, 0), 0.0, 0.0, 0.0 }
+  {
+  }
+
+  // センサ i のフレームを追加する
+  void push(size_t i, double timestamp, const Frame &frame)
+  {
+    // 保持する数を超えたら最も古いフレームを捨てる
+    if (queue[i].size() >= window)
+    {
+      queue[i].pop_front();
+      ++statistics.dropped[i];
+    }
+
+    // タイムスタンプが戻っていたら (デバイスの再接続など) それまでのフレームを捨てる
+    if (!queue[i].empty() && timestamp < queue[i].back().timestamp)
+    {
+      statistics.dropped[i] += queue[i].size();
+      queue[i].clear();
+    }
+
+    queue[i].push_back(Entry{ timestamp, frame });
+  }
+
+  // タイムスタンプのそろった最も新しいフレームの組を取り出す (組がなければ false)
+  bool match(std::vector<Frame> &set)
+  {
+    // 組が見つかったら true
+    bool found(false);
+
+    // 組のタイムスタンプの差
+    double skew(0.0);
+
+    // 組が作れる限り古い順に取り出して最後の組を残す
+    for (std::vector<Frame> candidate; matchOldest(candidate, skew); candidate.clear())
+    {
+      if (found) ++statistics.skipped;
+      set.swap(candidate);
+      found = true;
+    }
+
+    // 組を出力したら統計を更新する
+    if (found)
+    {
+      ++statistics.matched;
+      statistics.skew = skew;
+      statistics.maxSkew = std::max(statistics.maxSkew, skew);
+      statistics.totalSkew += skew;
+    }
+
+    return found;
+  }
+
+  // 同期の統計を得る
+  const Statistics &getStatistics() const
+  {
+    return statistics;
+  }
+};
@@ -115,7 +115,7 @@ struct GgApplication
   }
 
   // アプリケーションの実行
-  virtual void run();
+  virtual void run(int argc, const char *const *argv);
 
   //
   // ウィンドウ関連の処理
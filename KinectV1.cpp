@@ -86,25 +86,27 @@ KinectV1::KinectV1()
   colorWidth = COLOR_W;
   colorHeight = COLOR_H;
 
-  // まだシェーダが作られていなかったら
-  if (shader.get() == nullptr)
-  {
-    // カメラ座標算出用のシェーダを作成する
-    shader.reset(new Compute("position_v1.comp"));
+  // カメラ座標算出用のシェーダを用意する
+  shader = Compute::share("position_v1.comp", getFilterDefines());
 
-    // シェーダの uniform 変数の場所を調べる
-    depthLoc = glGetUniformLocation(shader->get(), "depth");
-    pointLoc = glGetUniformLocation(shader->get(), "point");
-    scaleLoc = glGetUniformLocation(shader->get(), "scale");
+  // シェーダの uniform 変数の場所を調べる
+  depthLoc = glGetUniformLocation(shader->get(), "depth");
+  pointLoc = glGetUniformLocation(shader->get(), "point");
 
-    // シェーダストレージブロックに結合ポイントを割り当てる
-    const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
-    glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
-  }
+  // Uniform Block に結合ポイントを割り当てる
+  const GLuint parameterIndex(glGetProgramResourceIndex(shader->get(), GL_UNIFORM_BLOCK, "Parameter"));
+  glUniformBlockBinding(shader->get(), parameterIndex, ParameterBinding);
+
+  // シェーダストレージブロックに結合ポイントを割り当てる
+  const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
+  glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
 
   // テクスチャとバッファオブジェクトを作成してポイント数を返す
   const int depthCount(makeTexture());
 
+  // カメラ座標を求めるシェーダのワークグループのサイズをこの解像度で自動調整する
+  tunePosition(shader);
+
   // デプスデータの計測不能点を変換するために用いる一次メモリを確保する
   depth.resize(depthCount);
 
@@ -114,6 +116,10 @@ KinectV1::KinectV1()
   // デプスマップのテクスチャ座標に対する頂点座標の拡大率
   scale[0] = static_cast<GLfloat>(NUI_CAMERA_DEPTH_NOMINAL_INVERSE_FOCAL_LENGTH_IN_PIXELS * depthWidth);
   scale[1] = static_cast<GLfloat>(NUI_CAMERA_DEPTH_NOMINAL_INVERSE_FOCAL_LENGTH_IN_PIXELS * depthHeight);
+
+  // 拡大率は変わらないので Uniform Buffer Object に入れておく (std140 では vec4 の大きさにする)
+  const GLfloat parameter[] = { scale[0], scale[1], 0.0f, 0.0f };
+  parameterBuffer = makeParameter(parameter, sizeof parameter);
 }
 
 // デストラクタ
@@ -185,6 +191,9 @@ GLuint KinectV1::getDepth()
 
     // データをアンロックする
     sensor->NuiImageStreamReleaseFrame(depthStream, &frame);
+
+    // 新しいデプスデータを受け取った
+    ++depthFrame;
   }
 
   return depthTexture;
@@ -260,6 +269,10 @@ GLuint KinectV1::getPoint()
 
     // データをアンロックする
     sensor->NuiImageStreamReleaseFrame(depthStream, &frame);
+
+    // 新しいデプスデータを受け取ってカメラ座標を求めた
+    ++depthFrame;
+    updatePoint();
   }
 
   return pointTexture;
@@ -269,14 +282,21 @@ GLuint KinectV1::getPoint()
 GLuint KinectV1::getPosition()
 {
   const GLuint depthTexture(getDepth());
+
+  // デプスデータが更新されていなければカメラ座標は求め直さない
+  if (!updatePoint()) return pointTexture;
+
+  // 自動調整中なら候補のシェーダに切り替えて計測する
+  beginPosition(shader);
   shader->use();
   glUniform1i(depthLoc, DepthImageUnit);
   glUniform1i(pointLoc, PointImageUnit);
-  glUniform2fv(scaleLoc, 1, scale);
+  glBindBufferBase(GL_UNIFORM_BUFFER, ParameterBinding, parameterBuffer);
   glBindImageTexture(DepthImageUnit, depthTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R16UI);
   glBindImageTexture(PointImageUnit, pointTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WeightBinding, weightBuffer);
-  shader->execute(depthWidth, depthHeight, 16, 16);
+  shader->dispatch(depthWidth, depthHeight, 0, filterApron);
+  endPosition();
 
   return pointTexture;
 }
@@ -322,16 +342,4 @@ int KinectV1::connected(0);
 // 使用しているセンサの数
 int KinectV1::activated(0);
 
-// カメラ座標を計算するシェーダ
-std::unique_ptr<Compute> KinectV1::shader(nullptr);
-
-// デプスデータのイメージユニットの uniform 変数 depth の場所
-GLint KinectV1::depthLoc;
-
-// カメラ座標のイメージユニットの uniform 変数 point の場所
-GLint KinectV1::pointLoc;
-
-// スクリーン座標からカメラ座標に変換する係数の uniform 変数 scale の場所
-GLint KinectV1::scaleLoc;
-
 #endif
@@ -7,10 +7,6 @@
 // Kinect V1 を使う
 #if !defined(USE_KINECT_V1)
 #  define USE_KINECT_V1 1
-#  ifdef SENSOR
-#    undef SENSOR
-#  endif
-#  define SENSOR KinectV1
 #endif
 
 #if USE_KINECT_V1
@@ -69,16 +65,13 @@ class KinectV1 : public DepthCamera
   GLfloat scale[2];
 
   // カメラ座標を計算するシェーダ
-  static std::unique_ptr<Compute> shader;
+  std::shared_ptr<Compute> shader;
 
   // デプスデータのイメージユニットの uniform 変数 depth の場所
-  static GLint depthLoc;
+  GLint depthLoc;
 
   // カメラ座標のイメージユニットの uniform 変数 point の場所
-  static GLint pointLoc;
-
-  // スクリーン座標からカメラ座標に変換する係数の uniform 変数 scale の場所
-  static GLint scaleLoc;
+  GLint pointLoc;
 
 public:
 
@@ -94,6 +87,12 @@ public:
   // 疑似カラー処理の範囲
   static constexpr GLfloat range[2] = { 0.8f, 4.0f };
 
+  // 疑似カラー処理の範囲を得る
+  const GLfloat *getRange() const
+  {
+    return range;
+  }
+
   // デプスデータを取得する
   GLuint getDepth();
 
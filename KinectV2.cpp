@@ -91,25 +91,24 @@ KinectV2::KinectV2()
     return;
   }
 
-  // まだシェーダが作られていなかったら
-  if (shader.get() == nullptr)
-  {
-    // カメラ座標算出用のシェーダを作成する
-    shader.reset(new Compute("position_v2.comp"));
+  // カメラ座標算出用のシェーダを用意する
+  shader = Compute::share("position_v2.comp", getFilterDefines());
 
-    // シェーダの uniform 変数の場所を調べる
-    depthLoc = glGetUniformLocation(shader->get(), "depth");
-    pointLoc = glGetUniformLocation(shader->get(), "point");
-    mapperLoc = glGetUniformLocation(shader->get(), "mapper");
+  // シェーダの uniform 変数の場所を調べる
+  depthLoc = glGetUniformLocation(shader->get(), "depth");
+  pointLoc = glGetUniformLocation(shader->get(), "point");
+  mapperLoc = glGetUniformLocation(shader->get(), "mapper");
 
-    // シェーダストレージブロックに結合ポイントを割り当てる
-    const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
-    glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
-  }
+  // シェーダストレージブロックに結合ポイントを割り当てる
+  const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
+  glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
 
   // テクスチャとバッファオブジェクトを作成してポイント数を返す
   const int depthCount(makeTexture());
 
+  // カメラ座標を求めるシェーダのワークグループのサイズをこの解像度で自動調整する
+  tunePosition(shader);
+
   // デプスデータの計測不能点を変換するために用いる一次メモリを確保する
   depth.resize(depthCount);
 
@@ -119,10 +118,11 @@ KinectV2::KinectV2()
   // カラーデータを変換する用いる一時メモリを確保する
   color.resize(colorWidth * colorHeight * 4);
 
+  // YUY2 のカラーデータはシェーダで RGB に変換する
+  makeYuyvTexture();
+
   // デプス値に対するカメラ座標の変換テーブルのテクスチャを作成する
-  glGenTextures(1, &mapperTexture);
-  glBindTexture(GL_TEXTURE_2D, mapperTexture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, depthWidth, depthHeight, 0, GL_RG, GL_FLOAT, NULL);
+  mapperTexture = acquireTexture(GL_RG32F, depthWidth, depthHeight);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -133,11 +133,9 @@ KinectV2::KinectV2()
 KinectV2::~KinectV2()
 {
   // コンストラクタが正常に実行されセンサが有効なら
+  //   変換テーブルのテクスチャは DepthCamera のデストラクタで資源プールに返却する
   if (mapperTexture > 0 && sensor)
   {
-    // 変換テーブルのテクスチャを削除する
-     glDeleteTextures(1, &mapperTexture);
-
     // センサを開放する
     colorReader->Release();
     depthReader->Release();
@@ -198,6 +196,9 @@ GLuint KinectV2::getDepth()
 
     // デプスフレームを開放する
     depthFrame->Release();
+
+    // 新しいデプスデータを受け取った
+    ++this->depthFrame;
   }
 
   return depthTexture;
@@ -256,6 +257,10 @@ GLuint KinectV2::getPoint()
 
     // デプスフレームを開放する
     depthFrame->Release();
+
+    // 新しいデプスデータを受け取ってカメラ座標を求めた
+    ++this->depthFrame;
+    updatePoint();
   }
 
   return pointTexture;
@@ -265,6 +270,12 @@ GLuint KinectV2::getPoint()
 GLuint KinectV2::getPosition()
 {
   const GLuint depthTexture(getDepth());
+
+  // デプスデータが更新されていなければカメラ座標は求め直さない
+  if (!updatePoint()) return pointTexture;
+
+  // 自動調整中なら候補のシェーダに切り替えて計測する
+  beginPosition(shader);
   shader->use();
   glUniform1i(depthLoc, DepthImageUnit);
   glUniform1i(pointLoc, PointImageUnit);
@@ -273,7 +284,8 @@ GLuint KinectV2::getPosition()
   glBindImageTexture(PointImageUnit, pointTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
   glBindImageTexture(MapperImageUnit, mapperTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WeightBinding, weightBuffer);
-  shader->execute(depthWidth, depthHeight, 16, 16);
+  shader->dispatch(depthWidth, depthHeight, 0, filterApron);
+  endPosition();
 
   return pointTexture;
 }
@@ -288,15 +300,35 @@ GLuint KinectV2::getColor()
   IColorFrame *colorFrame;
   if (colorReader->AcquireLatestFrame(&colorFrame) == S_OK)
   {
-    // カラーデータを取得して RGBA 形式に変換する
-    colorFrame->CopyConvertedFrameDataToArray(static_cast<UINT>(color.size()),
-      static_cast<BYTE *>(color.data()), ColorImageFormat::ColorImageFormat_Bgra);
+    // カラーデータのもとの形式
+    ColorImageFormat format(ColorImageFormat::ColorImageFormat_None);
+    colorFrame->get_RawColorImageFormat(&format);
+
+    // もとの形式が YUY2 なら
+    if (format == ColorImageFormat::ColorImageFormat_Yuy2)
+    {
+      // カラーデータをそのまま取得する
+      colorFrame->CopyRawFrameDataToArray(static_cast<UINT>(colorWidth * colorHeight * 2),
+        static_cast<BYTE *>(color.data()));
+
+      // カラーフレームを開放する
+      colorFrame->Release();
+
+      // カラーデータをテクスチャに転送してシェーダで RGB に変換する
+      setYuyv(color.data());
+    }
+    else
+    {
+      // カラーデータを取得して RGBA 形式に変換する
+      colorFrame->CopyConvertedFrameDataToArray(static_cast<UINT>(color.size()),
+        static_cast<BYTE *>(color.data()), ColorImageFormat::ColorImageFormat_Bgra);
 
-    // カラーフレームを開放する
-    colorFrame->Release();
+      // カラーフレームを開放する
+      colorFrame->Release();
 
-    // カラーデータをテクスチャに転送する
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth, colorHeight, GL_BGRA, GL_UNSIGNED_BYTE, color.data());
+      // カラーデータをテクスチャに転送する
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth, colorHeight, GL_BGRA, GL_UNSIGNED_BYTE, color.data());
+    }
   }
 
   return colorTexture;
@@ -305,16 +337,4 @@ GLuint KinectV2::getColor()
 // センサの識別子
 IKinectSensor *KinectV2::sensor(nullptr);
 
-// カメラ座標を計算するシェーダ
-std::unique_ptr<Compute> KinectV2::shader(nullptr);
-
-// デプスデータのイメージユニットの uniform 変数 depth の場所
-GLint KinectV2::depthLoc;
-
-// カメラ座標のイメージユニットの uniform 変数 point の場所
-GLint KinectV2::pointLoc;
-
-// 変換テーブルのイメージユニットの uniform 変数 point の場所
-GLint KinectV2::mapperLoc;
-
 #endif
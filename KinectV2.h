@@ -7,10 +7,6 @@
 // Kinect V2 を使う
 #if !defined(USE_KINECT_V2)
 #  define USE_KINECT_V2 1
-#  ifdef SENSOR
-#    undef SENSOR
-#  endif
-#  define SENSOR KinectV2
 #endif
 
 #if USE_KINECT_V2
@@ -49,16 +45,16 @@ class KinectV2 : public DepthCamera
   std::vector<GLubyte> color;
 
   // カメラ座標を計算するシェーダ
-  static std::unique_ptr<Compute> shader;
+  std::shared_ptr<Compute> shader;
 
   // デプスデータのイメージユニットの uniform 変数 depth の場所
-  static GLint depthLoc;
+  GLint depthLoc;
 
   // カメラ座標のイメージユニットの uniform 変数 point の場所
-  static GLint pointLoc;
+  GLint pointLoc;
 
   // 変換テーブルのイメージユニットの uniform 変数 mapper の場所
-  static GLint mapperLoc;
+  GLint mapperLoc;
 
 public:
 
@@ -74,6 +70,12 @@ public:
   // 疑似カラー処理の範囲
   static constexpr GLfloat range[2] = { 0.5f, 8.0f };
 
+  // 疑似カラー処理の範囲を得る
+  const GLfloat *getRange() const
+  {
+    return range;
+  }
+
   // デプスデータを取得する
   GLuint getDepth();
 
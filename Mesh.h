@@ -8,19 +8,46 @@
 #include "gg.h"
 using namespace gg;
 
+// 標準ライブラリ
+#include <map>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+
 class Mesh
 {
   // 頂点配列オブジェクト
   GLuint vao;
 
+  // インスタンスごとの行の番号を格納するバッファオブジェクト
+  GLuint rowBuffer;
+
+  // メッシュの横と縦の格子点の数
+  const GLint slices, stacks;
+
 public:
 
   // コンストラクタ
-  Mesh()
+  Mesh(GLint slices, GLint stacks)
+    : slices(slices)
+    , stacks(stacks)
   {
     // 頂点配列オブジェクトを作成する
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
+
+    // インスタンスごとの行の番号を 1 番の頂点属性にする
+    //   gl_InstanceID には baseInstance が足されないので, 途中の行から描くときはこれを使う
+    std::vector<GLint> row(stacks);
+    std::iota(row.begin(), row.end(), 0);
+    glGenBuffers(1, &rowBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, rowBuffer);
+    glBufferData(GL_ARRAY_BUFFER, row.size() * sizeof row[0], row.data(), GL_STATIC_DRAW);
+    glVertexAttribIPointer(1, 1, GL_INT, 0, 0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
   }
 
   // コピーコンストラクタを封じる
@@ -34,15 +61,51 @@ public:
   {
     // 頂点配列オブジェクトを削除する
     glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &rowBuffer);
+  }
+
+  // 同じ解像度のメッシュを共有する (使っているものがなくなれば削除する)
+  static std::shared_ptr<Mesh> share(GLint slices, GLint stacks)
+  {
+    // 作成したメッシュ
+    static std::map<std::pair<GLint, GLint>, std::weak_ptr<Mesh>> meshes;
+
+    // まだ使われていれば同じものを返す
+    std::weak_ptr<Mesh> &entry(meshes[std::make_pair(slices, stacks)]);
+    std::shared_ptr<Mesh> mesh(entry.lock());
+    if (!mesh) entry = mesh = std::make_shared<Mesh>(slices, stacks);
+
+    return mesh;
   }
 
   // 描画
-  virtual void draw(GLint slices, GLint stacks) const
+  //   roi は描画する格子点の範囲 (左下の位置と幅と高さ, nullptr なら全体)
+  virtual void draw(const GLint *roi = nullptr) const
+  {
+    // 頂点配列オブジェクトを指定する
+    glBindVertexArray(vao);
+
+    // 全体を描画する
+    if (!roi)
+    {
+      glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, slices * 2, stacks - 1);
+      return;
+    }
+
+    // 範囲の列から始まる三角形ストリップを範囲の行から描画する
+    glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, roi[0] * 2, roi[2] * 2, roi[3] - 1, roi[1]);
+  }
+
+  // バッファオブジェクトの描画コマンドで描画する
+  //   commands は baseInstance に行の番号を入れた count 個の glMultiDrawArraysIndirect() の描画コマンド
+  void draw(GLuint commands, GLsizei count) const
   {
     // 頂点配列オブジェクトを指定する
     glBindVertexArray(vao);
 
     // 描画する
-    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, slices * 2, stacks - 1);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands);
+    glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, nullptr, count, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
   }
 };
@@ -0,0 +1,528 @@
+﻿#include "MeshExtractor.h"
+
+//
+// 点群を統合した符号付き距離場からのメッシュの抽出と書き出し
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+// 累積和の一つのワークグループで処理する要素の数 (scan.comp の LOCAL_SIZE_X の 2 倍)
+static constexpr GLsizei scanBlock(512);
+
+// コンストラクタ
+MeshExtractor::MeshExtractor(const std::string &prefix, Format format, const GLfloat *center, GLfloat size,
+  GLint resolution, GLfloat truncation, GLfloat maxDistance, GLsizei vertexCapacity, GLsizei triangleCapacity)
+  : prefix(prefix)
+  , format(format)
+  , resolution(std::max(resolution, 2))
+  , voxelSize(size / static_cast<GLfloat>(std::max(resolution, 2) - 1))
+  , truncation(truncation > 0.0f ? truncation : 3.0f * voxelSize)
+  , maxDistance(maxDistance)
+  , vertexCapacity(vertexCapacity)
+  , triangleCapacity(triangleCapacity)
+  , fuse("fuse.comp")
+  , classify("classify.comp")
+  , scanner("scan.comp")
+  , edge("edge.comp")
+  , triangle("triangle.comp")
+  , pointLoc(glGetUniformLocation(fuse.get(), "point"))
+  , attitudeLoc(glGetUniformLocation(fuse.get(), "attitude"))
+  , maxDistanceLoc(glGetUniformLocation(fuse.get(), "maxDistance"))
+  , foregroundLoc(glGetUniformLocation(fuse.get(), "foreground"))
+  , foregroundOnlyLoc(glGetUniformLocation(fuse.get(), "foregroundOnly"))
+  , fuseOriginLoc(glGetUniformLocation(fuse.get(), "origin"))
+  , fuseResolutionLoc(glGetUniformLocation(fuse.get(), "resolution"))
+  , fuseVoxelSizeLoc(glGetUniformLocation(fuse.get(), "voxelSize"))
+  , truncationLoc(glGetUniformLocation(fuse.get(), "truncation"))
+  , classifyResolutionLoc(glGetUniformLocation(classify.get(), "resolution"))
+  , countLoc(glGetUniformLocation(scanner.get(), "count"))
+  , addLoc(glGetUniformLocation(scanner.get(), "add"))
+  , edgeOriginLoc(glGetUniformLocation(edge.get(), "origin"))
+  , edgeResolutionLoc(glGetUniformLocation(edge.get(), "resolution"))
+  , edgeVoxelSizeLoc(glGetUniformLocation(edge.get(), "voxelSize"))
+  , triangleResolutionLoc(glGetUniformLocation(triangle.get(), "resolution"))
+  , fence(nullptr)
+  , busy(false)
+  , frame(0)
+  , quit(false)
+  , fused(0)
+  , extracted(0)
+  , written(0)
+{
+  // 統合する領域の最小の角
+  for (int i = 0; i < 3; ++i) origin[i] = center[i] - 0.5f * size;
+
+  // シェーダストレージブロックに結合ポイントを割り当てる
+  const auto bind([](const Compute &shader, const char *name, GLuint binding)
+  {
+    const GLuint index(glGetProgramResourceIndex(shader.get(), GL_SHADER_STORAGE_BLOCK, name));
+    if (index != GL_INVALID_INDEX) glShaderStorageBlockBinding(shader.get(), index, binding);
+  });
+  bind(fuse, "Volume", DepthCamera::VolumeBinding);
+  bind(classify, "Volume", DepthCamera::VolumeBinding);
+  bind(classify, "Cases", DepthCamera::TableBinding);
+  bind(classify, "Cells", DepthCamera::CellBinding);
+  bind(classify, "VertexOffset", DepthCamera::VertexOffsetBinding);
+  bind(classify, "TriangleOffset", DepthCamera::TriangleOffsetBinding);
+  bind(classify, "Total", DepthCamera::TotalBinding);
+  bind(scanner, "Scan", DepthCamera::ScanBinding);
+  bind(scanner, "Sum", DepthCamera::SumBinding);
+  bind(edge, "Volume", DepthCamera::VolumeBinding);
+  bind(edge, "Cells", DepthCamera::CellBinding);
+  bind(edge, "VertexOffset", DepthCamera::VertexOffsetBinding);
+  bind(edge, "MeshVertex", DepthCamera::MeshVertexBinding);
+  bind(triangle, "Cases", DepthCamera::TableBinding);
+  bind(triangle, "Cells", DepthCamera::CellBinding);
+  bind(triangle, "VertexOffset", DepthCamera::VertexOffsetBinding);
+  bind(triangle, "TriangleOffset", DepthCamera::TriangleOffsetBinding);
+  bind(triangle, "MeshIndex", DepthCamera::MeshIndexBinding);
+
+  // 格子点の数
+  const GLsizei count(this->resolution * this->resolution * this->resolution);
+
+  // 格子点と立方体ごとのバッファオブジェクトを作成する
+  const auto create([](GLsizeiptr size, const void *data, GLbitfield flags)
+  {
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, data, flags);
+    return buffer;
+  });
+  volumeBuffer = create(count * sizeof (GLint[2]), nullptr, 0);
+  cellBuffer = create(count * sizeof (GLuint), nullptr, 0);
+  vertexOffsetBuffer = create(count * sizeof (GLuint), nullptr, 0);
+  triangleOffsetBuffer = create(count * sizeof (GLuint), nullptr, 0);
+
+  // 累積和の段ごとのブロックの合計
+  for (GLsizei n = count; n > 1; n = (n + scanBlock - 1) / scanBlock)
+  {
+    sumBuffer.push_back(create((n + scanBlock - 1) / scanBlock * sizeof (GLuint), nullptr, 0));
+  }
+
+  // 立方体の状態ごとの三角形の辺の番号の表
+  std::vector<GLint> start, edges;
+  makeCases(start, edges);
+  start.insert(start.end(), edges.begin(), edges.end());
+  caseBuffer = create(start.size() * sizeof (GLint), start.data(), 0);
+
+  // 読み出しに使うバッファオブジェクトは永続的にマップしておく
+  const GLbitfield mapping(GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+  const auto map([&](GLuint &buffer, GLsizeiptr size)
+  {
+    buffer = create(size, nullptr, mapping);
+    return glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size, mapping);
+  });
+  total = static_cast<const GLuint *>(map(totalBuffer, sizeof (GLuint[2])));
+  vertex = static_cast<const Vertex *>(map(vertexBuffer, vertexCapacity * sizeof (Vertex)));
+  index = static_cast<const GLuint *>(map(indexBuffer, triangleCapacity * sizeof (GLuint[3])));
+
+  // 空の符号付き距離場にしておく
+  reset();
+
+  // 書き出しスレッドを起動する
+  writer = std::thread([this]() { write(); });
+}
+
+// デストラクタ
+MeshExtractor::~MeshExtractor()
+{
+  // 読み出し中のメッシュを書き出しスレッドに渡す
+  if (fence)
+  {
+    glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+    update();
+  }
+
+  // 書き出しスレッドを止める
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    quit = true;
+  }
+  queueCondition.notify_one();
+  writer.join();
+
+  // 読み出し中のまま残ったフェンスを削除する
+  if (fence) glDeleteSync(fence);
+
+  // マップを解除する
+  for (const GLuint buffer : { totalBuffer, vertexBuffer, indexBuffer })
+  {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+  }
+
+  // バッファオブジェクトを削除する
+  glDeleteBuffers(static_cast<GLsizei>(sumBuffer.size()), sumBuffer.data());
+  const GLuint buffers[] = { volumeBuffer, cellBuffer, vertexOffsetBuffer, triangleOffsetBuffer,
+    caseBuffer, totalBuffer, vertexBuffer, indexBuffer };
+  glDeleteBuffers(static_cast<GLsizei>(sizeof buffers / sizeof buffers[0]), buffers);
+}
+
+// 立方体の状態ごとの三角形の辺の番号の表を作る
+//
+//   立方体の角 c の座標は (c & 1, c >> 1 & 1, c >> 2 & 1) で, 状態のビット c が 1 なら角 c は表面の奥にある
+//   各面を外から見て反時計回りにたどり, 奥に入る辺から次に手前に出る辺へ線分を結ぶ
+//   面の角が交互に奥と手前になる曖昧な場合は奥の角を切り離すことになり, 隣の立方体と同じ結び方になる
+//   線分はどの面でも同じ向きに結ぶので輪になり, 輪を扇形に三角形分割すると表面の手前から見て反時計回りになる
+//   扇の対角線が立方体の面の上にあると隣の立方体の三角形と辺を取り合うので, 対角線が面に乗らない頂点を扇の要にする
+//
+void MeshExtractor::makeCases(std::vector<GLint> &start, std::vector<GLint> &edges)
+{
+  // 角 c0 と c1 を結ぶ辺の番号
+  const auto edgeOf([](int c0, int c1)
+  {
+    const int a((c0 ^ c1) == 1 ? 0 : (c0 ^ c1) == 2 ? 1 : 2);
+    const int c(std::min(c0, c1));
+    return a * 4 + (c >> (a + 1) % 3 & 1) + (c >> (a + 2) % 3 & 1) * 2;
+  });
+
+  // 辺 e を含む立方体の面のビット (軸 a に垂直で座標が s の面は a * 2 + s 番目のビット)
+  const auto facesOf([](int e)
+  {
+    const int a(e / 4), b((a + 1) % 3), c((a + 2) % 3);
+    return 1 << (b * 2 + (e & 1)) | 1 << (c * 2 + (e >> 1 & 1));
+  });
+
+  start.clear();
+  edges.clear();
+
+  for (int state = 0; state < 256; ++state)
+  {
+    start.push_back(static_cast<GLint>(edges.size()));
+
+    // 線分の始点の辺から終点の辺への対応
+    std::map<int, int> link;
+
+    // 軸 a に垂直な面で座標が s のもの
+    for (int a = 0; a < 3; ++a) for (int s = 0; s < 2; ++s)
+    {
+      // 軸 a の外向きから見て反時計回りの面の角 (軸 a, b, c は右手系)
+      const int b((a + 1) % 3), c((a + 2) % 3);
+      static constexpr int ccw[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+      int q[4];
+      for (int k = 0; k < 4; ++k)
+      {
+        // 外向きが負の向きなら逆回りにする
+        const int *const uv(ccw[s == 1 ? k : (4 - k) % 4]);
+        q[k] = s << a | uv[0] << b | uv[1] << c;
+      }
+
+      // 奥に入る辺から次に手前に出る辺へ結ぶ
+      const auto inside([state](int corner) { return (state >> corner & 1) != 0; });
+      for (int k = 0; k < 4; ++k)
+      {
+        if (inside(q[k]) || !inside(q[(k + 1) % 4])) continue;
+        for (int l = 1; l < 4; ++l)
+        {
+          const int m((k + l) % 4);
+          if (inside(q[m]) && !inside(q[(m + 1) % 4]))
+          {
+            link[edgeOf(q[k], q[(k + 1) % 4])] = edgeOf(q[m], q[(m + 1) % 4]);
+            break;
+          }
+        }
+      }
+    }
+
+    // 線分をたどって輪にし, 扇形に三角形分割する
+    while (!link.empty())
+    {
+      std::vector<int> loop;
+      for (int e(link.begin()->first); link.count(e) > 0;)
+      {
+        loop.push_back(e);
+        const int next(link[e]);
+        link.erase(e);
+        e = next;
+      }
+
+      // 扇の要から隣り合わない頂点への対角線がどれも立方体の面に乗らない要を探す
+      const size_t n(loop.size());
+      size_t apex(0);
+      for (size_t i = 0; i < n; ++i)
+      {
+        bool crossing(false);
+        for (size_t k = 2; k + 1 < n; ++k) crossing |= (facesOf(loop[i]) & facesOf(loop[(i + k) % n])) != 0;
+        if (!crossing)
+        {
+          apex = i;
+          break;
+        }
+      }
+
+      for (size_t k = 2; k < n; ++k)
+      {
+        edges.push_back(loop[apex]);
+        edges.push_back(loop[(apex + k - 1) % n]);
+        edges.push_back(loop[(apex + k) % n]);
+      }
+    }
+  }
+
+  start.push_back(static_cast<GLint>(edges.size()));
+}
+
+// buffer の count 個の要素を排他的累積和にする
+void MeshExtractor::scan(GLuint buffer, GLsizei count, size_t level) const
+{
+  // ブロックごとの排他的累積和とブロックの合計を求める
+  scanner.use();
+  glUniform1i(countLoc, count);
+  glUniform1i(addLoc, GL_FALSE);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::ScanBinding, buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::SumBinding, sumBuffer[level]);
+  scanner.execute(count, 1, scanBlock);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // ブロックが一つなら終わり
+  const GLsizei blocks((count + scanBlock - 1) / scanBlock);
+  if (blocks <= 1) return;
+
+  // ブロックの合計を排他的累積和にする
+  scan(sumBuffer[level], blocks, level + 1);
+
+  // それぞれのブロックに前のブロックまでの合計を足す
+  scanner.use();
+  glUniform1i(countLoc, count);
+  glUniform1i(addLoc, GL_TRUE);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::ScanBinding, buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::SumBinding, sumBuffer[level]);
+  scanner.execute(count, 1, scanBlock);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// 統合した符号付き距離場を空にする
+void MeshExtractor::reset()
+{
+  const GLint zero(0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, volumeBuffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32I, GL_RED_INTEGER, GL_INT, &zero);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// センサの点群を符号付き距離場に統合する
+void MeshExtractor::integrate(const DepthCamera &sensor)
+{
+  // デプスセンサのサイズ
+  int width, height;
+  sensor.getDepthResolution(&width, &height);
+
+  fuse.use();
+  glUniform1i(pointLoc, DepthCamera::PointImageUnit);
+  glUniformMatrix4fv(attitudeLoc, 1, GL_FALSE, sensor.attitude.get());
+  glUniform1f(maxDistanceLoc, maxDistance);
+  glUniform3fv(fuseOriginLoc, 1, origin);
+  glUniform1i(fuseResolutionLoc, resolution);
+  glUniform1f(fuseVoxelSizeLoc, voxelSize);
+  glUniform1f(truncationLoc, truncation);
+  glBindImageTexture(DepthCamera::PointImageUnit, sensor.getPointTexture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+
+  // 前景を抽出していれば前景だけを統合する
+  const GLuint foreground(sensor.getForegroundTexture());
+  glUniform1i(foregroundOnlyLoc, foreground != 0);
+  if (foreground != 0)
+  {
+    glUniform1i(foregroundLoc, DepthCamera::ForegroundImageUnit);
+    glBindImageTexture(DepthCamera::ForegroundImageUnit, foreground, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  }
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::VolumeBinding, volumeBuffer);
+  fuse.dispatch(width, height);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  ++fused;
+}
+
+// メッシュの抽出を開始する
+bool MeshExtractor::extract()
+{
+  // 前のメッシュを読み出し中か書き出し中なら抽出しない
+  if (isBusy()) return false;
+
+  // 格子点の数
+  const GLsizei count(resolution * resolution * resolution);
+
+  // 頂点と三角形の総数を 0 にする
+  const GLuint zero(0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, totalBuffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // 立方体ごとの頂点と三角形の数を求める
+  classify.use();
+  glUniform1i(classifyResolutionLoc, resolution);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::VolumeBinding, volumeBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::TableBinding, caseBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::CellBinding, cellBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::VertexOffsetBinding, vertexOffsetBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::TriangleOffsetBinding, triangleOffsetBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::TotalBinding, totalBuffer);
+  classify.dispatch(resolution, resolution * resolution);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // 頂点と三角形の数を累積和にして格納先の先頭の番号にする
+  scan(vertexOffsetBuffer, count);
+  scan(triangleOffsetBuffer, count);
+
+  // 頂点を求める
+  edge.use();
+  glUniform3fv(edgeOriginLoc, 1, origin);
+  glUniform1i(edgeResolutionLoc, resolution);
+  glUniform1f(edgeVoxelSizeLoc, voxelSize);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::VolumeBinding, volumeBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::CellBinding, cellBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::VertexOffsetBinding, vertexOffsetBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::MeshVertexBinding, vertexBuffer);
+  edge.dispatch(resolution, resolution * resolution);
+
+  // 三角形を求める
+  triangle.use();
+  glUniform1i(triangleResolutionLoc, resolution);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::TableBinding, caseBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::CellBinding, cellBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::VertexOffsetBinding, vertexOffsetBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::TriangleOffsetBinding, triangleOffsetBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::MeshIndexBinding, indexBuffer);
+  triangle.dispatch(resolution, resolution * resolution);
+
+  // マップしたメモリから読めるようにして完了を待つフェンスを置く
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  ++extracted;
+
+  return true;
+}
+
+// 読み出しの完了したメッシュを書き出しスレッドに渡す
+void MeshExtractor::update()
+{
+  // 読み出し中でなければ何もしない
+  if (!fence) return;
+
+  // GPU 側の処理が終わっていなければ待たずに戻る
+  const GLenum status(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0));
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+
+  // フェンスを削除する
+  glDeleteSync(fence);
+  fence = nullptr;
+
+  // 書き出しスレッドに渡す
+  busy = true;
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    queue.push_back(frame++);
+  }
+  queueCondition.notify_one();
+}
+
+// 書き出しスレッドの処理
+void MeshExtractor::write()
+{
+  for (;;)
+  {
+    // 仕事を取り出す
+    unsigned long long number;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueCondition.wait(lock, [this]() { return quit || !queue.empty(); });
+      if (queue.empty()) return;
+      number = queue.front();
+      queue.pop_front();
+    }
+
+    // ファイルに書き出す
+    if (save(number)) ++written;
+
+    // 読み出し先を空ける
+    busy = false;
+  }
+}
+
+// マップしたバッファオブジェクトの内容をファイルに書き出す
+bool MeshExtractor::save(unsigned long long number) const
+{
+  // 頂点数 (格納先からあふれた分は捨てられている)
+  const GLuint vertices(std::min(total[0], static_cast<GLuint>(vertexCapacity)));
+
+  // 格納された頂点だけを使う三角形を選ぶ
+  const GLuint triangles(std::min(total[1], static_cast<GLuint>(triangleCapacity)));
+  std::vector<GLuint> faces;
+  faces.reserve(triangles);
+  for (GLuint t = 0; t < triangles; ++t)
+  {
+    const GLuint *const f(index + t * 3);
+    if (f[0] < vertices && f[1] < vertices && f[2] < vertices) faces.push_back(t);
+  }
+
+  // ファイル名
+  std::ostringstream name;
+  name << prefix << '_' << std::setw(6) << std::setfill('0') << number
+    << (format == PlyFormat ? ".ply" : ".obj");
+
+  // ファイルを開く
+  std::ofstream file(name.str(), std::ios::binary);
+  if (!file) return false;
+
+  if (format == PlyFormat)
+  {
+    // PLY のヘッダ
+    file << "ply\n"
+      "format binary_little_endian 1.0\n"
+      "element vertex " << vertices << "\n"
+      "property float x\n"
+      "property float y\n"
+      "property float z\n"
+      "property float nx\n"
+      "property float ny\n"
+      "property float nz\n"
+      "element face " << faces.size() << "\n"
+      "property list uchar int vertex_indices\n"
+      "end_header\n";
+
+    // 頂点の配列はそのまま書き出す
+    file.write(reinterpret_cast<const char *>(vertex), vertices * sizeof (Vertex));
+
+    // 三角形は頂点数を付けて書き出す
+    std::vector<char> buffer(faces.size() * (1 + sizeof (GLuint[3])));
+    char *p(buffer.data());
+    for (const GLuint t : faces)
+    {
+      *p++ = 3;
+      memcpy(p, index + t * 3, sizeof (GLuint[3]));
+      p += sizeof (GLuint[3]);
+    }
+    file.write(buffer.data(), buffer.size());
+  }
+  else
+  {
+    // ggElementsObj() で読み込めるように頂点位置と法線ベクトルを同じ番号にする
+    file << std::setprecision(7);
+    for (GLuint i = 0; i < vertices; ++i)
+    {
+      const Vertex &v(vertex[i]);
+      file << "v " << v.position[0] << ' ' << v.position[1] << ' ' << v.position[2] << '\n';
+    }
+    for (GLuint i = 0; i < vertices; ++i)
+    {
+      const Vertex &v(vertex[i]);
+      file << "vn " << v.normal[0] << ' ' << v.normal[1] << ' ' << v.normal[2] << '\n';
+    }
+    for (const GLuint t : faces)
+    {
+      const GLuint *const f(index + t * 3);
+      file << 'f';
+      for (int k = 0; k < 3; ++k) file << ' ' << f[k] + 1 << "//" << f[k] + 1;
+      file << '\n';
+    }
+  }
+
+  return !file.bad();
+}
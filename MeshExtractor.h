@@ -0,0 +1,219 @@
+﻿#pragma once
+
+//
+// 点群を統合した符号付き距離場からのメッシュの抽出と書き出し
+//
+//   センサの点群を立方体の領域の Truncated Signed Distance Field (TSDF) に統合し,
+//   マーチングキューブ法で三角形を求めて OBJ か バイナリ PLY のファイルに書き出す
+//   三角形と頂点の格納先は累積和で詰めて求め, 頂点は辺ごとに一つにして三角形で共有する
+//
+
+// デプスセンサ関連の基底クラス
+#include "DepthCamera.h"
+
+// 標準ライブラリ
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MeshExtractor
+{
+public:
+
+  // 書き出すファイルの形式
+  enum Format
+  {
+    PlyFormat = 0,                                      // バイナリ PLY
+    ObjFormat                                           // Wavefront OBJ
+  };
+
+  // 書き出す頂点のデータ (edge.comp と PLY のヘッダに合わせる)
+  struct Vertex
+  {
+    GLfloat position[3];                                // ワールド座標
+    GLfloat normal[3];                                  // ワールド座標の法線ベクトル
+  };
+
+private:
+
+  // 書き出すファイル名の先頭
+  const std::string prefix;
+
+  // 書き出すファイルの形式
+  const Format format;
+
+  // 統合する領域の最小の角のワールド座標
+  GLfloat origin[3];
+
+  // 統合する領域の一辺の格子点の数
+  const GLint resolution;
+
+  // 格子点の間隔
+  const GLfloat voxelSize;
+
+  // 符号付き距離を打ち切る距離
+  const GLfloat truncation;
+
+  // 統合する点のセンサからの最大距離
+  const GLfloat maxDistance;
+
+  // 格納できる頂点と三角形の数
+  const GLsizei vertexCapacity, triangleCapacity;
+
+  // 符号付き距離場を統合するシェーダ
+  const Compute fuse;
+
+  // 立方体ごとの頂点と三角形の数を求めるシェーダ
+  const Compute classify;
+
+  // 累積和を求めるシェーダ
+  const Compute scanner;
+
+  // 頂点を求めるシェーダ
+  const Compute edge;
+
+  // 三角形を求めるシェーダ
+  const Compute triangle;
+
+  // fuse.comp の uniform 変数の場所
+  const GLint pointLoc, attitudeLoc, maxDistanceLoc, foregroundLoc, foregroundOnlyLoc;
+  const GLint fuseOriginLoc, fuseResolutionLoc, fuseVoxelSizeLoc, truncationLoc;
+
+  // classify.comp の uniform 変数の場所
+  const GLint classifyResolutionLoc;
+
+  // scan.comp の uniform 変数の場所
+  const GLint countLoc, addLoc;
+
+  // edge.comp の uniform 変数の場所
+  const GLint edgeOriginLoc, edgeResolutionLoc, edgeVoxelSizeLoc;
+
+  // triangle.comp の uniform 変数の場所
+  const GLint triangleResolutionLoc;
+
+  // 格子点ごとの符号付き距離の和と重みのバッファオブジェクト
+  GLuint volumeBuffer;
+
+  // 立方体ごとの交差する辺と立方体の状態のバッファオブジェクト
+  GLuint cellBuffer;
+
+  // 立方体ごとの頂点と三角形の数を格納先の先頭の番号にするバッファオブジェクト
+  GLuint vertexOffsetBuffer, triangleOffsetBuffer;
+
+  // 累積和の段ごとのブロックの合計のバッファオブジェクト
+  std::vector<GLuint> sumBuffer;
+
+  // 立方体の状態ごとの三角形の辺の番号の表のバッファオブジェクト
+  GLuint caseBuffer;
+
+  // 頂点と三角形の総数, 頂点, 三角形の頂点番号を読み出すバッファオブジェクト
+  GLuint totalBuffer, vertexBuffer, indexBuffer;
+
+  // 永続的にマップしたバッファオブジェクトの先頭
+  const GLuint *total;
+  const Vertex *vertex;
+  const GLuint *index;
+
+  // 読み出しの完了を待つフェンス
+  GLsync fence;
+
+  // 書き出しスレッドが使用中なら true
+  std::atomic<bool> busy;
+
+  // 書き出すメッシュの番号
+  unsigned long long frame;
+
+  // 書き出しスレッドに渡したメッシュの番号
+  std::deque<unsigned long long> queue;
+
+  // 書き出しスレッドとの排他制御
+  std::mutex queueMutex;
+
+  // 書き出しスレッドへの通知
+  std::condition_variable queueCondition;
+
+  // 書き出しスレッドを止めるなら true
+  bool quit;
+
+  // 書き出しスレッド
+  std::thread writer;
+
+  // 統合したフレーム数, 抽出したメッシュの数, 書き出したメッシュの数
+  std::atomic<unsigned long long> fused, extracted, written;
+
+  // 立方体の状態ごとの三角形の辺の番号の表を作る
+  static void makeCases(std::vector<GLint> &start, std::vector<GLint> &edges);
+
+  // buffer の count 個の要素を排他的累積和にする
+  void scan(GLuint buffer, GLsizei count, size_t level = 0) const;
+
+  // 書き出しスレッドの処理
+  void write();
+
+  // マップしたバッファオブジェクトの内容をファイルに書き出す
+  bool save(unsigned long long number) const;
+
+public:
+
+  // コンストラクタ
+  //   prefix 書き出すファイル名の先頭 (後ろにメッシュの番号を付ける)
+  //   format 書き出すファイルの形式
+  //   center 統合する領域の中心のワールド座標
+  //   size 統合する領域の一辺の長さ (m)
+  //   resolution 統合する領域の一辺の格子点の数
+  //   truncation 符号付き距離を打ち切る距離 (m, 0 なら格子点の間隔の 3 倍)
+  //   maxDistance 統合する点のセンサからの最大距離 (m)
+  //   vertexCapacity, triangleCapacity 格納できる頂点と三角形の数
+  MeshExtractor(const std::string &prefix, Format format, const GLfloat *center, GLfloat size,
+    GLint resolution = 128, GLfloat truncation = 0.0f, GLfloat maxDistance = 5.0f,
+    GLsizei vertexCapacity = 1 << 20, GLsizei triangleCapacity = 1 << 21);
+
+  // コピーコンストラクタ (コピー禁止)
+  MeshExtractor(const MeshExtractor &e) = delete;
+
+  // 代入 (代入禁止)
+  MeshExtractor &operator=(const MeshExtractor &e) = delete;
+
+  // デストラクタ
+  virtual ~MeshExtractor();
+
+  // 統合した符号付き距離場を空にする
+  void reset();
+
+  // センサの点群を符号付き距離場に統合する
+  void integrate(const DepthCamera &sensor);
+
+  // メッシュの抽出を開始する (前のメッシュを読み出し中か書き出し中なら false を返す)
+  bool extract();
+
+  // 読み出しの完了したメッシュを書き出しスレッドに渡す
+  void update();
+
+  // 読み出しか書き出しの途中なら true
+  bool isBusy() const
+  {
+    return fence != nullptr || busy;
+  }
+
+  // 統合したフレーム数を得る
+  unsigned long long getFused() const
+  {
+    return fused;
+  }
+
+  // 抽出したメッシュの数を得る
+  unsigned long long getExtracted() const
+  {
+    return extracted;
+  }
+
+  // 書き出したメッシュの数を得る
+  unsigned long long getWritten() const
+  {
+    return written;
+  }
+};
@@ -0,0 +1,839 @@
+﻿#include "ObjLoader.h"
+
+//
+// 三角形分割された Wavefront OBJ ファイルの高速な読み込み
+//
+
+// ファイルのメモリへのマップ
+#ifdef _WIN32
+#  include <Windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+// 標準ライブラリ
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+
+// 一つのスレッドに解析させる最小のバイト数
+constexpr size_t minChunk(1 << 20);
+
+// デフォルトの材質 (gg.cpp と同じ)
+constexpr GgSimpleShader::Material defaultMaterial =
+{
+  { 0.1f, 0.1f, 0.1f, 1.0f },
+  { 0.6f, 0.6f, 0.6f, 0.0f },
+  { 0.3f, 0.3f, 0.3f, 0.0f },
+  60.0f
+};
+
+// デフォルトの材質名 (gg.cpp と同じ)
+constexpr char defaultMaterialName[] = "_default_";
+
+namespace
+{
+  // GLfloat 型の 3 要素のベクトル
+  using vec3 = std::array<GLfloat, 3>;
+
+  // 読み出し専用にメモリにマップしたファイル
+  class MappedFile
+  {
+    // マップしたメモリの先頭
+    const char *data;
+
+    // ファイルのサイズ
+    size_t size;
+
+    // マップできなかったときに読み込んだ内容
+    std::vector<char> copy;
+
+#ifdef _WIN32
+    // ファイルとファイルマッピングのハンドル
+    HANDLE file, mapping;
+#else
+    // ファイル記述子
+    int fd;
+#endif
+
+  public:
+
+    // コンストラクタ
+    MappedFile(const char *name)
+      : data(nullptr)
+      , size(0)
+#ifdef _WIN32
+      , file(INVALID_HANDLE_VALUE)
+      , mapping(nullptr)
+#else
+      , fd(-1)
+#endif
+    {
+#ifdef _WIN32
+      file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      LARGE_INTEGER length;
+      if (file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &length) && length.QuadPart > 0)
+      {
+        size = static_cast<size_t>(length.QuadPart);
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      }
+#else
+      fd = open(name, O_RDONLY);
+      struct stat st;
+      if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+      {
+        size = static_cast<size_t>(st.st_size);
+        void *const m(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (m != MAP_FAILED)
+        {
+          madvise(m, size, MADV_SEQUENTIAL);
+          data = static_cast<const char *>(m);
+        }
+      }
+#endif
+
+      // マップできなければ読み込む
+      if (!data)
+      {
+        std::ifstream stream(name, std::ios::binary);
+        if (stream)
+        {
+          copy.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+          size = copy.size();
+          data = copy.data();
+        }
+      }
+    }
+
+    // デストラクタ
+    ~MappedFile()
+    {
+#ifdef _WIN32
+      if (mapping)
+      {
+        if (data && copy.empty()) UnmapViewOfFile(data);
+        CloseHandle(mapping);
+      }
+      if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+      if (data && copy.empty()) munmap(const_cast<char *>(data), size);
+      if (fd >= 0) close(fd);
+#endif
+    }
+
+    // コピー禁止
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // 開けなければ false
+    explicit operator bool() const
+    {
+      return data != nullptr;
+    }
+
+    // 先頭と末尾
+    const char *begin() const { return data; }
+    const char *end() const { return data + size; }
+  };
+
+  // 三角形の頂点の頂点位置と法線の番号 (1 から始まり, 0 なら未定義)
+  struct Corner
+  {
+    GLuint p, n;
+  };
+
+  // 面の並びの途中で状態を変える行
+  struct Event
+  {
+    // 次の三角形の番号
+    size_t face;
+
+    // 種類
+    enum Kind { Smooth, Usemtl, Mtllib } kind;
+
+    // 引数
+    std::string arg;
+  };
+
+  // 一つのスレッドが解析した結果
+  struct Chunk
+  {
+    std::vector<vec3> pos, norm;
+    std::vector<Corner> face;
+    std::vector<Event> event;
+
+    // 負の相対番号で指定した三角形の頂点の face の位置と番号の種類 (1 なら頂点位置, 2 なら法線のビット)
+    std::vector<std::pair<size_t, int>> relative;
+
+    vec3 bmin{ FLT_MAX, FLT_MAX, FLT_MAX }, bmax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  };
+
+  // 空白か
+  inline bool isBlank(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  // 数字か
+  inline bool isDigit(char c)
+  {
+    return static_cast<unsigned char>(c - '0') < 10;
+  }
+
+  // 空白を読み飛ばす
+  inline const char *skipBlank(const char *p, const char *end)
+  {
+    while (p < end && isBlank(*p)) ++p;
+    return p;
+  }
+
+  // 行末まで読み飛ばす (次の行の先頭を返す)
+  inline const char *skipLine(const char *p, const char *end)
+  {
+    p = static_cast<const char *>(memchr(p, '\n', end - p));
+    return p ? p + 1 : end;
+  }
+
+  // 実数を読み取る (指数部を含む十進表記だけを扱い, 数字がなければ 0 にする)
+  inline const char *parseFloat(const char *p, const char *end, GLfloat &value)
+  {
+    // 10 の累乗 (double で正確に表せる範囲)
+    static constexpr double power[] =
+    {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    p = skipBlank(p, end);
+
+    // 符号
+    const bool negative(p < end && *p == '-');
+    if (p < end && (*p == '-' || *p == '+')) ++p;
+
+    // 仮数部は 19 桁までを整数で求め, 残りの桁は指数部にする
+    std::uint64_t mantissa(0);
+    int digits(0), exponent(0);
+    for (; p < end && isDigit(*p); ++p)
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa > 0) ++digits;
+      }
+      else ++exponent;
+    }
+    if (p < end && *p == '.')
+    {
+      for (++p; p < end && isDigit(*p); ++p)
+      {
+        if (digits < 19)
+        {
+          mantissa = mantissa * 10 + (*p - '0');
+          if (mantissa > 0) ++digits;
+          --exponent;
+        }
+      }
+    }
+
+    // 指数部
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+      const char *q(p + 1);
+      const bool minus(q < end && *q == '-');
+      if (q < end && (*q == '-' || *q == '+')) ++q;
+      if (q < end && isDigit(*q))
+      {
+        int e(0);
+        for (; q < end && isDigit(*q); ++q) if (e < 10000) e = e * 10 + (*q - '0');
+        exponent += minus ? -e : e;
+        p = q;
+      }
+    }
+
+    double v(static_cast<double>(mantissa));
+    if (v != 0.0)
+    {
+      if (exponent < 0)
+        v = -exponent <= 22 ? v / power[-exponent] : v * std::pow(10.0, exponent);
+      else if (exponent > 0)
+        v = exponent <= 22 ? v * power[exponent] : v * std::pow(10.0, exponent);
+    }
+    value = static_cast<GLfloat>(negative ? -v : v);
+
+    return p;
+  }
+
+  // 符号なし整数を読み取る (数字がなければ 0 にする)
+  inline const char *parseIndex(const char *p, const char *end, GLuint &value)
+  {
+    value = 0;
+    for (; p < end && isDigit(*p); ++p) value = value * 10 + (*p - '0');
+    return p;
+  }
+
+  // 頂点の番号を読み取る
+  //   負なら直前までの count 個の要素からの相対番号なので, チャンクの先頭からの番号にして relative に bit を立てる
+  inline const char *parseReference(const char *p, const char *end, size_t count, int bit, GLuint &value,
+    int &relative)
+  {
+    if (p >= end || *p != '-') return parseIndex(p, end, value);
+
+    p = parseIndex(p + 1, end, value);
+    if (value > 0)
+    {
+      // チャンクより前の要素を指すときは負になるが, ファイルの先頭からの番号にするときに足す数で戻る
+      value = static_cast<GLuint>(count + 1 - value);
+      relative |= bit;
+    }
+    return p;
+  }
+
+  // 命令が name なら引数の先頭を返す
+  inline const char *matchOp(const char *p, const char *end, const char *name)
+  {
+    const size_t length(strlen(name));
+    if (static_cast<size_t>(end - p) < length || memcmp(p, name, length) != 0) return nullptr;
+    p += length;
+    return p == end || isBlank(*p) || *p == '\n' ? p : nullptr;
+  }
+
+  // 行の残りの前後の空白を除いた文字列
+  std::string restOfLine(const char *p, const char *end)
+  {
+    p = skipBlank(p, end);
+    const char *q(static_cast<const char *>(memchr(p, '\n', end - p)));
+    if (!q) q = end;
+    while (q > p && isBlank(q[-1])) --q;
+    return std::string(p, q);
+  }
+
+  // 行の残りの最初の語
+  std::string firstWord(const char *p, const char *end)
+  {
+    p = skipBlank(p, end);
+    const char *q(p);
+    while (q < end && !isBlank(*q) && *q != '\n') ++q;
+    return std::string(p, q);
+  }
+
+  // ファイルの [p, end) の範囲を解析する
+  void parse(const char *p, const char *end, Chunk &chunk)
+  {
+    while (p < end)
+    {
+      p = skipBlank(p, end);
+      if (p >= end) break;
+
+      switch (*p)
+      {
+      case 'v':
+        if (const char *q = matchOp(p, end, "v"))
+        {
+          // 頂点位置
+          vec3 v;
+          q = parseFloat(q, end, v[0]);
+          q = parseFloat(q, end, v[1]);
+          q = parseFloat(q, end, v[2]);
+          chunk.pos.emplace_back(v);
+
+          // 頂点位置の最小値と最大値を求める (AABB)
+          for (int i = 0; i < 3; ++i)
+          {
+            chunk.bmin[i] = std::min(chunk.bmin[i], v[i]);
+            chunk.bmax[i] = std::max(chunk.bmax[i], v[i]);
+          }
+          p = q;
+        }
+        else if (const char *q = matchOp(p, end, "vn"))
+        {
+          // 頂点法線
+          vec3 n;
+          q = parseFloat(q, end, n[0]);
+          q = parseFloat(q, end, n[1]);
+          q = parseFloat(q, end, n[2]);
+          chunk.norm.emplace_back(n);
+          p = q;
+        }
+        break;
+
+      case 'f':
+        if (const char *q = matchOp(p, end, "f"))
+        {
+          // 多角形の頂点を扇形に三角形分割する
+          Corner first{ 0, 0 }, last{ 0, 0 };
+          int firstRelative(0), lastRelative(0);
+          const auto push([&chunk](const Corner &c, int relative)
+          {
+            if (relative) chunk.relative.emplace_back(chunk.face.size(), relative);
+            chunk.face.push_back(c);
+          });
+          for (int i = 0;; ++i)
+          {
+            q = skipBlank(q, end);
+            if (q >= end || (!isDigit(*q) && *q != '-')) break;
+
+            // 項目は 頂点座標番号/テクスチャ座標番号/法線番号 (テクスチャ座標は使わない)
+            Corner c{ 0, 0 };
+            GLuint t;
+            int relative(0);
+            q = parseReference(q, end, chunk.pos.size(), 1, c.p, relative);
+            if (q < end && *q == '/')
+            {
+              q = parseReference(q + 1, end, 0, 0, t, relative);
+              if (q < end && *q == '/') q = parseReference(q + 1, end, chunk.norm.size(), 2, c.n, relative);
+            }
+            while (q < end && !isBlank(*q) && *q != '\n') ++q;
+
+            if (i >= 2)
+            {
+              push(first, firstRelative);
+              push(last, lastRelative);
+              push(c, relative);
+            }
+            else if (i == 0)
+            {
+              first = c;
+              firstRelative = relative;
+            }
+            last = c;
+            lastRelative = relative;
+          }
+          p = q;
+        }
+        break;
+
+      case 's':
+        if (const char *q = matchOp(p, end, "s"))
+        {
+          // '1' だったらスムースシェーディング有効
+          chunk.event.push_back(Event{ chunk.face.size() / 3, Event::Smooth, firstWord(q, end) });
+        }
+        break;
+
+      case 'u':
+        if (const char *q = matchOp(p, end, "usemtl"))
+        {
+          chunk.event.push_back(Event{ chunk.face.size() / 3, Event::Usemtl, firstWord(q, end) });
+        }
+        break;
+
+      case 'm':
+        if (const char *q = matchOp(p, end, "mtllib"))
+        {
+          chunk.event.push_back(Event{ chunk.face.size() / 3, Event::Mtllib, restOfLine(q, end) });
+        }
+        break;
+
+      default:
+        break;
+      }
+
+      // 次の行に進む
+      p = skipLine(p, end);
+    }
+  }
+
+  // MTL ファイルを読み込む (gg.cpp の ggLoadMtl() と同じ)
+  void loadMtl(const std::string &path, std::map<std::string, GLuint> &mtl,
+    std::vector<GgSimpleShader::Material> &material)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return;
+
+    // 現在の材質にデフォルトの材質を設定する
+    mtl[defaultMaterialName] = static_cast<GLuint>(material.size());
+    material.emplace_back(defaultMaterial);
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+      const char *p(line.data()), *const end(line.data() + line.size());
+      p = skipBlank(p, end);
+
+      if (const char *q = matchOp(p, end, "newmtl"))
+      {
+        // 材質名が存在しなければデフォルトの材質で新規作成する
+        const std::string name(firstWord(q, end));
+        if (mtl.find(name) == mtl.end())
+        {
+          mtl[name] = static_cast<GLuint>(material.size());
+          material.emplace_back(defaultMaterial);
+        }
+      }
+      else if (material.empty())
+      {
+        continue;
+      }
+      else if (const char *q = matchOp(p, end, "Ka"))
+      {
+        for (int i = 0; i < 3; ++i) q = parseFloat(q, end, material.back().ambient[i]);
+      }
+      else if (const char *q = matchOp(p, end, "Kd"))
+      {
+        for (int i = 0; i < 3; ++i) q = parseFloat(q, end, material.back().diffuse[i]);
+      }
+      else if (const char *q = matchOp(p, end, "Ks"))
+      {
+        for (int i = 0; i < 3; ++i) q = parseFloat(q, end, material.back().specular[i]);
+      }
+      else if (const char *q = matchOp(p, end, "Ns"))
+      {
+        GLfloat shininess;
+        parseFloat(q, end, shininess);
+        material.back().shininess = shininess * 0.1f;
+      }
+      else if (const char *q = matchOp(p, end, "d"))
+      {
+        parseFloat(q, end, material.back().ambient[3]);
+      }
+    }
+  }
+
+  // 頂点位置と法線の番号の組から頂点番号を引くハッシュ表 (オープンアドレス法)
+  class VertexTable
+  {
+    // 空きを表すキー
+    static constexpr std::uint64_t empty = ~std::uint64_t(0);
+
+    // キーと値
+    std::vector<std::uint64_t> key;
+    std::vector<GLuint> value;
+
+    // 格納している数
+    size_t count;
+
+    // ハッシュ値
+    static size_t hash(std::uint64_t k)
+    {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      return static_cast<size_t>(k);
+    }
+
+    // 表を大きくする
+    void grow()
+    {
+      std::vector<std::uint64_t> oldKey(key.size() * 2, empty);
+      std::vector<GLuint> oldValue(value.size() * 2);
+      oldKey.swap(key);
+      oldValue.swap(value);
+      const size_t mask(key.size() - 1);
+      for (size_t i = 0; i < oldKey.size(); ++i)
+      {
+        if (oldKey[i] == empty) continue;
+        size_t h(hash(oldKey[i]) & mask);
+        while (key[h] != empty) h = (h + 1) & mask;
+        key[h] = oldKey[i];
+        value[h] = oldValue[i];
+      }
+    }
+
+  public:
+
+    // コンストラクタ (expected 個程度を格納する)
+    VertexTable(size_t expected)
+      : count(0)
+    {
+      size_t size(16);
+      while (size < expected * 2) size <<= 1;
+      key.assign(size, empty);
+      value.resize(size);
+    }
+
+    // 組 (p, n) の頂点番号を探し, なければ next を登録する (登録したら true)
+    bool insert(GLuint p, GLuint n, GLuint next, GLuint &index)
+    {
+      const std::uint64_t k(std::uint64_t(p) << 32 | n);
+      const size_t mask(key.size() - 1);
+      for (size_t h = hash(k) & mask;; h = (h + 1) & mask)
+      {
+        if (key[h] == k)
+        {
+          index = value[h];
+          return false;
+        }
+        if (key[h] == empty)
+        {
+          key[h] = k;
+          value[h] = index = next;
+          if (++count * 2 > key.size()) grow();
+          return true;
+        }
+      }
+    }
+  };
+}
+
+// 三角形分割された OBJ ファイルと MTL ファイルを読み込む
+bool ObjLoader::load(const char *name,
+  std::vector<std::array<GLuint, 3>> &group,
+  std::vector<GgSimpleShader::Material> &material,
+  std::vector<GgVertex> &vert,
+  std::vector<GLuint> &face,
+  bool normalize, unsigned int threads)
+{
+  // ファイルをメモリにマップする
+  const MappedFile file(name);
+  if (!file) return false;
+
+  // ファイルのあるディレクトリ
+  const std::string path(name);
+  const size_t base(path.find_last_of("/\\"));
+  const std::string dirname(base == std::string::npos ? "" : path.substr(0, base + 1));
+
+  // スレッドの数
+  const size_t size(file.end() - file.begin());
+  if (threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+  const size_t count(std::max(std::min(static_cast<size_t>(threads), size / minChunk), size_t(1)));
+
+  // 行の境界で分けた範囲を並列に解析する
+  std::vector<Chunk> chunk(count);
+  std::vector<std::thread> worker;
+  const char *first(file.begin());
+  for (size_t i = 0; i < count; ++i)
+  {
+    const char *last(i + 1 < count ? skipLine(file.begin() + size * (i + 1) / count, file.end()) : file.end());
+    if (last < first) last = first;
+    if (i + 1 < count)
+      worker.emplace_back(parse, first, last, std::ref(chunk[i]));
+    else
+      parse(first, last, chunk[i]);
+    first = last;
+  }
+  for (auto &w : worker) w.join();
+
+  // 頂点位置と法線をつなぐ
+  std::vector<vec3> pos, norm;
+  size_t faces(0);
+  vec3 bmin{ FLT_MAX, FLT_MAX, FLT_MAX }, bmax{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+  for (auto &c : chunk)
+  {
+    // 相対番号をファイルの先頭からの番号にする
+    for (const auto &r : c.relative)
+    {
+      if (r.second & 1) c.face[r.first].p += static_cast<GLuint>(pos.size());
+      if (r.second & 2) c.face[r.first].n += static_cast<GLuint>(norm.size());
+    }
+
+    pos.insert(pos.end(), c.pos.begin(), c.pos.end());
+    norm.insert(norm.end(), c.norm.begin(), c.norm.end());
+    faces += c.face.size() / 3;
+    for (int i = 0; i < 3; ++i)
+    {
+      bmin[i] = std::min(bmin[i], c.bmin[i]);
+      bmax[i] = std::max(bmax[i], c.bmax[i]);
+    }
+    std::vector<vec3>().swap(c.pos);
+    std::vector<vec3>().swap(c.norm);
+  }
+
+  // 図形の大きさと位置を正規化する
+  if (normalize && !pos.empty())
+  {
+    const GLfloat s(std::max(std::max(bmax[0] - bmin[0], bmax[1] - bmin[1]), bmax[2] - bmin[2]));
+    const GLfloat scale(s != 0.0f ? 2.0f / s : 1.0f);
+    const vec3 center{ (bmax[0] + bmin[0]) * 0.5f, (bmax[1] + bmin[1]) * 0.5f, (bmax[2] + bmin[2]) * 0.5f };
+    for (auto &p : pos) for (int i = 0; i < 3; ++i) p[i] = (p[i] - center[i]) * scale;
+  }
+
+  // 法線データがなければスムーズシェーディングする三角形の面法線を頂点ごとに積算する
+  const bool computeNormal(norm.empty());
+  std::vector<vec3> accumulated;
+
+  // 三角形の頂点位置が正しければ面法線を求める
+  const GLuint positions(static_cast<GLuint>(pos.size())), normals(static_cast<GLuint>(norm.size()));
+  const auto faceNormal([&](const Corner *f, vec3 &n)
+  {
+    for (int i = 0; i < 3; ++i) if (f[i].p == 0 || f[i].p > positions) return false;
+    const vec3 &p0(pos[f[0].p - 1]), &p1(pos[f[1].p - 1]), &p2(pos[f[2].p - 1]);
+    const GLfloat d1[] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    const GLfloat d2[] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    ggCross(n.data(), d1, d2);
+    return true;
+  });
+
+  // 面の並びの途中の状態の変化を順にたどる
+  const auto walk([&](const auto &triangle, const auto &state)
+  {
+    bool smooth(false);
+    for (const auto &c : chunk)
+    {
+      size_t t(0);
+      for (const auto &e : c.event)
+      {
+        for (; t < e.face; ++t) triangle(&c.face[t * 3], smooth);
+        if (e.kind == Event::Smooth) smooth = e.arg == "1";
+        state(e);
+      }
+      for (const size_t n(c.face.size() / 3); t < n; ++t) triangle(&c.face[t * 3], smooth);
+    }
+  });
+
+  if (computeNormal)
+  {
+    accumulated.assign(pos.size(), vec3{ 0.0f, 0.0f, 0.0f });
+    walk([&](const Corner *f, bool smooth)
+    {
+      vec3 n;
+      if (smooth && faceNormal(f, n))
+      {
+        for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) accumulated[f[i].p - 1][j] += n[j];
+      }
+    }, [](const Event &) {});
+    for (auto &n : accumulated) ggNormalize3(n.data());
+  }
+
+  // 材質名をキーにした材質番号
+  std::map<std::string, GLuint> mtl;
+  std::string mtlname;
+
+  // 頂点属性と三角形のデータのメモリを確保する
+  vert.reserve(vert.size() + std::max(pos.size(), norm.size()));
+  face.reserve(face.size() + faces * 3);
+
+  // 頂点位置と法線の番号の組の頂点番号
+  VertexTable table(std::max(pos.size(), norm.size()));
+
+  // 現在のポリゴングループの最初の頂点番号の位置
+  GLuint startgroup(static_cast<GLuint>(face.size()));
+
+  // ポリゴングループの三角形数と材質番号を記録する
+  const auto closeGroup([&]()
+  {
+    const GLuint next(static_cast<GLuint>(face.size()));
+    if (next > startgroup) group.push_back({ startgroup, next - startgroup, mtl[mtlname] });
+    startgroup = next;
+  });
+
+  const vec3 zero{ 0.0f, 0.0f, 0.0f };
+  walk([&](const Corner *f, bool smooth)
+  {
+    // 頂点位置の番号が正しくない三角形は捨てる
+    vec3 fn;
+    if (!faceNormal(f, fn)) return;
+
+    for (int i = 0; i < 3; ++i)
+    {
+      const GLuint n(f[i].n <= normals ? f[i].n : 0);
+      const vec3 &p(pos[f[i].p - 1]);
+
+      if (smooth)
+      {
+        // スムーズシェーディングする三角形は頂点位置と法線の番号の組が同じ頂点を共有する
+        GLuint index;
+        if (table.insert(f[i].p, n, static_cast<GLuint>(vert.size()), index))
+        {
+          const vec3 &v(computeNormal ? accumulated[f[i].p - 1] : n > 0 ? norm[n - 1] : zero);
+          vert.emplace_back(p.data(), v.data());
+        }
+        face.push_back(index);
+      }
+      else
+      {
+        // スムーズシェーディングしない三角形は頂点を共有しない
+        if (computeNormal) ggNormalize3(fn.data());
+        const vec3 &v(computeNormal ? fn : n > 0 ? norm[n - 1] : zero);
+        face.push_back(static_cast<GLuint>(vert.size()));
+        vert.emplace_back(p.data(), v.data());
+      }
+    }
+  }, [&](const Event &e)
+  {
+    if (e.kind == Event::Usemtl)
+    {
+      // ポリゴングループを閉じて次に usemtl が来るまで材質名を保持する
+      closeGroup();
+      mtlname = mtl.find(e.arg) == mtl.end() ? defaultMaterialName : e.arg;
+    }
+    else if (e.kind == Event::Mtllib)
+    {
+      loadMtl(dirname + e.arg, mtl, material);
+    }
+  });
+
+  // 最後のポリゴングループを閉じる
+  closeGroup();
+
+#if defined(DEBUG)
+  std::cerr
+    << "[" << name << "]\n(Loaded) Thread: " << count << ", Group: " << group.size()
+    << ", Material: " << material.size() << ", Vertex: " << vert.size() << ", Face: " << face.size() << "\n";
+#endif
+
+  return true;
+}
+
+// OBJ ファイルを読み込んで GgElements を作る
+GgElements *ObjLoader::elements(const char *name, bool normalize, unsigned int threads)
+{
+  std::vector<std::array<GLuint, 3>> group;
+  std::vector<GgSimpleShader::Material> material;
+  std::vector<GgVertex> vert;
+  std::vector<GLuint> face;
+
+  // ファイルを読み込む
+  if (!load(name, group, material, vert, face, normalize, threads)) return nullptr;
+
+  // GgElements オブジェクトを作成する
+  return new GgElements(vert.data(), static_cast<GLsizei>(vert.size()),
+    face.data(), static_cast<GLsizei>(face.size()), GL_TRIANGLES);
+}
+
+// ggLoadSimpleObj() とこのクラスの読み込み時間を計測する
+bool ObjLoader::benchmark(const char *name, int repeat, std::ostream &out)
+{
+  if (repeat < 1) repeat = 1;
+
+  // 読み込み関数を repeat 回実行して最短と平均の時間 (ms) を求める
+  const auto measure([repeat](const char *label, std::ostream &out, const auto &function)
+  {
+    double best(0.0), sum(0.0);
+    size_t vertices(0), indices(0);
+    for (int i = 0; i < repeat; ++i)
+    {
+      std::vector<std::array<GLuint, 3>> group;
+      std::vector<GgSimpleShader::Material> material;
+      std::vector<GgVertex> vert;
+      std::vector<GLuint> face;
+
+      const auto start(std::chrono::steady_clock::now());
+      if (!function(group, material, vert, face)) return false;
+      const double t(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+      if (i == 0 || t < best) best = t;
+      sum += t;
+      vertices = vert.size();
+      indices = face.size();
+    }
+    out << label << ": best = " << best << " ms, mean = " << sum / repeat << " ms, vertices = " << vertices
+      << ", triangles = " << indices / 3 << "\n";
+    return true;
+  });
+
+  out << "[" << name << "] repeat = " << repeat << ", threads = " << std::thread::hardware_concurrency() << "\n";
+
+  const bool current(measure("ggLoadSimpleObj", out, [name](auto &group, auto &material, auto &vert, auto &face)
+  {
+    return ggLoadSimpleObj(name, group, material, vert, face);
+  }));
+  const bool fast(measure("ObjLoader", out, [name](auto &group, auto &material, auto &vert, auto &face)
+  {
+    return load(name, group, material, vert, face);
+  }));
+
+  return current && fast;
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+
+//
+// 三角形分割された Wavefront OBJ ファイルの高速な読み込み
+//
+//   ファイルをメモリにマップして行の境界で分けた範囲を複数のスレッドで並列に解析し,
+//   頂点位置と法線の番号の組をハッシュで重複除去して GgElements の頂点と三角形のデータを直接作る
+//   結果は ggLoadSimpleObj() (Elements 形式) と同じ形式で, ggElementsObj() の代わりに使える
+//
+
+// 補助プログラム
+#include "gg.h"
+using namespace gg;
+
+// 標準ライブラリ
+#include <array>
+#include <ostream>
+#include <vector>
+
+class ObjLoader
+{
+public:
+
+  // 三角形分割された OBJ ファイルと MTL ファイルを読み込む (ggLoadSimpleObj() の Elements 形式と同じ)
+  //   group 読み込んだデータのポリゴングループごとの最初の頂点番号の位置と数・材質番号
+  //   material 読み込んだデータのポリゴングループごとの材質
+  //   vert 読み込んだデータの頂点属性
+  //   face 読み込んだデータの三角形の頂点インデックス
+  //   normalize true なら読み込んだデータの大きさを正規化する
+  //   threads 解析に使うスレッドの数 (0 ならハードウェアのスレッド数)
+  //   戻り値 ファイルの読み込みに成功したら true
+  static bool load(const char *name,
+    std::vector<std::array<GLuint, 3>> &group,
+    std::vector<GgSimpleShader::Material> &material,
+    std::vector<GgVertex> &vert,
+    std::vector<GLuint> &face,
+    bool normalize = false, unsigned int threads = 0);
+
+  // OBJ ファイルを読み込んで GgElements を作る (読み込みに失敗したら nullptr)
+  static GgElements *elements(const char *name, bool normalize = false, unsigned int threads = 0);
+
+  // ggLoadSimpleObj() とこのクラスの読み込み時間を repeat 回ずつ計測して out に出力する
+  //   戻り値 どちらの読み込みにも成功したら true
+  static bool benchmark(const char *name, int repeat, std::ostream &out);
+};
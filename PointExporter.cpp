@@ -0,0 +1,272 @@
+﻿#include "PointExporter.h"
+
+//
+// 点群のファイルへの書き出し
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+// 独自形式のファイルの識別子
+static constexpr char rawMagic[4] = { 'G', 'D', 'P', 'C' };
+
+// 読み出し先のコンストラクタ
+PointExporter::Channel::Channel(GLsizei capacity, size_t slots)
+  : capacity(capacity)
+  , slot(slots)
+  , next(0)
+  , frame(0)
+{
+  // 頂点数と頂点を格納するバッファオブジェクトのサイズ
+  const GLsizeiptr size(sizeof (GLuint) + capacity * sizeof (Vertex));
+
+  // すべてのスロットについて
+  for (auto &s : slot)
+  {
+    // 永続的にマップできるバッファオブジェクトを作成する
+    glGenBuffers(1, &s.buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s.buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr,
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+
+    // 書き出しスレッドから読めるようにマップしたままにする
+    s.data = static_cast<const GLubyte *>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size,
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT));
+    s.fence = nullptr;
+    s.frame = 0;
+    s.busy = false;
+  }
+}
+
+// 読み出し先のデストラクタ
+PointExporter::Channel::~Channel()
+{
+  for (auto &s : slot)
+  {
+    if (s.fence) glDeleteSync(s.fence);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s.buffer);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glDeleteBuffers(1, &s.buffer);
+  }
+}
+
+// コンストラクタ
+PointExporter::PointExporter(const std::string &prefix, Format format, GLfloat maxDistance, size_t slots)
+  : prefix(prefix)
+  , format(format)
+  , maxDistance(maxDistance)
+  , slots(std::max(slots, size_t(2)))
+  , shader("export.comp")
+  , pointLoc(glGetUniformLocation(shader.get(), "point"))
+  , colorLoc(glGetUniformLocation(shader.get(), "color"))
+  , attitudeLoc(glGetUniformLocation(shader.get(), "attitude"))
+  , maxDistanceLoc(glGetUniformLocation(shader.get(), "maxDistance"))
+  , foregroundLoc(glGetUniformLocation(shader.get(), "foreground"))
+  , foregroundOnlyLoc(glGetUniformLocation(shader.get(), "foregroundOnly"))
+  , quit(false)
+  , captured(0)
+  , written(0)
+  , dropped(0)
+{
+  // シェーダストレージブロックに結合ポイントを割り当てる
+  const GLuint uvmapIndex(glGetProgramResourceIndex(shader.get(), GL_SHADER_STORAGE_BLOCK, "Uvmap"));
+  glShaderStorageBlockBinding(shader.get(), uvmapIndex, DepthCamera::UvmapBinding);
+  const GLuint normalIndex(glGetProgramResourceIndex(shader.get(), GL_SHADER_STORAGE_BLOCK, "Normal"));
+  glShaderStorageBlockBinding(shader.get(), normalIndex, DepthCamera::NormalBinding);
+  const GLuint exportIndex(glGetProgramResourceIndex(shader.get(), GL_SHADER_STORAGE_BLOCK, "Export"));
+  glShaderStorageBlockBinding(shader.get(), exportIndex, DepthCamera::ExportBinding);
+
+  // 書き出しスレッドを起動する
+  writer = std::thread([this]() { write(); });
+}
+
+// デストラクタ
+PointExporter::~PointExporter()
+{
+  // 読み出し中のスロットを書き出しスレッドに渡す
+  for (auto &job : pending)
+  {
+    glClientWaitSync(job.slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+  }
+  update();
+
+  // 書き出しスレッドを止める
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    quit = true;
+  }
+  queueCondition.notify_one();
+  writer.join();
+}
+
+// センサ id の点群の読み出しを開始する
+bool PointExporter::capture(const DepthCamera &sensor, int id)
+{
+  // デプスセンサのサイズ
+  int width, height;
+  sensor.getDepthResolution(&width, &height);
+
+  // センサの読み出し先がなければ作る (書き出し中のスロットがあれば作り直さない)
+  if (id >= static_cast<int>(channel.size())) channel.resize(id + 1);
+  if (!channel[id] || (channel[id]->capacity < width * height && std::none_of(channel[id]->slot.begin(),
+    channel[id]->slot.end(), [](const Slot &s) { return s.fence || s.busy; })))
+  {
+    channel[id].reset(new Channel(width * height, slots));
+  }
+
+  // 次に使うスロット
+  Channel &c(*channel[id]);
+  Slot &slot(c.slot[c.next]);
+
+  // スロットがまだ読み出し中か書き出し中なら描画を止めないようにこのフレームは捨てる
+  if (slot.fence || slot.busy)
+  {
+    ++dropped;
+    return false;
+  }
+
+  // 頂点数を 0 にする
+  const GLuint zero(0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.buffer);
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof zero, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // 頂点を求める
+  shader.use();
+  glUniform1i(pointLoc, DepthCamera::PointImageUnit);
+  glUniform1i(colorLoc, 0);
+  glUniformMatrix4fv(attitudeLoc, 1, GL_FALSE, sensor.attitude.get());
+  glUniform1f(maxDistanceLoc, maxDistance);
+  glBindImageTexture(DepthCamera::PointImageUnit, sensor.getPointTexture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+
+  // 前景を抽出していれば前景だけを書き出す
+  const GLuint foreground(sensor.getForegroundTexture());
+  glUniform1i(foregroundOnlyLoc, foreground != 0);
+  if (foreground != 0)
+  {
+    glUniform1i(foregroundLoc, DepthCamera::ForegroundImageUnit);
+    glBindImageTexture(DepthCamera::ForegroundImageUnit, foreground, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, sensor.getColorTexture());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::UvmapBinding, sensor.getUvmapBuffer());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::NormalBinding, sensor.getNormalBuffer());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::ExportBinding, slot.buffer);
+  shader.dispatch(width, height);
+
+  // マップしたメモリから読めるようにして完了を待つフェンスを置く
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.frame = c.frame++;
+
+  // 読み出し中のスロットに加える
+  pending.push_back(Job{ id, c.capacity, &slot });
+  c.next = (c.next + 1) % c.slot.size();
+  ++captured;
+
+  return true;
+}
+
+// 読み出しの完了したスロットを書き出しスレッドに渡す
+void PointExporter::update()
+{
+  // 読み出し中のスロットを古い順に
+  while (!pending.empty())
+  {
+    // GPU 側の処理が終わっていなければ待たずに戻る
+    Slot &slot(*pending.front().slot);
+    const GLenum status(glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0));
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+    // フェンスを削除する
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+
+    // 書き出しスレッドに渡す
+    slot.busy = true;
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      queue.push_back(pending.front());
+    }
+    queueCondition.notify_one();
+    pending.pop_front();
+  }
+}
+
+// 書き出しスレッドの処理
+void PointExporter::write()
+{
+  for (;;)
+  {
+    // 仕事を取り出す
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueCondition.wait(lock, [this]() { return quit || !queue.empty(); });
+      if (queue.empty()) return;
+      job = queue.front();
+      queue.pop_front();
+    }
+
+    // ファイルに書き出す
+    if (save(job)) ++written;
+
+    // スロットを空ける
+    job.slot->busy = false;
+  }
+}
+
+// スロットの内容をファイルに書き出す
+bool PointExporter::save(const Job &job) const
+{
+  const Slot &slot(*job.slot);
+
+  // 頂点数 (格納先からあふれた分は捨てられている)
+  GLuint count;
+  memcpy(&count, slot.data, sizeof count);
+  if (count > static_cast<GLuint>(job.capacity)) count = job.capacity;
+
+  // ファイル名
+  std::ostringstream name;
+  name << prefix << '_' << job.id << '_' << std::setw(6) << std::setfill('0') << slot.frame
+    << (format == PlyFormat ? ".ply" : ".pts");
+
+  // ファイルを開く
+  std::ofstream file(name.str(), std::ios::binary);
+  if (!file) return false;
+
+  if (format == PlyFormat)
+  {
+    // PLY のヘッダ
+    file << "ply\n"
+      "format binary_little_endian 1.0\n"
+      "element vertex " << count << "\n"
+      "property float x\n"
+      "property float y\n"
+      "property float z\n"
+      "property float nx\n"
+      "property float ny\n"
+      "property float nz\n"
+      "property uchar red\n"
+      "property uchar green\n"
+      "property uchar blue\n"
+      "property uchar alpha\n"
+      "end_header\n";
+  }
+  else
+  {
+    // 識別子と頂点数
+    file.write(rawMagic, sizeof rawMagic);
+    file.write(reinterpret_cast<const char *>(&count), sizeof count);
+  }
+
+  // 頂点の配列はそのまま書き出す
+  file.write(reinterpret_cast<const char *>(slot.data + sizeof count), count * sizeof (Vertex));
+
+  return !file.bad();
+}
@@ -0,0 +1,180 @@
+﻿#pragma once
+
+//
+// 点群のファイルへの書き出し
+//
+
+// デプスセンサ関連の基底クラス
+#include "DepthCamera.h"
+
+// 標準ライブラリ
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class PointExporter
+{
+public:
+
+  // 書き出すファイルの形式
+  enum Format
+  {
+    PlyFormat = 0,                                      // バイナリ PLY
+    RawFormat                                           // ヘッダと頂点の配列だけの独自形式
+  };
+
+  // 書き出す頂点のデータ (export.comp と PLY のヘッダに合わせる)
+  struct Vertex
+  {
+    GLfloat position[3];                                // ワールド座標
+    GLfloat normal[3];                                  // ワールド座標の法線ベクトル
+    GLubyte color[4];                                   // RGBA
+  };
+
+private:
+
+  // 読み出しに使うバッファオブジェクトのスロット
+  struct Slot
+  {
+    // 頂点数と頂点を格納するバッファオブジェクト
+    GLuint buffer;
+
+    // 永続的にマップしたバッファオブジェクトの先頭
+    const GLubyte *data;
+
+    // 書き込み完了を待つフェンス
+    GLsync fence;
+
+    // 書き出すフレームの番号
+    unsigned long long frame;
+
+    // 書き出しスレッドが使用中なら true
+    std::atomic<bool> busy;
+  };
+
+  // センサごとの読み出し先
+  struct Channel
+  {
+    // 格納できる頂点数
+    GLsizei capacity;
+
+    // 読み出しに使うスロット
+    std::vector<Slot> slot;
+
+    // 次に使うスロット
+    size_t next;
+
+    // 書き出したフレームの数
+    unsigned long long frame;
+
+    // コンストラクタ
+    Channel(GLsizei capacity, size_t slots);
+
+    // デストラクタ
+    ~Channel();
+  };
+
+  // 書き出しスレッドに渡す仕事
+  struct Job
+  {
+    int id;
+    GLsizei capacity;
+    Slot *slot;
+  };
+
+  // 書き出すファイル名の先頭
+  const std::string prefix;
+
+  // 書き出すファイルの形式
+  const Format format;
+
+  // 書き出す点のセンサからの最大距離
+  const GLfloat maxDistance;
+
+  // センサごとのスロットの数
+  const size_t slots;
+
+  // センサごとの読み出し先
+  std::vector<std::unique_ptr<Channel>> channel;
+
+  // 頂点を求めるシェーダ
+  const Compute shader;
+
+  // シェーダの uniform 変数の場所
+  const GLint pointLoc, colorLoc, attitudeLoc, maxDistanceLoc, foregroundLoc, foregroundOnlyLoc;
+
+  // GPU 側の処理が完了して書き出しを待っているスロット
+  std::deque<Job> pending;
+
+  // 書き出しスレッドに渡した仕事
+  std::deque<Job> queue;
+
+  // 書き出しスレッドとの排他制御
+  std::mutex queueMutex;
+
+  // 書き出しスレッドへの通知
+  std::condition_variable queueCondition;
+
+  // 書き出しスレッドを止めるなら true
+  bool quit;
+
+  // 書き出しスレッド
+  std::thread writer;
+
+  // 読み出したフレーム数, 書き出したフレーム数, 空きスロットがなくて捨てたフレーム数
+  std::atomic<unsigned long long> captured, written, dropped;
+
+  // 書き出しスレッドの処理
+  void write();
+
+  // スロットの内容をファイルに書き出す
+  bool save(const Job &job) const;
+
+public:
+
+  // コンストラクタ
+  //   prefix 書き出すファイル名の先頭 (後ろにセンサの番号とフレームの番号を付ける)
+  //   format 書き出すファイルの形式
+  //   maxDistance 書き出す点のセンサからの最大距離 (m)
+  //   slots センサごとのスロットの数
+  PointExporter(const std::string &prefix, Format format = PlyFormat, GLfloat maxDistance = 5.0f,
+    size_t slots = 3);
+
+  // コピーコンストラクタ (コピー禁止)
+  PointExporter(const PointExporter &e) = delete;
+
+  // 代入 (代入禁止)
+  PointExporter &operator=(const PointExporter &e) = delete;
+
+  // デストラクタ
+  virtual ~PointExporter();
+
+  // センサ id の点群の読み出しを開始する (空きスロットがなければ捨てて false を返す)
+  bool capture(const DepthCamera &sensor, int id);
+
+  // 読み出しの完了したスロットを書き出しスレッドに渡す
+  void update();
+
+  // 読み出したフレーム数を得る
+  unsigned long long getCaptured() const
+  {
+    return captured;
+  }
+
+  // 書き出したフレーム数を得る
+  unsigned long long getWritten() const
+  {
+    return written;
+  }
+
+  // 空きスロットがなくて捨てたフレーム数を得る
+  unsigned long long getDropped() const
+  {
+    return dropped;
+  }
+};
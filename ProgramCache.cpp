@@ -0,0 +1,262 @@
+﻿#include "ProgramCache.h"
+
+//
+// シェーダプログラムのバイナリのキャッシュ
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+// キャッシュファイルの先頭
+struct Header
+{
+  // キャッシュファイルの識別子
+  char magic[4];
+
+  // キャッシュのキー
+  std::uint64_t key;
+
+  // バイナリの形式
+  GLenum format;
+
+  // バイナリの長さ
+  GLint length;
+};
+
+// キャッシュファイルの識別子
+constexpr char magic[4] = { 'G', 'D', 'P', 'B' };
+
+// キャッシュを保存するディレクトリ (空ならキャッシュしない)
+static std::string cacheDirectory;
+
+// ドライバがプログラムのバイナリを取り出せるなら true
+static bool binarySupported(false);
+
+// ドライバを識別する文字列
+static std::string driver;
+
+// すべてのシェーダに埋め込むマクロ定義
+static ProgramCache::Defines commonDefines;
+
+// 文字列を FNV-1a のハッシュ値に加える
+static std::uint64_t hash(std::uint64_t h, const std::string &s)
+{
+  for (const unsigned char c : s)
+  {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+
+  // 次の文字列と区切る
+  h ^= 0xffu;
+  h *= 1099511628211ull;
+  return h;
+}
+
+// シェーダのソースファイルを読み込む
+static bool readSource(const char *name, std::string &src)
+{
+  std::ifstream file(name, std::ios::binary);
+  if (!file)
+  {
+#if defined(_DEBUG)
+    std::cerr << "Error: Can't open source file: " << name << std::endl;
+#endif
+    return false;
+  }
+  src.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return !file.bad();
+}
+
+// ソースプログラムの #version の次の行にマクロ定義を埋め込む
+static void inject(std::string &src, const ProgramCache::Defines &defines)
+{
+  // シェーダごとのマクロ定義をすべてのシェーダのものより優先する
+  ProgramCache::Defines merged(defines);
+  merged.insert(commonDefines.begin(), commonDefines.end());
+  if (merged.empty()) return;
+
+  // #version の行の次に挿入する
+  const auto version(src.find("#version"));
+  const auto newline(version == std::string::npos ? std::string::npos : src.find('\n', version));
+  const auto at(version == std::string::npos ? 0 : newline == std::string::npos ? src.size() : newline + 1);
+
+  // エラーメッセージの行番号がソースファイルと合うようにする
+  const auto line(std::count(src.begin(), src.begin() + at, '\n') + 1);
+
+  std::string text(at > 0 && src[at - 1] != '\n' ? "\n" : "");
+  for (const auto &define : merged) text += "#define " + define.first + " " + define.second + "\n";
+  text += "#line " + std::to_string(line) + "\n";
+  src.insert(at, text);
+}
+
+// ソースプログラムとドライバからキャッシュファイルのパスを求める (キャッシュしなければ空)
+static std::string getPath(const std::vector<std::string> &sources, std::uint64_t &key)
+{
+  if (cacheDirectory.empty() || !binarySupported) return std::string();
+
+  // FNV-1a のオフセット基底にドライバとソースプログラムを加える
+  key = hash(14695981039346656037ull, driver);
+  for (const auto &src : sources) key = hash(key, src);
+
+  char name[24];
+  std::snprintf(name, sizeof name, "%016llx.bin", static_cast<unsigned long long>(key));
+  return (std::filesystem::path(cacheDirectory) / name).string();
+}
+
+// キャッシュファイルからプログラムオブジェクトを作成する (できなければ 0)
+static GLuint loadBinary(const std::string &path, std::uint64_t key)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file) return 0;
+
+  // キャッシュファイルの先頭を読み込んで確かめる
+  Header header;
+  file.read(reinterpret_cast<char *>(&header), sizeof header);
+  if (!file || !std::equal(magic, magic + 4, header.magic) || header.key != key || header.length <= 0) return 0;
+
+  // バイナリを読み込む
+  std::vector<char> binary(header.length);
+  file.read(binary.data(), binary.size());
+  if (!file) return 0;
+
+  // バイナリからプログラムオブジェクトを作成する
+  const GLuint program(glCreateProgram());
+  glProgramBinary(program, header.format, binary.data(), header.length);
+
+  // ドライバが受け付けなければソースプログラムから作り直す
+  GLint status;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status == GL_FALSE)
+  {
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  return program;
+}
+
+// プログラムオブジェクトのバイナリをキャッシュファイルに保存する
+static void saveBinary(GLuint program, const std::string &path, std::uint64_t key)
+{
+  // バイナリを取り出せるようにしてリンクし直す
+  glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(program);
+
+  // バイナリを取り出す
+  Header header{ { magic[0], magic[1], magic[2], magic[3] }, key, 0, 0 };
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+  if (header.length <= 0) return;
+  std::vector<char> binary(header.length);
+  glGetProgramBinary(program, header.length, &header.length, &header.format, binary.data());
+  if (header.length <= 0) return;
+
+  // 書き込み途中のファイルを他のプロセスが読まないように別名で書いてから置き換える
+  std::error_code error;
+  std::filesystem::create_directories(cacheDirectory, error);
+  const std::string temporary(path + ".tmp");
+  std::ofstream file(temporary, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(&header), sizeof header);
+  file.write(binary.data(), header.length);
+  file.close();
+  if (file) std::filesystem::rename(temporary, path, error);
+  if (!file || error)
+  {
+    std::filesystem::remove(temporary, error);
+#if defined(_DEBUG)
+    std::cerr << "Warning: Can't write program cache: " << path << std::endl;
+#endif
+  }
+}
+
+// キャッシュを保存するディレクトリを設定する
+void ProgramCache::setDirectory(const std::string &directory)
+{
+  // バイナリの形式がひとつもなければバイナリはキャッシュしない
+  GLint formats(0);
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  binarySupported = formats > 0;
+  cacheDirectory = directory;
+
+  // ドライバが変わればバイナリは使えないのでドライバの情報もキーに含める
+  driver.clear();
+  for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+  {
+    const GLubyte *const s(glGetString(name));
+    if (s) driver += reinterpret_cast<const char *>(s);
+    driver += '\n';
+  }
+}
+
+// キャッシュを保存するディレクトリを得る
+const std::string &ProgramCache::getDirectory()
+{
+  return cacheDirectory;
+}
+
+// ドライバを識別する文字列を得る
+std::string ProgramCache::getDriverId()
+{
+  char id[17];
+  std::snprintf(id, sizeof id, "%016llx", static_cast<unsigned long long>(hash(14695981039346656037ull, driver)));
+  return id;
+}
+
+// すべてのシェーダに埋め込むマクロ定義を設定する
+void ProgramCache::setDefines(const Defines &defines)
+{
+  commonDefines = defines;
+}
+
+// バーテックスシェーダとフラグメントシェーダのソースファイルからプログラムオブジェクトを作成する
+GLuint ProgramCache::load(const char *vert, const char *frag, const Defines &defines)
+{
+  // ソースファイルを読み込んでマクロ定義を埋め込む
+  std::vector<std::string> sources(2);
+  if (!readSource(vert, sources[0]) || !readSource(frag, sources[1])) return 0;
+  for (auto &src : sources) inject(src, defines);
+
+  // キャッシュがあればそれを使う
+  std::uint64_t key(0);
+  const std::string path(getPath(sources, key));
+  if (!path.empty())
+  {
+    const GLuint program(loadBinary(path, key));
+    if (program != 0) return program;
+  }
+
+  // なければソースプログラムから作成してキャッシュに保存する
+  const GLuint program(ggCreateShader(sources[0].c_str(), sources[1].c_str(), nullptr, 0, nullptr, vert, frag));
+  if (program != 0 && !path.empty()) saveBinary(program, path, key);
+  return program;
+}
+
+// コンピュートシェーダのソースファイルからプログラムオブジェクトを作成する
+GLuint ProgramCache::loadCompute(const char *comp, const Defines &defines)
+{
+  // ソースファイルを読み込んでマクロ定義を埋め込む
+  std::vector<std::string> sources(1);
+  if (!readSource(comp, sources[0])) return 0;
+  inject(sources[0], defines);
+
+  // キャッシュがあればそれを使う
+  std::uint64_t key(0);
+  const std::string path(getPath(sources, key));
+  if (!path.empty())
+  {
+    const GLuint program(loadBinary(path, key));
+    if (program != 0) return program;
+  }
+
+  // なければソースプログラムから作成してキャッシュに保存する
+  const GLuint program(ggCreateComputeShader(sources[0].c_str(), comp));
+  if (program != 0 && !path.empty()) saveBinary(program, path, key);
+  return program;
+}
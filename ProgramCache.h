@@ -0,0 +1,46 @@
+﻿#pragma once
+
+//
+// シェーダプログラムのバイナリのキャッシュ
+//
+//   ソースプログラムとドライバが同じならリンク済みのバイナリをファイルから読み込んで起動を速くする
+//
+
+// 補助プログラム
+#include "gg.h"
+using namespace gg;
+
+// 標準ライブラリ
+#include <map>
+#include <string>
+
+class ProgramCache
+{
+public:
+
+  // シェーダに埋め込むマクロ定義 (名前と値)
+  using Defines = std::map<std::string, std::string>;
+
+  // キャッシュを保存するディレクトリを設定する (空ならキャッシュしない)
+  //   OpenGL のコンテキストを作成した後に呼び出す
+  static void setDirectory(const std::string &directory);
+
+  // キャッシュを保存するディレクトリを得る (空ならキャッシュしない)
+  static const std::string &getDirectory();
+
+  // ドライバを識別する文字列を得る (ドライバの情報のハッシュ値)
+  static std::string getDriverId();
+
+  // すべてのシェーダに埋め込むマクロ定義を設定する
+  static void setDefines(const Defines &defines);
+
+  // バーテックスシェーダとフラグメントシェーダのソースファイルからプログラムオブジェクトを作成する
+  //   defines はすべてのシェーダのものに加えて #version の次の行に埋め込む
+  //   作成できなければ 0 を返す
+  static GLuint load(const char *vert, const char *frag, const Defines &defines = Defines());
+
+  // コンピュートシェーダのソースファイルからプログラムオブジェクトを作成する
+  //   defines はすべてのシェーダのものに加えて #version の次の行に埋め込む
+  //   作成できなければ 0 を返す
+  static GLuint loadCompute(const char *comp, const Defines &defines = Defines());
+};
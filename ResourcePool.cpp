@@ -0,0 +1,169 @@
+﻿#include "ResourcePool.h"
+
+//
+// テクスチャとバッファオブジェクトの資源プール
+//
+//   削除しなかったものは OpenGL のコンテキストと一緒に削除される
+//
+
+// 標準ライブラリ
+#include <map>
+#include <tuple>
+#include <vector>
+
+// バッファオブジェクトの大きさの区分の単位 (64KB)
+constexpr GLsizeiptr bufferGranularity(65536);
+
+// テクスチャの区分 (内部フォーマット, 幅, 高さ)
+using TextureClass = std::tuple<GLenum, GLsizei, GLsizei>;
+
+// バッファオブジェクトの区分 (区分の単位に切り上げた大きさ, ストレージのフラグ)
+using BufferClass = std::pair<GLsizeiptr, GLbitfield>;
+
+// 取り出されているテクスチャとバッファオブジェクトの区分
+static std::map<GLuint, TextureClass> usedTextures;
+static std::map<GLuint, BufferClass> usedBuffers;
+
+// 返却されて残しているテクスチャとバッファオブジェクト
+static std::map<TextureClass, std::vector<GLuint>> freeTextures;
+static std::map<BufferClass, std::vector<GLuint>> freeBuffers;
+
+// 確保したメモリ量の合計と返却されて残しているメモリ量
+static GLsizeiptr allocated(0), pooled(0);
+
+// 返却されたものを再利用した回数
+static unsigned long long reused(0);
+
+// 内部フォーマットの一画素のバイト数
+static GLsizeiptr getTexelSize(GLenum format)
+{
+  switch (format)
+  {
+  case GL_R16UI:
+    return 2;
+  case GL_RG32F:
+    return 8;
+  case GL_RGBA32F:
+    return 16;
+  default:
+    // GL_RGBA8, GL_RGBA8UI, GL_R32UI など
+    return 4;
+  }
+}
+
+// テクスチャの区分のメモリ量
+static GLsizeiptr getSize(const TextureClass &key)
+{
+  return getTexelSize(std::get<0>(key)) * std::get<1>(key) * std::get<2>(key);
+}
+
+// 内部フォーマットが format で大きさが width x height のテクスチャを取り出す
+GLuint ResourcePool::acquireTexture(GLenum format, GLsizei width, GLsizei height)
+{
+  const TextureClass key(format, width, height);
+  GLuint texture;
+
+  // 同じ区分のものが返却されていればそれを使う
+  auto &textures(freeTextures[key]);
+  if (!textures.empty())
+  {
+    texture = textures.back();
+    textures.pop_back();
+    pooled -= getSize(key);
+    ++reused;
+  }
+  else
+  {
+    // なければ変更できないストレージで確保する
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    allocated += getSize(key);
+  }
+
+  usedTextures[texture] = key;
+  return texture;
+}
+
+// 取り出したテクスチャを返却する
+void ResourcePool::releaseTexture(GLuint texture)
+{
+  const auto used(usedTextures.find(texture));
+  if (used == usedTextures.end()) return;
+
+  freeTextures[used->second].push_back(texture);
+  pooled += getSize(used->second);
+  usedTextures.erase(used);
+}
+
+// size バイト以上でストレージのフラグが flags のバッファオブジェクトを取り出す
+GLuint ResourcePool::acquireBuffer(GLsizeiptr size, GLbitfield flags)
+{
+  const BufferClass key((size + bufferGranularity - 1) / bufferGranularity * bufferGranularity, flags);
+  GLuint buffer;
+
+  // 同じ区分のものが返却されていればそれを使う
+  auto &buffers(freeBuffers[key]);
+  if (!buffers.empty())
+  {
+    buffer = buffers.back();
+    buffers.pop_back();
+    pooled -= key.first;
+    ++reused;
+  }
+  else
+  {
+    // なければ変更できないストレージで確保する
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, key.first, nullptr, flags);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    allocated += key.first;
+  }
+
+  usedBuffers[buffer] = key;
+  return buffer;
+}
+
+// 取り出したバッファオブジェクトを返却する
+void ResourcePool::releaseBuffer(GLuint buffer)
+{
+  const auto used(usedBuffers.find(buffer));
+  if (used == usedBuffers.end()) return;
+
+  freeBuffers[used->second].push_back(buffer);
+  pooled += used->second.first;
+  usedBuffers.erase(used);
+}
+
+// 取り出したテクスチャのメモリ量を得る
+GLsizeiptr ResourcePool::getTextureSize(GLuint texture)
+{
+  const auto used(usedTextures.find(texture));
+  return used == usedTextures.end() ? 0 : getSize(used->second);
+}
+
+// 取り出したバッファオブジェクトのメモリ量を得る
+GLsizeiptr ResourcePool::getBufferSize(GLuint buffer)
+{
+  const auto used(usedBuffers.find(buffer));
+  return used == usedBuffers.end() ? 0 : used->second.first;
+}
+
+// 確保したメモリ量の合計を得る
+GLsizeiptr ResourcePool::getAllocated()
+{
+  return allocated;
+}
+
+// 返却されて残しているメモリ量を得る
+GLsizeiptr ResourcePool::getPooled()
+{
+  return pooled;
+}
+
+// 返却されたものを再利用した回数を得る
+unsigned long long ResourcePool::getReused()
+{
+  return reused;
+}
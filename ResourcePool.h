@@ -0,0 +1,47 @@
+﻿#pragma once
+
+//
+// テクスチャとバッファオブジェクトの資源プール
+//
+//   変更できないストレージ (glTexStorage2D, glBufferStorage) で確保し,
+//   返却されたものは削除せずに残しておいて同じ区分の要求があれば再利用する
+//   センサを開き直しても確保し直さないので, ドライバのメモリの再割り当てによる引っかかりを避けられる
+//
+
+// 補助プログラム
+#include "gg.h"
+using namespace gg;
+
+class ResourcePool
+{
+public:
+
+  // 内部フォーマットが format で大きさが width x height のテクスチャを取り出す
+  //   返却されたもののうち同じ内部フォーマットと大きさのものがあればそれを使う
+  static GLuint acquireTexture(GLenum format, GLsizei width, GLsizei height);
+
+  // 取り出したテクスチャを返却する
+  static void releaseTexture(GLuint texture);
+
+  // size バイト以上でストレージのフラグが flags のバッファオブジェクトを取り出す
+  //   大きさは区分の単位に切り上げ, 返却されたもののうち同じ区分とフラグのものがあればそれを使う
+  static GLuint acquireBuffer(GLsizeiptr size, GLbitfield flags);
+
+  // 取り出したバッファオブジェクトを返却する
+  static void releaseBuffer(GLuint buffer);
+
+  // 取り出したテクスチャのメモリ量 (バイト) を得る
+  static GLsizeiptr getTextureSize(GLuint texture);
+
+  // 取り出したバッファオブジェクトのメモリ量 (バイト) を得る
+  static GLsizeiptr getBufferSize(GLuint buffer);
+
+  // 確保したメモリ量の合計 (バイト, 返却されて残しているものを含む) を得る
+  static GLsizeiptr getAllocated();
+
+  // 返却されて残しているメモリ量 (バイト) を得る
+  static GLsizeiptr getPooled();
+
+  // 返却されたものを再利用した回数を得る
+  static unsigned long long getReused();
+};
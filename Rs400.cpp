@@ -16,21 +16,13 @@
 #  pragma comment (lib, "realsense2" RS_EXT_STR)
 #endif
 
-// デプスデータをカラーデータに合わせる場合 1
-#define ALIGN_TO_COLOR 0
-
-// パイプラインの設定
-constexpr int depth_width = 1280;		// depth_intr.width;
-constexpr int depth_height = 720;		// depth_intr.height;
-constexpr int depth_fps = 30;				// 30 or 60 due to resolution
-constexpr int color_width = 1920;		// color_intr.width
-constexpr int color_height = 1080;	// color_intr.height
-constexpr int color_fps = 30;				// 30 or 60
-
 // 標準ライブラリ
 #include <iostream>
 #include <climits>
 #include <cassert>
+#include <algorithm>
+#include <iterator>
+#include <chrono>
 
 #if defined(DEBUG)
 static void check_frame_format(int format)
@@ -94,22 +86,20 @@ static void check_intrinsics(const rs2_intrinsics &intrinsics)
 #  define CHECK_INTRINSICS(intrinsics)
 #endif
 
-// コンストラクタ
-Rs400::Rs400()
-	: depthPtr(nullptr)
-  , colorPtr(nullptr)
+// RealSense のコンテキストを得る
+rs2::context &Rs400::get_context()
 {
 	// RealSense のコンテキスト
 	static std::unique_ptr<rs2::context> context(nullptr);
 
-	// 最初のオブジェクトの時だけ
+	// 最初に呼び出されたときだけ
 	if (!context)
 	{
 		// コンテキストを作成して
 		context.reset(new rs2::context);
 
 		// デバイスが変更されたときに呼び出すコールバック関数を指定する
-		context->set_devices_changed_callback([&](rs2::event_information &info)
+		context->set_devices_changed_callback([](rs2::event_information &info)
 		{
 			// 取り外されたデバイスがあればそれを削除する
 			remove_device(info);
@@ -130,38 +120,115 @@ Rs400::Rs400()
 		}
 	}
 
-	// RealSense の使用台数が接続台数に達していれば戻る
-	if (activated >= count_device())
+	return *context;
+}
+
+// コンストラクタ
+Rs400::Rs400(int depth_width, int depth_height, int depth_fps,
+  int color_width, int color_height, int color_fps, bool align_to_color, const std::string &serial,
+  const Processing &processing, bool color_yuyv)
+	: depthPtr(nullptr)
+  , colorPtr(nullptr)
+  , synchronized(false)
+  , alignToColor(align_to_color)
+  , yuyv(color_yuyv)
+  , processing(processing)
+  , depthScale(0.001f)
+  , processed(1)
+  , filtering(false)
+  , processedCount(0)
+  , processedTime(0)
+  , alignBuffer(0)
+  , rawTexture(0)
+  , alignTexture(0)
+{
+	// デバイスリストを用意する
+	get_context();
+
+	// 使用するデバイスを決める
 	{
-		setMessage("RealSense の数が足りません");
-		return;
+		// デバイスリストをロックする
+		std::lock_guard<std::mutex> lock(devicesMutex);
+
+		if (serial.empty())
+		{
+			// 使われていない最初のデバイスを探す
+			for (const auto &device : devices)
+			{
+				if (opened.count(device.first) == 0)
+				{
+					this->serial = device.first;
+					break;
+				}
+			}
+
+			// 使われていないデバイスがなければ戻る
+			if (this->serial.empty())
+			{
+				setMessage("RealSense の数が足りません");
+				return;
+			}
+		}
+		else if (devices.count(serial) == 0)
+		{
+			setMessage("指定したシリアル番号の RealSense が見つかりません");
+			return;
+		}
+		else if (opened.count(serial) > 0)
+		{
+			setMessage("指定したシリアル番号の RealSense は使用中です");
+			return;
+		}
+		else
+		{
+			this->serial = serial;
+		}
+
+		// 使用中にする
+		opened.insert(this->serial);
 	}
 
-  // デバイスの番号
-  int id(0);
+	// パイプラインの設定
+	rs2::config conf;
 
-  for (const auto &device : devices)
-  {
-    // 未使用のデバイスがあったら
-    if (id++ == activated)
-    {
-      // 使用中のデバイスをカウントする
-      ++activated;
+	// このデバイスのシリアル番号の RealSense をパイプラインで使用できるようにする
+	conf.enable_device(this->serial);
 
-      // パイプラインの設定
-      rs2::config conf;
+	// キャプチャするデータのフォーマットを指定する
+	conf.enable_stream(RS2_STREAM_DEPTH, depth_width, depth_height, RS2_FORMAT_Z16, depth_fps);
+	conf.enable_stream(RS2_STREAM_COLOR, color_width, color_height, yuyv ? RS2_FORMAT_YUYV : RS2_FORMAT_RGB8, color_fps);
 
-      // このデバイスのシリアル番号の RealSense をパイプラインで使用できるようにする
-      conf.enable_device(device.first);
+	try
+	{
+		// この設定でパイプラインを開始する
+		profile = pipe.start(conf);
 
-      // キャプチャするデータのフォーマットを指定する
-      conf.enable_stream(RS2_STREAM_DEPTH, depth_width, depth_height, RS2_FORMAT_Z16, depth_fps);
-      conf.enable_stream(RS2_STREAM_COLOR, color_width, color_height, RS2_FORMAT_RGB8, color_fps);
+		// デプスセンサ
+		const auto sensor(profile.get_device().first<rs2::depth_sensor>());
 
-      // この設定でパイプラインを開始する
-      profile = pipe.start(conf);
-      break;
-    }
+		// ビジュアルプリセットを選ぶ
+		if (processing.preset >= 0 && sensor.supports(RS2_OPTION_VISUAL_PRESET))
+			sensor.set_option(RS2_OPTION_VISUAL_PRESET, static_cast<float>(processing.preset));
+
+		// デプスの単位を設定する
+		if (processing.depthUnits > 0.0f && sensor.supports(RS2_OPTION_DEPTH_UNITS))
+			sensor.set_option(RS2_OPTION_DEPTH_UNITS, processing.depthUnits);
+
+		// デプスデータの値の単位
+		depthScale = sensor.get_depth_scale();
+	}
+	catch (...)
+	{
+		// 開始できなければデバイスを使用中でなくする
+		std::lock_guard<std::mutex> lock(devicesMutex);
+		opened.erase(this->serial);
+		throw;
+	}
+
+  // 複数のセンサのタイムスタンプを比較できるようにグローバルタイムを有効にする
+  for (auto &&sensor : profile.get_device().query_sensors())
+  {
+    if (sensor.supports(RS2_OPTION_GLOBAL_TIME_ENABLED)) sensor.set_option(RS2_OPTION_GLOBAL_TIME_ENABLED, 1.0f);
   }
 
 	// デプスストリーム
@@ -170,6 +237,42 @@ Rs400::Rs400()
 	// デプスストリームの内部パラメータ
   depthIntrinsics = dstream.get_intrinsics();
 
+  // 間引きはほかのフィルタより先にかける
+  if (processing.decimation > 1)
+  {
+    rs2::decimation_filter decimation;
+    decimation.set_option(RS2_OPTION_FILTER_MAGNITUDE, static_cast<float>(processing.decimation));
+    filters.push_back(decimation);
+  }
+
+  // 空間フィルタと時間フィルタは視差の空間でかける
+  if (processing.spatial || processing.temporal)
+  {
+    filters.push_back(rs2::disparity_transform(true));
+    if (processing.spatial) filters.push_back(rs2::spatial_filter());
+    if (processing.temporal) filters.push_back(rs2::temporal_filter());
+    filters.push_back(rs2::disparity_transform(false));
+  }
+
+  // 穴埋めは最後にかける
+  if (processing.holeFilling >= 0)
+  {
+    rs2::hole_filling_filter holeFilling;
+    holeFilling.set_option(RS2_OPTION_HOLES_FILL, static_cast<float>(processing.holeFilling));
+    filters.push_back(holeFilling);
+  }
+
+  // 間引くときは
+  if (processing.decimation > 1)
+  {
+    // 一フレームにフィルタをかけて
+    rs2::frameset frames(pipe.wait_for_frames());
+    for (const auto &filter : filters) frames = frames.apply_filter(filter);
+
+    // 間引いたデプスデータの内部パラメータを使う
+    depthIntrinsics = frames.get_depth_frame().get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+  }
+
 #if defined(DEBUG)
 	// デプスセンサの内部パラメータの確認
   check_intrinsics(depthIntrinsics);
@@ -193,60 +296,137 @@ Rs400::Rs400()
 	colorHeight = colorIntrinsics.height;
 
   // デプスフレームの幅と高さ
-#if ALIGN_TO_COLOR
-  depthWidth = colorWidth;
-  depthHeight = colorHeight;
-#else
-  depthWidth = depthIntrinsics.width;
-  depthHeight = depthIntrinsics.height;
-#endif
+  depthWidth = alignToColor ? colorWidth : depthIntrinsics.width;
+  depthHeight = alignToColor ? colorHeight : depthIntrinsics.height;
 
   // カラーセンサに対するデプスセンサの外部パラメータ
   extrinsics = dstream.get_extrinsics_to(cstream);
 
-  // まだシェーダが作られていなかったら
-  if (shader.get() == nullptr)
+  // カメラ座標算出用のシェーダを用意する
+  shader = Compute::share("position_rs.comp", getFilterDefines());
+
+  // シェーダの uniform 変数の場所を調べる
+  depthLoc = glGetUniformLocation(shader->get(), "depth");
+  pointLoc = glGetUniformLocation(shader->get(), "point");
+  originLoc = glGetUniformLocation(shader->get(), "origin");
+  limitLoc = glGetUniformLocation(shader->get(), "limit");
+
+  // カメラパラメータは変わらないので Uniform Buffer Object に入れておく
+  //   デプスデータをカラーデータに合わせていればカラーセンサのカメラ座標になる
+  static constexpr GLfloat identity[] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+  static constexpr GLfloat zero[] = { 0.0f, 0.0f, 0.0f };
+  parameterBuffer = alignToColor
+    ? makeCameraParameter(colorIntrinsics, identity, zero)
+    : makeCameraParameter(depthIntrinsics, extrinsics.rotation, extrinsics.translation);
+  const GLuint parameterIndex(glGetProgramResourceIndex(shader->get(), GL_UNIFORM_BLOCK, "Parameter"));
+  glUniformBlockBinding(shader->get(), parameterIndex, ParameterBinding);
+
+  // シェーダストレージブロックに結合ポイントを割り当てる
+  const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
+  glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
+  const GLuint uvmapIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Uvmap"));
+  glShaderStorageBlockBinding(shader->get(), uvmapIndex, UvmapBinding);
+
+  // テクスチャとバッファオブジェクトを作成してポイント数を返す
+  const int depthCount(makeTexture());
+
+  // カメラ座標を求めて描画する領域を設定する
+  setRoi(processing.roi[0], processing.roi[1], processing.roi[2], processing.roi[3]);
+
+  // カメラ座標を求めるシェーダのワークグループのサイズをこの領域の大きさで自動調整する
+  tunePosition(shader);
+
+  // カラーデータを YUYV で受け取るならシェーダで変換する
+  if (yuyv) makeYuyvTexture();
+
+  // デプスデータをカラーデータに合わせるなら
+  if (alignToColor)
   {
-    // カメラ座標算出用のシェーダを作成する
-    shader.reset(new Compute("position_rs.comp"));
+    // カラーデータに合わせる前のデプスデータを格納するテクスチャを準備する
+    rawTexture = acquireTexture(GL_R16UI, depthIntrinsics.width, depthIntrinsics.height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    // カラーセンサの画素ごとの最も近いデプス値を求めるテクスチャを何も書き込んでいない状態で準備する
+    const std::vector<GLuint> empty(colorWidth * colorHeight, 0xffffffffu);
+    alignTexture = acquireTexture(GL_R32UI, colorWidth, colorHeight);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth, colorHeight, GL_RED_INTEGER, GL_UNSIGNED_INT, empty.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    // デプスデータをカラーデータに合わせるシェーダを用意する
+    aligner = Compute::share("align_rs.comp");
 
     // シェーダの uniform 変数の場所を調べる
-    depthLoc = glGetUniformLocation(shader->get(), "depth");
-    pointLoc = glGetUniformLocation(shader->get(), "point");
-    dppLoc = glGetUniformLocation(shader->get(), "dpp");
-    dfLoc = glGetUniformLocation(shader->get(), "df");
-    cppLoc = glGetUniformLocation(shader->get(), "cpp");
-    cfLoc = glGetUniformLocation(shader->get(), "cf");
-    maxDepthLoc = glGetUniformLocation(shader->get(), "maxDepth");
-    extRotationLoc = glGetUniformLocation(shader->get(), "extRotation");
-    extTranslationLoc = glGetUniformLocation(shader->get(), "extTranslation");
-
-    // シェーダストレージブロックに結合ポイントを割り当てる
-    const GLuint weightIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Weight"));
-    glShaderStorageBlockBinding(shader->get(), weightIndex, WeightBinding);
-    const GLuint uvmapIndex(glGetProgramResourceIndex(shader->get(), GL_SHADER_STORAGE_BLOCK, "Uvmap"));
-    glShaderStorageBlockBinding(shader->get(), uvmapIndex, UvmapBinding);
+    alignRawLoc = glGetUniformLocation(aligner->get(), "raw");
+    alignAlignedLoc = glGetUniformLocation(aligner->get(), "aligned");
+    alignDepthLoc = glGetUniformLocation(aligner->get(), "depth");
+    alignResolveLoc = glGetUniformLocation(aligner->get(), "resolve");
+
+    // カラーセンサに合わせる前のデプスセンサのカメラパラメータを Uniform Buffer Object に入れておく
+    alignBuffer = makeCameraParameter(depthIntrinsics, extrinsics.rotation, extrinsics.translation);
+    const GLuint alignIndex(glGetProgramResourceIndex(aligner->get(), GL_UNIFORM_BLOCK, "Parameter"));
+    glUniformBlockBinding(aligner->get(), alignIndex, ParameterBinding);
+
+    // シェーダを使わないときは CPU で合わせる
+    align.reset(new rs2::align(RS2_STREAM_COLOR));
   }
 
-  // テクスチャとバッファオブジェクトを作成してポイント数を返す
-  const int depthCount(makeTexture());
-
   // データ転送用のメモリを確保する
   point.resize(depthCount);
   uvmap.resize(depthCount);
 	color.resize(colorWidth * colorHeight);
+
+  // フィルタをかけるならキャプチャ用のスレッドでかける
+  if (!filters.empty())
+  {
+    filtering = true;
+    processor = std::thread([this]() { process(); });
+  }
 }
 
 // デストラクタ
 Rs400::~Rs400()
 {
+  // フィルタをかけるスレッドを止める
+  if (processor.joinable())
+  {
+    filtering = false;
+    processor.join();
+  }
+
+  // バッファオブジェクトを削除する (テクスチャは DepthCamera のデストラクタで資源プールに返却する)
+  if (alignBuffer > 0) glDeleteBuffers(1, &alignBuffer);
+
+  // 使用していたデバイスを使用中でなくする
+  if (!serial.empty())
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    opened.erase(serial);
+  }
+}
+
+// 接続されている RealSense のシリアル番号と製品名のリストを得る
+std::map<std::string, std::string> Rs400::getDevices()
+{
+	// デバイスリストを用意する
+	get_context();
+
+	// デバイスリストをロックする
+	std::lock_guard<std::mutex> lock(devicesMutex);
+
+	// シリアル番号と製品名を取り出す
+	std::map<std::string, std::string> list;
+	for (const auto &device : devices) list.emplace(device.first, device.second.get_info(RS2_CAMERA_INFO_NAME));
+
+	return list;
 }
 
 // RealSense を追加する
 void Rs400::add_device(rs2::device &dev)
 {
 	// RealSense 以外のカメラでないか調べる
-	if (dev.get_info(RS2_CAMERA_INFO_NAME) == "Platform Camera")
+	if (std::string(dev.get_info(RS2_CAMERA_INFO_NAME)) == "Platform Camera")
 	{
 		// RealSense ではない
 		return;
@@ -255,8 +435,8 @@ void Rs400::add_device(rs2::device &dev)
 	// RealSense のシリアル番号を調べる
 	std::string serial_number(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER));
 
-	// デバイスをロックする
-	std::lock_guard<std::mutex> lock(deviceMutex);
+	// デバイスリストをロックする
+	std::lock_guard<std::mutex> lock(devicesMutex);
 
 	// デバイスリストのなかにデバイスがあるか調べる
 	if (devices.find(serial_number) != devices.end())
@@ -266,20 +446,20 @@ void Rs400::add_device(rs2::device &dev)
 	}
 
 	// このデバイスをリストに登録する
-	devices.emplace(serial_number, &dev);
+	devices.emplace(serial_number, dev);
 }
 
 // RealSense を無効にする
 void Rs400::remove_device(const rs2::event_information &info)
 {
-	// デバイスをロックする
-	std::lock_guard<std::mutex> lock(deviceMutex);
+	// デバイスリストをロックする
+	std::lock_guard<std::mutex> lock(devicesMutex);
 
 	// デバイスリストのすべてのデバイスについて
 	for (auto device = devices.begin(); device != devices.end();)
 	{
 		// そのデバイスが削除されていたら
-		if (info.was_removed(*device->second))
+		if (info.was_removed(device->second))
 		{
 			// そのデバイスをデバイスリストから削除して先に進む
 			device = devices.erase(device);
@@ -292,48 +472,115 @@ void Rs400::remove_device(const rs2::event_information &info)
 	}
 }
 
-// 接続されている RealSense の数を調べる
-int Rs400::count_device()
+// フィルタをかけるスレッドの処理
+void Rs400::process()
 {
-	// デバイスをロックする
-	std::lock_guard<std::mutex> lock(deviceMutex);
+  while (filtering)
+  {
+    // フレームが到着するのを待つ
+    rs2::frameset frames;
+    if (!pipe.try_wait_for_frames(&frames, 100)) continue;
 
-	// デバイスリストの数を返す
-	return static_cast<int>(devices.size());
-}
+    // フィルタを順にかける
+    const auto start(std::chrono::steady_clock::now());
+    for (const auto &filter : filters) frames = frames.apply_filter(filter);
+    const auto elapsed(std::chrono::steady_clock::now() - start);
 
-// デプスデータを取得する
-GLuint Rs400::getDepth()
-{
-	// デプスデータのテクスチャを指定する
-	glBindTexture(GL_TEXTURE_2D, depthTexture);
+    // フィルタをかけたフレームを描画のスレッドに渡す
+    processed.enqueue(frames);
 
-  // センサから取得するフレームの格納先
-  rs2::frameset frames;
+    // フィルタをかけた時間を記録する
+    processedTime += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    ++processedCount;
+  }
+}
 
-  // 新しいフレームが到着していれば
-  if (pipe.poll_for_frames(&frames) && deviceMutex.try_lock())
+// フレームのデプスデータをテクスチャに転送してカラーデータを保持する
+void Rs400::setFrames(const rs2::frameset &frames)
+{
+  // デプスデータを取得中でなければ
+  if (deviceMutex.try_lock())
   {
-#if ALIGN_TO_COLOR
-    // デプスデータをカラーデータに合わせる
-    rs2::align align_to_color(RS2_STREAM_COLOR);
-    frames = align_to_color.process(frames);
-#endif
+    // データを使い終わるまでフレームを保持する
+    this->frames = frames;
 
     // デプスフレームを取り出す
-    const auto dframe(frames.get_depth_frame());
+    const auto dframe(this->frames.get_depth_frame());
     depthPtr = static_cast<const GLushort *>(dframe.get_data());
+    ++depthFrame;
 
-    // デプスデータをテクスチャに転送する
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, depthWidth, depthHeight, GL_RED_INTEGER, GL_UNSIGNED_SHORT, depthPtr);
+    // デプスデータをテクスチャに転送する (カラーデータに合わせるならシェーダで合わせる前のもの)
+    glBindTexture(GL_TEXTURE_2D, alignToColor ? rawTexture : depthTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, depthIntrinsics.width, depthIntrinsics.height,
+      GL_RED_INTEGER, GL_UNSIGNED_SHORT, depthPtr);
 
     // カラーフレームを取り出す
-    const auto cframe(frames.get_color_frame());
+    const auto cframe(this->frames.get_color_frame());
     colorPtr = static_cast<const Color *>(cframe.get_data());
 
+    // 共有メモリに書き込む
+    if (publisher)
+    {
+      publisher->publish(depthPtr, reinterpret_cast<const std::uint8_t *>(colorPtr),
+        dframe.get_timestamp(), attitude.get());
+    }
+
     // デプスデータをアンロックする
     deviceMutex.unlock();
   }
+}
+
+// 受け取ったフレームを共有メモリに書き込むようにする
+bool Rs400::setPublisher(const std::string &name, std::uint32_t slots)
+{
+  // 共有メモリにはカラーデータに合わせる前のデプスデータを書き込む
+
+  // 内部パラメータを共有メモリの形式にする
+  const auto intrinsics([](const rs2_intrinsics &from, FrameIntrinsics &to)
+  {
+    to.ppx = from.ppx;
+    to.ppy = from.ppy;
+    to.fx = from.fx;
+    to.fy = from.fy;
+    std::copy(std::begin(from.coeffs), std::end(from.coeffs), to.coeffs);
+    to.model = from.model;
+  });
+
+  // 共有メモリのヘッダの内容
+  FrameRingHeader format{};
+  format.depthWidth = depthIntrinsics.width;
+  format.depthHeight = depthIntrinsics.height;
+  format.colorWidth = colorWidth;
+  format.colorHeight = colorHeight;
+  format.colorFormat = yuyv ? FrameColorYuyv : FrameColorRgb;
+  format.depthScale = depthScale;
+  intrinsics(depthIntrinsics, format.depthIntrinsics);
+  intrinsics(colorIntrinsics, format.colorIntrinsics);
+  std::copy(std::begin(extrinsics.rotation), std::end(extrinsics.rotation), format.extRotation);
+  std::copy(std::begin(extrinsics.translation), std::end(extrinsics.translation), format.extTranslation);
+
+  // デプスデータの取得中でないときに共有メモリを作る
+  std::lock_guard<std::mutex> lock(deviceMutex);
+  publisher.reset(new FramePublisher(name, format, slots));
+  if (publisher->isOpened()) return true;
+
+  publisher.reset();
+  return false;
+}
+
+// デプスデータを取得する
+GLuint Rs400::getDepth()
+{
+  // フレームを外部から受け取らないとき新しいフレームが到着していれば
+  rs2::frameset frames;
+  if (!synchronized && pollFrames(frames))
+  {
+    // デプスデータをテクスチャに転送する
+    setFrames(frames);
+  }
+
+	// デプスデータのテクスチャを指定する
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
 
   return depthTexture;
 }
@@ -350,6 +597,28 @@ GLuint Rs400::getPoint()
 	// デプスデータが更新されており RealSense がデプスデータの取得中でなければ
 	if (depthPtr && deviceMutex.try_lock())
 	{
+    // このデプスデータからカメラ座標を求める
+    updatePoint();
+
+    // デプスデータの内部パラメータ (カラーデータに合わせていればカラーセンサのもの)
+    const rs2_intrinsics &intrinsics(alignToColor ? colorIntrinsics : depthIntrinsics);
+
+    // カラーデータに合わせるときは CPU で合わせる
+    rs2::frameset aligned;
+    if (alignToColor)
+    {
+      aligned = align->process(frames);
+      depthPtr = static_cast<const GLushort *>(aligned.get_depth_frame().get_data());
+
+      // 合わせたデプスデータをテクスチャに転送する
+      glBindTexture(GL_TEXTURE_2D, depthTexture);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, depthWidth, depthHeight, GL_RED_INTEGER, GL_UNSIGNED_SHORT, depthPtr);
+      glBindTexture(GL_TEXTURE_2D, pointTexture);
+    }
+
+    // 計測不能点を飛ばす距離 (m)
+    const GLfloat far(0.001f * maxDepth);
+
     // デプスデータからテクスチャ座標を求める
     for (int i = 0; i < depthWidth * depthHeight; ++i)
     {
@@ -360,24 +629,30 @@ GLuint Rs400::getPoint()
       // 格納先
       const int j((depthHeight - y - 1) * depthWidth + x);
 
-      // カラーデータを格納する
-      color[j] = colorPtr[i];
+      // カラーデータを格納する (YUYV なら画素の大きさが違うのでシェーダで変換したものを使う)
+      if (!yuyv) color[j] = colorPtr[i];
 
-#if ALIGN_TO_COLOR
-      // テクスチャ座標を求める
-      uvmap[j][0] = x + 0.5f;
-      uvmap[j][1] = y + 0.5f;
-#else
       // デプスセンサのカメラ座標を m 単位で求める (計測不能点だったら最遠点に飛ばす)
-      const GLfloat dz(0.001f * ((depthPtr[i] != 0 && depthPtr[i] < maxDepth) ? depthPtr[i] : maxDepth));
-      const GLfloat dx(dz * (x - depthIntrinsics.ppx) / depthIntrinsics.fx);
-      const GLfloat dy(dz * (y - depthIntrinsics.ppy) / depthIntrinsics.fy);
+      const GLfloat d(depthScale * depthPtr[i]);
+      const bool clipped(d < processing.nearClip || (processing.farClip > 0.0f && d > processing.farClip));
+      const GLfloat dz((depthPtr[i] != 0 && d < far && !clipped) ? d : far);
+      const GLfloat dx(dz * (x - intrinsics.ppx) / intrinsics.fx);
+      const GLfloat dy(dz * (y - intrinsics.ppy) / intrinsics.fy);
 
       // デプスセンサのカメラ座標を保存する
       point[j][0] = dx;
       point[j][1] = -dy;
       point[j][2] = -dz;
 
+      // デプスデータをカラーデータに合わせているときは
+      if (alignToColor)
+      {
+        // テクスチャ座標は画素位置そのもの
+        uvmap[j][0] = x + 0.5f;
+        uvmap[j][1] = y + 0.5f;
+        continue;
+      }
+
       // カラーセンサから見たカメラ座標を求める
       const GLfloat cx(extrinsics.rotation[0] * dx + extrinsics.rotation[3] * dy + extrinsics.rotation[6] * dz + extrinsics.translation[0]);
       const GLfloat cy(extrinsics.rotation[1] * dx + extrinsics.rotation[4] * dy + extrinsics.rotation[7] * dz + extrinsics.translation[1]);
@@ -386,7 +661,6 @@ GLuint Rs400::getPoint()
       // カラーセンサのカメラ座標をテクスチャ座標に変換して保存する
       uvmap[j][0] = cx * colorIntrinsics.fx / cz + colorIntrinsics.ppx;
       uvmap[j][1] = cy * colorIntrinsics.fy / cz + colorIntrinsics.ppy;
-#endif
     }
 
     // カメラ座標をテクスチャに転送する
@@ -411,27 +685,86 @@ GLuint Rs400::getPoint()
 // カメラ座標を算出する
 GLuint Rs400::getPosition()
 {
+  // デプスデータを取得する
+  getDepth();
+
+  // デプスデータが更新されていなければカメラ座標は求め直さない
+  if (!updatePoint()) return pointTexture;
+
+  // カラーデータに合わせるならシェーダで合わせる
+  if (alignToColor) alignDepth();
+
+  // 自動調整中なら候補のシェーダに切り替えて計測する
+  beginPosition(shader);
+
   // カメラ座標をシェーダで算出する
-  const GLuint depthTexture(getDepth());
   shader->use();
   glUniform1i(depthLoc, DepthImageUnit);
   glUniform1i(pointLoc, PointImageUnit);
-  glUniform2f(dppLoc, depthIntrinsics.ppx, depthIntrinsics.ppy);
-  glUniform2f(dfLoc, depthIntrinsics.fx, depthIntrinsics.fy);
-  glUniform2f(cppLoc, colorIntrinsics.ppx, colorIntrinsics.ppy);
-  glUniform2f(cfLoc, colorIntrinsics.fx, colorIntrinsics.fy);
-  glUniform1f(maxDepthLoc, maxDepth);
-  glUniformMatrix3fv(extRotationLoc, 1, GL_FALSE, extrinsics.rotation);
-  glUniform3fv(extTranslationLoc, 1, extrinsics.translation);
+  glBindBufferBase(GL_UNIFORM_BUFFER, ParameterBinding, parameterBuffer);
   glBindImageTexture(DepthImageUnit, depthTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R16UI);
   glBindImageTexture(PointImageUnit, pointTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WeightBinding, weightBuffer);
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, UvmapBinding, uvmapBuffer);
-  shader->execute(depthWidth, depthHeight, 16, 16);
+
+  // 設定した領域だけを処理する
+  glUniform2i(originLoc, roi[0], roi[1]);
+  glUniform2i(limitLoc, roi[0] + roi[2], roi[1] + roi[3]);
+  shader->dispatch(roi[2], roi[3], 0, filterApron);
+  endPosition();
 
   return pointTexture;
 }
 
+// カメラパラメータを格納した Uniform Buffer Object を作成する
+GLuint Rs400::makeCameraParameter(const rs2_intrinsics &depth, const GLfloat *rotation, const GLfloat *translation) const
+{
+  Parameter parameter{};
+
+  // mat3 の列は vec4 の大きさになるので列ごとにコピーする
+  for (int i = 0; i < 3; ++i) std::copy(rotation + i * 3, rotation + i * 3 + 3, parameter.extRotation + i * 4);
+  std::copy(translation, translation + 3, parameter.extTranslation);
+
+  parameter.maxDepth = 0.001f * maxDepth / depthScale;
+  parameter.dpp[0] = depth.ppx;
+  parameter.dpp[1] = depth.ppy;
+  parameter.df[0] = depth.fx;
+  parameter.df[1] = depth.fy;
+  parameter.cpp[0] = colorIntrinsics.ppx;
+  parameter.cpp[1] = colorIntrinsics.ppy;
+  parameter.cf[0] = colorIntrinsics.fx;
+  parameter.cf[1] = colorIntrinsics.fy;
+  parameter.depthScale = depthScale;
+  parameter.smoothing = processing.smoothing;
+  parameter.nearDepth = processing.nearClip / depthScale;
+  parameter.farDepth = processing.farClip > 0.0f ? processing.farClip / depthScale : 65535.0f;
+
+  return makeParameter(&parameter, sizeof parameter);
+}
+
+// デプスデータをシェーダでカラーデータに合わせる
+void Rs400::alignDepth()
+{
+  aligner->use();
+  glUniform1i(alignRawLoc, RawImageUnit);
+  glUniform1i(alignAlignedLoc, AlignImageUnit);
+  glUniform1i(alignDepthLoc, DepthImageUnit);
+  glBindBufferBase(GL_UNIFORM_BUFFER, ParameterBinding, alignBuffer);
+  glBindImageTexture(RawImageUnit, rawTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R16UI);
+  glBindImageTexture(AlignImageUnit, alignTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+  glBindImageTexture(DepthImageUnit, depthTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R16UI);
+
+  // デプスデータの画素をカラーセンサに投影して画素ごとに最も近いものを残す
+  glUniform1i(alignResolveLoc, GL_FALSE);
+  aligner->dispatch(depthIntrinsics.width, depthIntrinsics.height);
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+  // 残ったものをカラーデータに合わせたデプスデータにする
+  glUniform1i(alignResolveLoc, GL_TRUE);
+  aligner->dispatch(colorWidth, colorHeight);
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
 // カラーデータを取得する
 GLuint Rs400::getColor()
 {
@@ -441,8 +774,11 @@ GLuint Rs400::getColor()
 	// カラーデータが更新されておりカラーデータの取得中でなければ
 	if (colorPtr && deviceMutex.try_lock())
 	{
-		// カラーデータをテクスチャに転送する
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth, colorHeight, GL_RGB, GL_UNSIGNED_BYTE, colorPtr);
+		// カラーデータをテクスチャに転送する (YUYV ならシェーダで RGB に変換する)
+		if (yuyv)
+			setYuyv(colorPtr);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colorWidth, colorHeight, GL_RGB, GL_UNSIGNED_BYTE, colorPtr);
 
     // 一度送ってしまえば更新されるまで送る必要がないのでデータは不要
 		colorPtr = nullptr;
@@ -454,31 +790,13 @@ GLuint Rs400::getColor()
 	return colorTexture;
 }
 
-// 使用しているセンサの数
-int Rs400::activated(0);
-
-// カメラ座標を計算するシェーダ
-std::unique_ptr<Compute> Rs400::shader(nullptr);
-
-// デプスデータのイメージユニットの uniform 変数 depth の場所
-GLint Rs400::depthLoc;
-
-// カメラ座標のイメージユニットの uniform 変数 point の場所
-GLint Rs400::pointLoc;
-
-// デプスセンサのカメラパラメータの uniform 変数の場所
-GLint Rs400::dppLoc, Rs400::dfLoc;
-
-// カラーセンサのカメラパラメータの uniform 変数の場所
-GLint Rs400::cppLoc, Rs400::cfLoc;
-
-// 奥行きの最大値 の uniform 変数 maxDepth の場所
-GLint Rs400::maxDepthLoc;
-
-// RealSense のカラーセンサに対するデプスセンサの外部パラメータの uniform 変数の場所
-GLint Rs400::extRotationLoc, Rs400::extTranslationLoc;
+// RealSense のデバイスリストの mutex
+std::mutex Rs400::devicesMutex;
 
 // RealSense のデバイスリスト
-std::map<std::string, rs2::device *> Rs400::devices;
+std::map<std::string, rs2::device> Rs400::devices;
+
+// 使用中の RealSense のシリアル番号
+std::set<std::string> Rs400::opened;
 
 #endif
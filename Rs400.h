@@ -10,10 +10,6 @@
 // RealSense を使う
 #if !defined(USE_REAL_SENSE)
 #  define USE_REAL_SENSE 1
-#  ifdef SENSOR
-#    undef SENSOR
-#  endif
-#  define SENSOR Rs400
 #endif
 
 #if USE_REAL_SENSE
@@ -21,16 +17,71 @@
 // RealSense 関連
 #include <librealsense2/rs.hpp>
 
+// 共有メモリのリングバッファによるフレームの配布
+#include "FrameRing.h"
+
 // 標準ライブラリ
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <string>
 #include <map>
+#include <set>
 
 class Rs400 : public DepthCamera
 {
-  // 使用しているセンサの数
-  static int activated;
+public:
+
+  // デプスデータの後処理の設定
+  struct Processing
+  {
+    // 間引きの倍率 (1 なら間引かない, 2～8)
+    int decimation;
+
+    // 空間フィルタをかけるなら true
+    bool spatial;
+
+    // 時間フィルタをかけるなら true
+    bool temporal;
+
+    // 穴埋めの方法 (-1 なら穴埋めしない, 0: 左から, 1: 周囲の最遠点, 2: 周囲の最近点)
+    int holeFilling;
+
+    // デプスの単位 (m, 0 ならデバイスのデフォルト)
+    float depthUnits;
+
+    // ビジュアルプリセット (rs2_rs400_visual_preset, -1 ならデバイスのデフォルト)
+    int preset;
+
+    // position_rs.comp でバイラテラルフィルタをかけるなら true
+    bool smoothing;
+
+    // カメラ座標を求めて描画するデプスデータの領域 (左上の位置と幅と高さ, 幅か高さが 0 なら全体)
+    int roi[4];
+
+    // これより近いか遠いデプス値を計測不能点にする距離 (m, 0 なら切り取らない)
+    float nearClip, farClip;
+
+    // デフォルトは後処理をしない
+    Processing()
+      : decimation(1)
+      , spatial(false)
+      , temporal(false)
+      , holeFilling(-1)
+      , depthUnits(0.0f)
+      , preset(-1)
+      , smoothing(true)
+      , roi{ 0, 0, 0, 0 }
+      , nearClip(0.0f)
+      , farClip(0.0f)
+    {
+    }
+  };
+
+private:
+
+  // 使用している RealSense のシリアル番号
+  std::string serial;
 
 	// 新着のデプスデータ
 	const GLushort *depthPtr;
@@ -47,35 +98,99 @@ class Rs400 : public DepthCamera
 	// 新着のカラーデータ
 	const Color *colorPtr;
 
+  // 新着のデータを保持するフレーム
+  rs2::frameset frames;
+
+  // フレームを外部から受け取るなら true
+  bool synchronized;
+
+  // デプスデータをカラーデータに合わせるなら true
+  const bool alignToColor;
+
+  // カラーデータを YUYV で受け取ってシェーダで RGB に変換するなら true
+  const bool yuyv;
+
+  // 受け取ったフレームを共有メモリに書き込む
+  std::unique_ptr<FramePublisher> publisher;
+
+  // デプスデータの後処理の設定
+  const Processing processing;
+
+  // デプスデータの値の単位 (m)
+  float depthScale;
+
+  // デプスデータに順にかけるフィルタ
+  std::vector<rs2::filter> filters;
+
+  // フィルタをかけたフレーム
+  rs2::frame_queue processed;
+
+  // フィルタをかけるスレッド
+  std::thread processor;
+
+  // フィルタをかけるスレッドが動いている間 true
+  std::atomic<bool> filtering;
+
+  // フィルタをかけたフレームの数と時間の合計 (ns)
+  std::atomic<std::uint64_t> processedCount, processedTime;
+
+  // フィルタをかけるスレッドの処理
+  void process();
+
 	// カメラ座標を計算するシェーダ
-	static std::unique_ptr<Compute> shader;
+	std::shared_ptr<Compute> shader;
 
   // デプスデータのイメージユニットの uniform 変数 depth の場所
-  static GLint depthLoc;
+  GLint depthLoc;
 
   // カメラ座標のイメージユニットの uniform 変数 point の場所
-  static GLint pointLoc;
+  GLint pointLoc;
+
+  // カメラ座標を求める領域の uniform 変数 origin と limit の場所
+  GLint originLoc, limitLoc;
+
+  // シェーダの Parameter ブロックに渡すカメラパラメータ (std140 のレイアウト)
+  struct Parameter
+  {
+    // カラーセンサに対するデプスセンサの回転 (mat3 の列は vec4 の大きさになる)
+    GLfloat extRotation[12];
 
-  // デプスセンサの主点位置の uniform 変数 dpp の場所
-  static GLint dppLoc;
+    // カラーセンサに対するデプスセンサの平行移動
+    GLfloat extTranslation[3];
 
-  // デプスセンサの焦点距離の unform 変数 df の場所
-  static GLint dfLoc;
+    // 奥行きの最大値 (デプスデータの値)
+    GLfloat maxDepth;
 
-  // カラーセンサの主点位置の uniform 変数 dpp の場所
-  static GLint cppLoc;
+    // デプスセンサの主点位置と焦点距離
+    GLfloat dpp[2], df[2];
 
-  // カラーセンサの焦点距離の unform 変数 df の場所
-  static GLint cfLoc;
+    // カラーセンサの主点位置と焦点距離
+    GLfloat cpp[2], cf[2];
 
-  // 奥行きの最大値の uniform 変数 maxDepth の場所
-  static GLint maxDepthLoc;
+    // デプスデータの値の単位
+    GLfloat depthScale;
+
+    // バイラテラルフィルタをかけるなら true
+    GLint smoothing;
+
+    // これより近いか遠いデプスデータの値を計測不能点にする
+    GLfloat nearDepth, farDepth;
+  };
+
+  // カメラパラメータを格納した Uniform Buffer Object を作成する
+  GLuint makeCameraParameter(const rs2_intrinsics &depth, const GLfloat *rotation, const GLfloat *translation) const;
 
   // デバイスの mutex
 	std::mutex deviceMutex;
 
+	// RealSense のデバイスリストの mutex
+	static std::mutex devicesMutex;
+
 	// RealSense のデバイスリスト
-	static std::map<std::string, rs2::device *> devices;
+	static std::map<std::string, rs2::device> devices;
+
+	// 使用中の RealSense のシリアル番号
+	static std::set<std::string> opened;
 
 	// RealSense のパイプライン
 	rs2::pipeline pipe;
@@ -92,32 +207,108 @@ class Rs400 : public DepthCamera
   // RealSense のカラーセンサに対するデプスセンサの外部パラメータ
   rs2_extrinsics extrinsics;
 
-  // RealSense のカラーセンサに対するデプスセンサの外部パラメータの uniform 変数の場所
-  static GLint extRotationLoc, extTranslationLoc;
+  // デプスデータをカラーデータに合わせるシェーダ
+  std::shared_ptr<Compute> aligner;
+
+  // デプスデータをカラーデータに合わせるシェーダの uniform 変数の場所
+  GLint alignRawLoc, alignAlignedLoc, alignDepthLoc, alignResolveLoc;
+
+  // デプスデータをカラーデータに合わせるシェーダに渡すカメラパラメータの Uniform Buffer Object
+  GLuint alignBuffer;
+
+  // カラーデータに合わせる前のデプスデータを格納するテクスチャ
+  GLuint rawTexture;
+
+  // カラーセンサの画素ごとの最も近いデプス値を求めるテクスチャ
+  GLuint alignTexture;
+
+  // CPU でデプスデータをカラーデータに合わせる処理ブロック (シェーダを使わないとき)
+  std::unique_ptr<rs2::align> align;
+
+  // デプスデータをシェーダでカラーデータに合わせる
+  void alignDepth();
+
+	// RealSense のコンテキストを得る (最初に呼び出したときにデバイスリストを作る)
+	static rs2::context &get_context();
 
 	// RealSense を有効にする
-	void add_device(rs2::device &dev);
+	static void add_device(rs2::device &dev);
 
 	// RealSense を無効にする
-	void remove_device(const rs2::event_information &info);
-
-	// 接続されている RealSense の数を調べる
-	int count_device();
+	static void remove_device(const rs2::event_information &info);
 
 public:
 
   // コンストラクタ
-	Rs400();
+	Rs400(
+    int depth_width = 1280,                             // デプスセンサの幅
+    int depth_height = 720,                             // デプスセンサの高さ
+    int depth_fps = 30,                                 // デプスセンサのフレームレート (解像度により 30 か 60)
+    int color_width = 1920,                             // カラーセンサの幅
+    int color_height = 1080,                            // カラーセンサの高さ
+    int color_fps = 30,                                 // カラーセンサのフレームレート (30 か 60)
+    bool align_to_color = false,                        // デプスデータをカラーデータに合わせるなら true
+    const std::string &serial = "",                     // 使用する RealSense のシリアル番号 (空なら使われていないもの)
+    const Processing &processing = Processing(),        // デプスデータの後処理の設定
+    bool color_yuyv = false                             // カラーデータを YUYV で受け取るなら true
+    );
 
   // デストラクタ
   virtual ~Rs400();
 
+  // 接続されている RealSense のシリアル番号と製品名のリストを得る
+  static std::map<std::string, std::string> getDevices();
+
+  // 使用している RealSense のシリアル番号を得る
+  const std::string &getSerial() const
+  {
+    return serial;
+  }
+
   // 計測不能点のデフォルト距離
   static constexpr GLushort maxDepth = 10000;
 
   // 疑似カラー処理の範囲
   static constexpr GLfloat range[2] = { 0.3f, 5.0f };
 
+  // 疑似カラー処理の範囲を得る
+  const GLfloat *getRange() const
+  {
+    return range;
+  }
+
+  // 新しいフレームを取り出す (到着していなければ false)
+  bool pollFrames(rs2::frameset &frames)
+  {
+    // フィルタをかけているときはフィルタをかけたものを取り出す
+    return processor.joinable() ? processed.poll_for_frame(&frames) : pipe.poll_for_frames(&frames);
+  }
+
+  // フィルタをかけるのにかかった一フレームあたりの平均の時間 (ms) を得る
+  double getProcessingTime() const
+  {
+    const std::uint64_t count(processedCount.load());
+    return count > 0 ? processedTime.load() * 1.0e-6 / count : 0.0;
+  }
+
+  // フレームのタイムスタンプ (ms) を得る
+  static double getTimestamp(const rs2::frameset &frames)
+  {
+    return frames.get_depth_frame().get_timestamp();
+  }
+
+  // フレームを外部から受け取るかどうかを設定する
+  void setSynchronized(bool synchronized)
+  {
+    this->synchronized = synchronized;
+  }
+
+  // フレームのデプスデータをテクスチャに転送してカラーデータを保持する
+  void setFrames(const rs2::frameset &frames);
+
+  // 受け取ったフレームを共有メモリ name に書き込むようにする (作れなければ false)
+  bool setPublisher(const std::string &name, std::uint32_t slots = 4);
+
   // デプスデータを取得する
   GLuint getDepth();
 
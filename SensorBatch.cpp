@@ -0,0 +1,166 @@
+﻿#include "SensorBatch.h"
+
+//
+// すべてのセンサの点群の一括描画
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <limits>
+
+// コンストラクタ
+SensorBatch::SensorBatch(const std::vector<std::unique_ptr<DepthCamera>> &sensors)
+  : foregroundArray(0)
+  , instances(sensors.size())
+  , commands(sensors.size())
+{
+  // センサごとの解像度と法線ベクトルの位置, 描画コマンドを求める
+  GLint maxWidth(1), maxHeight(1), count(0);
+  for (size_t i = 0; i < sensors.size(); ++i)
+  {
+    int width, height;
+    sensors[i]->getDepthResolution(&width, &height);
+    instances[i].size[0] = width;
+    instances[i].size[1] = height;
+    instances[i].offset = count;
+    const GLint *const roi(sensors[i]->getRoi());
+    instances[i].row = roi[1];
+    maxWidth = std::max(maxWidth, width);
+    maxHeight = std::max(maxHeight, height);
+    count += width * height;
+
+    // Mesh::draw() と同じ三角形ストリップを描画する範囲について baseInstance にセンサの番号を入れて描く
+    commands[i] = Command{ static_cast<GLuint>(roi[2] * 2), static_cast<GLuint>(roi[3] - 1),
+      static_cast<GLuint>(roi[0] * 2), static_cast<GLuint>(i) };
+  }
+
+  // すべてのセンサのカメラ座標を格納するテクスチャ配列 (一番大きいセンサの解像度にする)
+  glGenTextures(1, &pointArray);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, pointArray);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA32F, maxWidth, maxHeight, static_cast<GLsizei>(sensors.size()));
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+  // センサが前景を抽出していればすべてのセンサの前景を格納するテクスチャ配列も作る
+  if (sensors.front()->getForegroundTexture() != 0)
+  {
+    glGenTextures(1, &foregroundArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, foregroundArray);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, maxWidth, maxHeight, static_cast<GLsizei>(sensors.size()));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  }
+
+  // すべてのセンサの法線ベクトルを格納するバッファオブジェクト
+  glGenBuffers(1, &normalBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, normalBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof (GLfloat[4]), nullptr, GL_DYNAMIC_COPY);
+
+  // センサごとのデータを格納するバッファオブジェクト (毎フレーム書き換える)
+  glGenBuffers(1, &instanceBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, instances.size() * sizeof (Instance), nullptr, GL_STREAM_DRAW);
+
+  // 描画コマンドを格納するバッファオブジェクト (見えないセンサは毎フレーム描かないようにする)
+  glGenBuffers(1, &commandBuffer);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof (Command), commands.data(), GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  // センサの番号を頂点属性として取り出す頂点配列オブジェクト
+  //   除数をインスタンス数より大きくしておけば頂点属性は baseInstance 番目の要素になる
+  std::vector<GLint> index(sensors.size());
+  for (size_t i = 0; i < index.size(); ++i) index[i] = static_cast<GLint>(i);
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  glGenBuffers(1, &indexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, indexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, index.size() * sizeof index[0], index.data(), GL_STATIC_DRAW);
+  glVertexAttribIPointer(0, 1, GL_INT, 0, 0);
+  glVertexAttribDivisor(0, std::numeric_limits<GLint>::max());
+  glEnableVertexAttribArray(0);
+  glBindVertexArray(0);
+
+  // まだ新しいフレームを受け取っていないセンサも描けるように現在の内容を取り込んでおく
+  for (size_t i = 0; i < sensors.size(); ++i) update(i, *sensors[i]);
+}
+
+// デストラクタ
+SensorBatch::~SensorBatch()
+{
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &indexBuffer);
+  glDeleteBuffers(1, &commandBuffer);
+  glDeleteBuffers(1, &instanceBuffer);
+  glDeleteBuffers(1, &normalBuffer);
+  glDeleteTextures(1, &pointArray);
+  glDeleteTextures(1, &foregroundArray);
+}
+
+// センサ i の新しいカメラ座標と法線ベクトルと前景を取り込む
+void SensorBatch::update(size_t i, const DepthCamera &sensor)
+{
+  const Instance &instance(instances[i]);
+
+  // コンピュートシェーダの imageStore() やシェーダストレージへの書き込みと転送の完了を待つ
+  //   glCopyImageSubData() がどのビットで順序付けられるかは仕様で明示されていないので, シェーダの書き込みのビットも含める
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT
+    | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  // カメラ座標をテクスチャ配列の i 番目の層にコピーする
+  glCopyImageSubData(sensor.getPointTexture(), GL_TEXTURE_2D, 0, 0, 0, 0,
+    pointArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(i),
+    instance.size[0], instance.size[1], 1);
+
+  // 前景をテクスチャ配列の i 番目の層にコピーする
+  if (foregroundArray != 0 && sensor.getForegroundTexture() != 0)
+  {
+    glCopyImageSubData(sensor.getForegroundTexture(), GL_TEXTURE_2D, 0, 0, 0, 0,
+      foregroundArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, static_cast<GLint>(i),
+      instance.size[0], instance.size[1], 1);
+  }
+
+  // 法線ベクトルをまとめたバッファオブジェクトにコピーする
+  const GLsizeiptr size(instance.size[0] * instance.size[1] * sizeof (GLfloat[4]));
+  glBindBuffer(GL_COPY_READ_BUFFER, sensor.getNormalBuffer());
+  glBindBuffer(GL_COPY_WRITE_BUFFER, normalBuffer);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, instance.offset * sizeof (GLfloat[4]), size);
+}
+
+// すべてのセンサを描画する
+void SensorBatch::draw(const std::vector<std::unique_ptr<DepthCamera>> &sensors, const GgMatrix &mp, const GgMatrix &mm)
+{
+  // センサごとの変換行列と疑似カラー処理の範囲を更新する
+  for (size_t i = 0; i < sensors.size(); ++i)
+  {
+    const GgMatrix mv(sensors[i]->attitude * mm), mn(mv.normal());
+
+    // 境界ボックスが視野に入っていなければインスタンス数を 0 にして描かない
+    commands[i].instanceCount = sensors[i]->isVisible(mp * mv) ? sensors[i]->getRoi()[3] - 1 : 0;
+
+    std::copy(mv.get(), mv.get() + 16, instances[i].mv);
+    std::copy(mn.get(), mn.get() + 16, instances[i].mn);
+    std::copy(sensors[i]->getRange(), sensors[i]->getRange() + 2, instances[i].range);
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instances.size() * sizeof (Instance), instances.data());
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof (Command), commands.data());
+
+  // すべてのセンサのカメラ座標と法線ベクトル, センサごとのデータ
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, pointArray);
+  if (foregroundArray != 0)
+  {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, foregroundArray);
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::NormalBinding, normalBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::InstanceBinding, instanceBuffer);
+
+  // 一回の呼び出しですべてのセンサを描画する
+  glBindVertexArray(vao);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+  glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, nullptr, static_cast<GLsizei>(instances.size()), 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
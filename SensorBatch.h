@@ -0,0 +1,99 @@
+﻿#pragma once
+
+//
+// すべてのセンサの点群の一括描画
+//
+//   センサごとのカメラ座標をテクスチャ配列に, 法線ベクトルを一つのバッファオブジェクトにまとめ,
+//   センサごとの変換行列などを Shader Storage Buffer Object に入れて
+//   glMultiDrawArraysIndirect() の一回の呼び出しで全部のセンサを描画する
+//
+
+// デプスセンサ関連の基底クラス
+#include "DepthCamera.h"
+
+// 標準ライブラリ
+#include <memory>
+#include <vector>
+
+class SensorBatch
+{
+  // センサごとのデータ (batch.vert の Instance と同じ std430 のレイアウト)
+  struct Instance
+  {
+    // モデルビュー変換行列
+    GLfloat mv[16];
+
+    // 法線ベクトルの変換行列
+    GLfloat mn[16];
+
+    // 疑似カラー処理の範囲
+    GLfloat range[2];
+
+    // デプスセンサの解像度
+    GLint size[2];
+
+    // 法線ベクトルのバッファオブジェクト上の先頭の位置 (要素数)
+    GLint offset;
+
+    // 描画する範囲の下端の行
+    GLint row;
+
+    // 構造体の大きさを vec4 の倍数にする
+    GLint padding[2];
+  };
+
+  // glMultiDrawArraysIndirect() の描画コマンド
+  struct Command
+  {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+  };
+
+  // すべてのセンサのカメラ座標を格納するテクスチャ配列
+  GLuint pointArray;
+
+  // すべてのセンサの前景を格納するテクスチャ配列 (前景を抽出しなければ 0)
+  GLuint foregroundArray;
+
+  // すべてのセンサの法線ベクトルを格納するバッファオブジェクト
+  GLuint normalBuffer;
+
+  // センサごとのデータを格納するバッファオブジェクト
+  GLuint instanceBuffer;
+
+  // 描画コマンドを格納するバッファオブジェクト
+  GLuint commandBuffer;
+
+  // センサの番号を頂点属性として取り出す頂点配列オブジェクトとそのバッファオブジェクト
+  GLuint vao, indexBuffer;
+
+  // センサごとのデータ
+  std::vector<Instance> instances;
+
+  // センサごとの描画コマンド
+  std::vector<Command> commands;
+
+public:
+
+  // コンストラクタ
+  SensorBatch(const std::vector<std::unique_ptr<DepthCamera>> &sensors);
+
+  // デストラクタ
+  virtual ~SensorBatch();
+
+  // コピーコンストラクタを封じる
+  SensorBatch(const SensorBatch &) = delete;
+
+  // 代入演算子を封じる
+  SensorBatch &operator=(const SensorBatch &) = delete;
+
+  // センサ i の新しいカメラ座標と法線ベクトルと前景を取り込む
+  void update(size_t i, const DepthCamera &sensor);
+
+  // すべてのセンサを描画する
+  //   batch.vert のシェーダの使用を開始してから呼ぶ, mp は投影変換行列, mm はモデル変換行列
+  //   視錐台カリングを有効にしたセンサは境界ボックスが視野に入っていなければ描かない
+  void draw(const std::vector<std::unique_ptr<DepthCamera>> &sensors, const GgMatrix &mp, const GgMatrix &mm);
+};
@@ -0,0 +1,125 @@
+﻿#include "SensorFactory.h"
+
+//
+// 設定に従ったデプスセンサの生成
+//
+
+// Kinect と DepthSense の SDK は Windows 用しかない
+#if !defined(_WIN32)
+#  if !defined(USE_KINECT_V1)
+#    define USE_KINECT_V1 0
+#  endif
+#  if !defined(USE_KINECT_V2)
+#    define USE_KINECT_V2 0
+#  endif
+#  if !defined(USE_DEPTH_SENSE)
+#    define USE_DEPTH_SENSE 0
+#  endif
+#endif
+
+// センサ関連の処理
+#include "KinectV1.h"
+#include "KinectV2.h"
+#include "Ds325.h"
+#include "Rs400.h"
+
+// 標準ライブラリ
+#include <algorithm>
+#include <stdexcept>
+#include <map>
+
+// 設定に従ってデプスセンサを起動する
+std::unique_ptr<DepthCamera> SensorFactory::create(const SensorConfig &config)
+{
+#if USE_REAL_SENSE
+  if (config.backend == "rs400")
+  {
+    // デプスデータの後処理
+    Rs400::Processing processing;
+    processing.decimation = config.decimation;
+    processing.spatial = config.spatial;
+    processing.temporal = config.temporal;
+    processing.holeFilling = config.holeFilling;
+    processing.depthUnits = config.depthUnits;
+    processing.smoothing = config.smoothing;
+    std::copy(config.roi, config.roi + 4, processing.roi);
+    processing.nearClip = config.nearClip;
+    processing.farClip = config.farClip;
+
+    // ビジュアルプリセット
+    if (!config.preset.empty())
+    {
+      static const std::map<std::string, rs2_rs400_visual_preset> presets
+      {
+        { "default", RS2_RS400_VISUAL_PRESET_DEFAULT },
+        { "hand", RS2_RS400_VISUAL_PRESET_HAND },
+        { "high_accuracy", RS2_RS400_VISUAL_PRESET_HIGH_ACCURACY },
+        { "high_density", RS2_RS400_VISUAL_PRESET_HIGH_DENSITY },
+        { "medium_density", RS2_RS400_VISUAL_PRESET_MEDIUM_DENSITY }
+      };
+      const auto preset(presets.find(config.preset));
+      if (preset == presets.end())
+      {
+        throw std::runtime_error("ビジュアルプリセットが不正です: " + config.preset);
+      }
+      processing.preset = preset->second;
+    }
+
+    return std::make_unique<Rs400>(config.depthWidth, config.depthHeight, config.depthFps,
+      config.colorWidth, config.colorHeight, config.colorFps, config.alignToColor, config.serial, processing, config.yuyv);
+  }
+#endif
+
+#if USE_KINECT_V1
+  // Kinect V1 の解像度は固定
+  if (config.backend == "kinectv1") return std::make_unique<KinectV1>();
+#endif
+
+#if USE_KINECT_V2
+  // Kinect V2 の解像度は固定
+  if (config.backend == "kinectv2") return std::make_unique<KinectV2>();
+#endif
+
+#if USE_DEPTH_SENSE
+  if (config.backend == "ds325") return std::make_unique<Ds325>(config.model);
+#endif
+
+  // 組み込まれている種類を示す
+  std::string message("このセンサは使えません: " + config.backend + " (");
+  for (const auto &backend : getBackends()) message += " " + backend;
+  throw std::runtime_error(message + " )");
+}
+
+// 組み込まれているセンサの種類の名前のリストを得る
+const std::vector<std::string> &SensorFactory::getBackends()
+{
+  static const std::vector<std::string> backends
+  {
+#if USE_REAL_SENSE
+    "rs400",
+#endif
+#if USE_KINECT_V1
+    "kinectv1",
+#endif
+#if USE_KINECT_V2
+    "kinectv2",
+#endif
+#if USE_DEPTH_SENSE
+    "ds325",
+#endif
+  };
+
+  return backends;
+}
+
+// 接続されているデバイスのリストを得る
+std::vector<SensorFactory::Device> SensorFactory::getDevices()
+{
+  std::vector<Device> list;
+
+#if USE_REAL_SENSE
+  for (const auto &device : Rs400::getDevices()) list.push_back({ "rs400", device.first, device.second });
+#endif
+
+  return list;
+}
@@ -0,0 +1,45 @@
+﻿#pragma once
+
+//
+// 設定に従ったデプスセンサの生成
+//
+
+// デプスセンサ関連の基底クラス
+#include "DepthCamera.h"
+
+// 実行時の設定
+#include "Config.h"
+
+// 標準ライブラリ
+#include <memory>
+#include <string>
+#include <vector>
+
+class SensorFactory
+{
+public:
+
+  // 接続されているデバイス
+  struct Device
+  {
+    // センサの種類
+    std::string backend;
+
+    // シリアル番号
+    std::string serial;
+
+    // 製品名
+    std::string name;
+  };
+
+  // 設定に従ってデプスセンサを起動する
+  //   センサが見つからなければ isOpend() が false のものを返す
+  //   組み込まれていない種類なら std::runtime_error を投げる
+  static std::unique_ptr<DepthCamera> create(const SensorConfig &config);
+
+  // 組み込まれているセンサの種類の名前のリストを得る
+  static const std::vector<std::string> &getBackends();
+
+  // 接続されているデバイスのリストを得る (列挙できるのは RealSense のみ)
+  static std::vector<Device> getDevices();
+};
@@ -0,0 +1,243 @@
+﻿#include "ViewportCapture.h"
+
+//
+// ビューポートの非同期の読み出しとファイルへの連続書き出し
+//
+
+// 標準ライブラリ
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+// 独自形式のファイルの識別子
+static constexpr char rawMagic[4] = { 'G', 'D', 'V', 'F' };
+
+// コンストラクタ
+ViewportCapture::ViewportCapture(const std::string &prefix, Format format, Source source, size_t slots)
+  : prefix(prefix)
+  , format(format)
+  , source(source)
+  , channels(source == ColorSource ? 3 : 1)
+  , slot(std::max(slots, size_t(2)))
+  , capacity(0)
+  , next(0)
+  , frame(0)
+  , quit(false)
+  , captured(0)
+  , written(0)
+  , dropped(0)
+{
+  for (auto &s : slot)
+  {
+    s.buffer = 0;
+    s.data = nullptr;
+    s.fence = nullptr;
+    s.width = s.height = 0;
+    s.frame = 0;
+    s.busy = false;
+  }
+
+  // 書き出しスレッドを起動する
+  writer = std::thread([this]() { write(); });
+}
+
+// デストラクタ
+ViewportCapture::~ViewportCapture()
+{
+  // 読み出し中のスロットを書き出しスレッドに渡す
+  for (const auto s : pending)
+  {
+    glClientWaitSync(s->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+  }
+  update();
+
+  // 書き出しスレッドを止める
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    quit = true;
+  }
+  queueCondition.notify_one();
+  writer.join();
+
+  // バッファオブジェクトを削除する
+  release();
+}
+
+// すべてのスロットのバッファオブジェクトを size バイトで作り直す
+void ViewportCapture::allocate(GLsizeiptr size)
+{
+  release();
+
+  for (auto &s : slot)
+  {
+    // 永続的にマップできるバッファオブジェクトを作成する
+    glGenBuffers(1, &s.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+    glBufferStorage(GL_PIXEL_PACK_BUFFER, size, nullptr,
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+
+    // 書き出しスレッドから読めるようにマップしたままにする
+    s.data = static_cast<const GLubyte *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT));
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  capacity = size;
+}
+
+// すべてのスロットのバッファオブジェクトを削除する
+void ViewportCapture::release()
+{
+  for (auto &s : slot)
+  {
+    if (s.fence) glDeleteSync(s.fence);
+    s.fence = nullptr;
+    if (s.buffer == 0) continue;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glDeleteBuffers(1, &s.buffer);
+    s.buffer = 0;
+    s.data = nullptr;
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  capacity = 0;
+}
+
+// 現在のビューポートの読み出しを開始する
+bool ViewportCapture::capture()
+{
+  // 現在のビューポートのサイズを得る
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  const GLsizeiptr size(static_cast<GLsizeiptr>(viewport[2]) * viewport[3] * channels);
+  if (size <= 0) return false;
+
+  // 足りなければ作り直す (使用中のスロットがあればこのフレームは捨てる)
+  if (size > capacity)
+  {
+    if (std::any_of(slot.begin(), slot.end(), [](const Slot &s) { return s.fence || s.busy; }))
+    {
+      ++dropped;
+      return false;
+    }
+    allocate(size);
+  }
+
+  // 次に使うスロット
+  Slot &s(slot[next]);
+
+  // スロットがまだ読み出し中か書き出し中なら描画を止めないようにこのフレームは捨てる
+  if (s.fence || s.busy)
+  {
+    ++dropped;
+    return false;
+  }
+
+  // 1 行ずつ詰めてピクセルバッファオブジェクトに読み出す (待たずに戻る)
+  GLint alignment;
+  glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+  if (source == ColorSource)
+    glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+  else
+    glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+
+  // 完了を待つフェンスを置く
+  s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  s.width = viewport[2];
+  s.height = viewport[3];
+  s.frame = frame++;
+
+  // 読み出し中のスロットに加える
+  pending.push_back(&s);
+  next = (next + 1) % slot.size();
+  ++captured;
+
+  return true;
+}
+
+// 読み出しの完了したスロットを書き出しスレッドに渡す
+void ViewportCapture::update()
+{
+  // 読み出し中のスロットを古い順に
+  while (!pending.empty())
+  {
+    // GPU 側の処理が終わっていなければ待たずに戻る
+    Slot &s(*pending.front());
+    const GLenum status(glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0));
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+    // フェンスを削除する
+    glDeleteSync(s.fence);
+    s.fence = nullptr;
+
+    // 書き出しスレッドに渡す
+    s.busy = true;
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      queue.push_back(&s);
+    }
+    queueCondition.notify_one();
+    pending.pop_front();
+  }
+}
+
+// 書き出しスレッドの処理
+void ViewportCapture::write()
+{
+  for (;;)
+  {
+    // 仕事を取り出す
+    Slot *s;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueCondition.wait(lock, [this]() { return quit || !queue.empty(); });
+      if (queue.empty()) return;
+      s = queue.front();
+      queue.pop_front();
+    }
+
+    // ファイルに書き出す
+    if (save(*s)) ++written;
+
+    // スロットを空ける
+    s->busy = false;
+  }
+}
+
+// スロットの内容をファイルに書き出す
+bool ViewportCapture::save(const Slot &s)
+{
+  if (format == TgaFormat)
+  {
+    // フレームごとのファイル名
+    std::ostringstream name;
+    name << prefix << '_' << std::setw(6) << std::setfill('0') << s.frame << ".tga";
+
+    // 左下から並んだ画素をそのまま TGA ファイルにする
+    return ggSaveTga(name.str().c_str(), s.data, s.width, s.height, channels);
+  }
+
+  // 独自形式なら最初のフレームでファイルを開く
+  if (!raw.is_open())
+  {
+    raw.open(prefix + ".raw", std::ios::binary);
+    if (!raw) return false;
+  }
+
+  // フレームのヘッダと左下から並んだ画素を書き出す
+  RawHeader header;
+  std::copy(rawMagic, rawMagic + sizeof rawMagic, header.magic);
+  header.width = s.width;
+  header.height = s.height;
+  header.channels = channels;
+  header.frame = s.frame;
+  raw.write(reinterpret_cast<const char *>(&header), sizeof header);
+  raw.write(reinterpret_cast<const char *>(s.data), static_cast<std::streamsize>(s.width) * s.height * channels);
+
+  return !raw.bad();
+}
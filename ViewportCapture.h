@@ -0,0 +1,178 @@
+﻿#pragma once
+
+//
+// ビューポートの非同期の読み出しとファイルへの連続書き出し
+//
+//   ggSaveColor() / ggSaveDepth() は glFinish() と glReadPixels() で描画を止めてから書き出すので,
+//   永続的にマップしたピクセルバッファオブジェクトのリングに読み出してフェンスで完了を待ち,
+//   読み出しの終わったものを別スレッドで TGA の連番画像か一つの独自形式のファイルに書き出す
+//
+
+// 補助プログラム
+#include "gg.h"
+using namespace gg;
+
+// 標準ライブラリ
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ViewportCapture
+{
+public:
+
+  // 書き出すファイルの形式
+  enum Format
+  {
+    TgaFormat = 0,                                      // フレームごとの TGA ファイル
+    RawFormat                                           // フレームのヘッダと画素を並べた一つのファイル
+  };
+
+  // 読み出すバッファ
+  enum Source
+  {
+    ColorSource = 0,                                    // カラーバッファ (RGB 各 8bit)
+    DepthSource                                         // デプスバッファ (8bit)
+  };
+
+  // 独自形式のファイルのフレームごとのヘッダ
+  struct RawHeader
+  {
+    char magic[4];                                      // 識別子 "GDVF"
+    GLuint width, height;                               // 画素数
+    GLuint channels;                                    // 1 画素のバイト数
+    GLuint64 frame;                                     // フレームの番号
+  };
+
+private:
+
+  // 読み出しに使うピクセルバッファオブジェクトのスロット
+  struct Slot
+  {
+    // ピクセルバッファオブジェクト
+    GLuint buffer;
+
+    // 永続的にマップしたバッファオブジェクトの先頭
+    const GLubyte *data;
+
+    // 読み出しの完了を待つフェンス
+    GLsync fence;
+
+    // 読み出したビューポートのサイズ
+    GLsizei width, height;
+
+    // 書き出すフレームの番号
+    unsigned long long frame;
+
+    // 書き出しスレッドが使用中なら true
+    std::atomic<bool> busy;
+  };
+
+  // 書き出すファイル名の先頭
+  const std::string prefix;
+
+  // 書き出すファイルの形式
+  const Format format;
+
+  // 読み出すバッファ
+  const Source source;
+
+  // 1 画素のバイト数
+  const GLuint channels;
+
+  // 読み出しに使うスロット
+  std::vector<Slot> slot;
+
+  // スロットのバッファオブジェクトの大きさ
+  GLsizeiptr capacity;
+
+  // 次に使うスロット
+  size_t next;
+
+  // 読み出したフレームの番号
+  unsigned long long frame;
+
+  // GPU 側の処理が完了して書き出しを待っているスロット
+  std::deque<Slot *> pending;
+
+  // 書き出しスレッドに渡したスロット
+  std::deque<Slot *> queue;
+
+  // 書き出しスレッドとの排他制御
+  std::mutex queueMutex;
+
+  // 書き出しスレッドへの通知
+  std::condition_variable queueCondition;
+
+  // 書き出しスレッドを止めるなら true
+  bool quit;
+
+  // 独自形式のときに書き出しスレッドが書き込むファイル
+  std::ofstream raw;
+
+  // 書き出しスレッド
+  std::thread writer;
+
+  // 読み出したフレーム数, 書き出したフレーム数, 空きスロットがなくて捨てたフレーム数
+  std::atomic<unsigned long long> captured, written, dropped;
+
+  // すべてのスロットのバッファオブジェクトを size バイトで作り直す
+  void allocate(GLsizeiptr size);
+
+  // すべてのスロットのバッファオブジェクトを削除する
+  void release();
+
+  // 書き出しスレッドの処理
+  void write();
+
+  // スロットの内容をファイルに書き出す
+  bool save(const Slot &s);
+
+public:
+
+  // コンストラクタ
+  //   prefix 書き出すファイル名の先頭 (TGA なら後ろにフレームの番号を付け, 独自形式なら .raw を付ける)
+  //   format 書き出すファイルの形式
+  //   source 読み出すバッファ
+  //   slots スロットの数
+  ViewportCapture(const std::string &prefix, Format format = TgaFormat, Source source = ColorSource,
+    size_t slots = 3);
+
+  // コピーコンストラクタ (コピー禁止)
+  ViewportCapture(const ViewportCapture &c) = delete;
+
+  // 代入 (代入禁止)
+  ViewportCapture &operator=(const ViewportCapture &c) = delete;
+
+  // デストラクタ
+  virtual ~ViewportCapture();
+
+  // 現在のビューポートの読み出しを開始する (空きスロットがなければ捨てて false を返す)
+  bool capture();
+
+  // 読み出しの完了したスロットを書き出しスレッドに渡す
+  void update();
+
+  // 読み出したフレーム数を得る
+  unsigned long long getCaptured() const
+  {
+    return captured;
+  }
+
+  // 書き出したフレーム数を得る
+  unsigned long long getWritten() const
+  {
+    return written;
+  }
+
+  // 空きスロットがなくて捨てたフレーム数を得る
+  unsigned long long getDropped() const
+  {
+    return dropped;
+  }
+};
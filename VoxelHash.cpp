@@ -0,0 +1,310 @@
+﻿#include "VoxelHash.h"
+
+//
+// 点群の疎なボクセルハッシュ
+//
+
+// 標準ライブラリ
+#include <limits>
+
+// コンストラクタ
+VoxelHash::VoxelHash(GLfloat voxelSize, GLfloat maxDistance, size_t maxBlocks, unsigned int lifetime)
+  : voxelSize(voxelSize)
+  , maxDistance(maxDistance)
+  , maxBlocks(maxBlocks)
+  , lifetime(lifetime)
+  , frame(1)
+  , shader("voxel.comp")
+  , pointLoc(glGetUniformLocation(shader.get(), "point"))
+  , attitudeLoc(glGetUniformLocation(shader.get(), "attitude"))
+  , voxelSizeLoc(glGetUniformLocation(shader.get(), "voxelSize"))
+  , strideLoc(glGetUniformLocation(shader.get(), "stride"))
+  , maxDistanceLoc(glGetUniformLocation(shader.get(), "maxDistance"))
+  , tableBuffer(0)
+  , tableSize(1 << 20)
+  , voxelBuffer{ 0, 0 }
+  , voxelCapacity(1 << 18)
+  , fence{ nullptr, nullptr }
+  , current(0)
+  , started(false)
+  , stride(2)
+{
+  // シェーダストレージブロックに結合ポイントを割り当てる
+  const GLuint tableIndex(glGetProgramResourceIndex(shader.get(), GL_SHADER_STORAGE_BLOCK, "Table"));
+  glShaderStorageBlockBinding(shader.get(), tableIndex, DepthCamera::TableBinding);
+  const GLuint voxelIndex(glGetProgramResourceIndex(shader.get(), GL_SHADER_STORAGE_BLOCK, "Voxel"));
+  glShaderStorageBlockBinding(shader.get(), voxelIndex, DepthCamera::VoxelBinding);
+
+  // フレーム内で重複するボクセルを取り除くハッシュテーブルを準備する
+  glGenBuffers(1, &tableBuffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, tableBuffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, tableSize * sizeof (GLuint), nullptr, GL_DYNAMIC_COPY);
+
+  // ボクセルの数とキーの格納先を準備する
+  glGenBuffers(static_cast<GLsizei>(voxelBuffer.size()), voxelBuffer.data());
+  for (const auto buffer : voxelBuffer)
+  {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (voxelCapacity + 1) * sizeof (GLuint), nullptr, GL_DYNAMIC_READ);
+  }
+}
+
+// デストラクタ
+VoxelHash::~VoxelHash()
+{
+  // フェンスを削除する
+  for (const auto f : fence) if (f) glDeleteSync(f);
+
+  // バッファオブジェクトを削除する
+  glDeleteBuffers(static_cast<GLsizei>(voxelBuffer.size()), voxelBuffer.data());
+  glDeleteBuffers(1, &tableBuffer);
+}
+
+// ボクセルの抽出を開始する
+void VoxelHash::start()
+{
+  // 空のハッシュテーブルを作る
+  const GLuint empty(std::numeric_limits<GLuint>::max());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, tableBuffer);
+  glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &empty);
+
+  // ボクセルの数を 0 にする
+  const GLuint zero(0);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelBuffer[current]);
+  glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof zero, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+  // シェーダから見えるようにする
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  // このフレームのボクセルの抽出を開始した
+  started = true;
+}
+
+// デプスセンサのカメラ座標のテクスチャを姿勢で変換してボクセルを登録する
+void VoxelHash::insert(const DepthCamera &sensor)
+{
+  // このフレームで最初の登録ならボクセルの抽出を開始する
+  if (!started) start();
+
+  // デプスセンサのサイズ
+  int width, height;
+  sensor.getDepthResolution(&width, &height);
+
+  // カメラ座標からボクセルを求める
+  shader.use();
+  glUniform1i(pointLoc, DepthCamera::PointImageUnit);
+  glUniformMatrix4fv(attitudeLoc, 1, GL_FALSE, sensor.attitude.get());
+  glUniform1f(voxelSizeLoc, voxelSize);
+  glUniform1i(strideLoc, stride);
+  glUniform1f(maxDistanceLoc, maxDistance);
+  glBindImageTexture(DepthCamera::PointImageUnit, sensor.getPointTexture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::TableBinding, tableBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::VoxelBinding, voxelBuffer[current]);
+  shader.dispatch((width + stride - 1) / stride, (height + stride - 1) / stride);
+}
+
+// このフレームで登録したボクセルをハッシュに反映する
+void VoxelHash::update()
+{
+  // このフレームで一つも登録していなければ何もしない
+  if (!started) return;
+
+  // ボクセルのキーの書き込みが完了したらバッファオブジェクトから読み出せるようにする
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  fence[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  // ボクセルのキーの格納先を切り替える
+  current = 1 - current;
+  started = false;
+
+  // 次に書き込む格納先に前のフレームのボクセルのキーが残っていればハッシュに取り込む
+  if (fence[current]) merge(current);
+
+  // フレーム番号を進める
+  ++frame;
+
+  // 古いブロックと容量を超えたブロックを削除する
+  evict();
+}
+
+// GPU で求めたボクセルのキーをハッシュに取り込む
+void VoxelHash::merge(int slot)
+{
+  // 1 フレーム前に投入しているので通常は待たずに完了している
+  glClientWaitSync(fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ULL);
+  glDeleteSync(fence[slot]);
+  fence[slot] = nullptr;
+
+  // ボクセルの数とキーを読み出す
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, voxelBuffer[slot]);
+  const GLuint *const data(static_cast<const GLuint *>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER,
+    0, (voxelCapacity + 1) * sizeof (GLuint), GL_MAP_READ_BIT)));
+  if (!data) return;
+
+  // 格納先からあふれた分は捨てる
+  const GLuint count(std::min(data[0], static_cast<GLuint>(voxelCapacity)));
+
+  // すべてのボクセルのキーについて
+  constexpr GLuint mask((1 << keyBits) - 1);
+  for (GLuint i = 1; i <= count; ++i)
+  {
+    // キーからボクセルの座標を取り出して占有状態にする
+    const GLuint key(data[i]);
+    touch(static_cast<int>(key & mask) - keyOffset,
+      static_cast<int>((key >> keyBits) & mask) - keyOffset,
+      static_cast<int>((key >> keyBits * 2) & mask) - keyOffset);
+  }
+
+  glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+}
+
+// ボクセルを占有状態にする
+void VoxelHash::touch(int x, int y, int z)
+{
+  // ボクセルを含むブロック
+  const int bx(floorDiv(x)), by(floorDiv(y)), bz(floorDiv(z));
+  const BlockKey key(makeKey(bx, by, bz));
+
+  // ブロックを探す
+  auto block(blocks.find(key));
+
+  if (block == blocks.end())
+  {
+    // 見つからなければ新しいブロックを作る
+    block = blocks.emplace(key, Block()).first;
+    block->second.stamp.fill(0);
+    block->second.lru = lru.insert(lru.begin(), key);
+  }
+  else if (block->second.lastSeen != frame)
+  {
+    // このフレームで初めて観測されたら LRU リストの先頭に移す
+    lru.splice(lru.begin(), lru, block->second.lru);
+  }
+
+  // ブロックとボクセルを観測したフレーム番号を記録する
+  block->second.lastSeen = frame;
+  block->second.stamp[((z - bz * blockSize) * blockSize + y - by * blockSize) * blockSize + x - bx * blockSize] = frame;
+}
+
+// 古いブロックと容量を超えたブロックを削除する
+void VoxelHash::evict()
+{
+  // LRU リストの末尾から
+  while (!lru.empty())
+  {
+    // 最も長く観測されていないブロック
+    const auto block(blocks.find(lru.back()));
+
+    // 容量に収まっていてまだ保持期間内なら終わる
+    if (blocks.size() <= maxBlocks && frame - block->second.lastSeen <= lifetime) break;
+
+    // ブロックを削除する
+    blocks.erase(block);
+    lru.pop_back();
+  }
+}
+
+// ワールド座標の点を含むボクセルが占有されていれば true を返す
+bool VoxelHash::occupied(const GLfloat *p) const
+{
+  // ボクセルの座標
+  int v[3];
+  toVoxel(p, v);
+
+  // ボクセルを含むブロック
+  const int bx(floorDiv(v[0])), by(floorDiv(v[1])), bz(floorDiv(v[2]));
+  const auto block(blocks.find(makeKey(bx, by, bz)));
+  if (block == blocks.end()) return false;
+
+  // ボクセルの占有状態を返す
+  return isOccupied(block->second.stamp[((v[2] - bz * blockSize) * blockSize
+    + v[1] - by * blockSize) * blockSize + v[0] - bx * blockSize]);
+}
+
+// ワールド座標の直方体の領域に含まれる占有ボクセルの数を返す
+size_t VoxelHash::count(const GLfloat *lower, const GLfloat *upper) const
+{
+  // 領域のボクセルの座標の範囲
+  int lo[3], hi[3];
+  toVoxel(lower, lo);
+  toVoxel(upper, hi);
+
+  // 占有ボクセルの数
+  size_t n(0);
+
+  // すべてのブロックについて
+  for (const auto &block : blocks)
+  {
+    // ブロックの基準位置のボクセルの座標
+    int b[3];
+    splitKey(block.first, b);
+    for (auto &c : b) c *= blockSize;
+
+    // 領域と重ならないブロックは飛ばす
+    if (b[0] > hi[0] || b[0] + blockSize <= lo[0]
+      || b[1] > hi[1] || b[1] + blockSize <= lo[1]
+      || b[2] > hi[2] || b[2] + blockSize <= lo[2]) continue;
+
+    // ブロック内の領域に含まれるボクセルについて
+    for (int z = std::max(lo[2] - b[2], 0); z < std::min(hi[2] - b[2] + 1, blockSize); ++z)
+      for (int y = std::max(lo[1] - b[1], 0); y < std::min(hi[1] - b[1] + 1, blockSize); ++y)
+        for (int x = std::max(lo[0] - b[0], 0); x < std::min(hi[0] - b[0] + 1, blockSize); ++x)
+          if (isOccupied(block.second.stamp[(z * blockSize + y) * blockSize + x])) ++n;
+  }
+
+  return n;
+}
+
+// ワールド座標の点から半径 radius 以内にある占有ボクセルの中心を近い順に最大 k 個求める
+size_t VoxelHash::nearest(const GLfloat *p, size_t k, GLfloat radius, std::vector<GgVector> &result) const
+{
+  result.clear();
+
+  // 探索するボクセルの座標の範囲
+  const GLfloat lower[] = { p[0] - radius, p[1] - radius, p[2] - radius };
+  const GLfloat upper[] = { p[0] + radius, p[1] + radius, p[2] + radius };
+  int lo[3], hi[3];
+  toVoxel(lower, lo);
+  toVoxel(upper, hi);
+
+  // 距離の二乗の上限
+  const GLfloat limit(radius * radius);
+
+  // 範囲のブロックについて
+  for (int bz = floorDiv(lo[2]); bz <= floorDiv(hi[2]); ++bz)
+    for (int by = floorDiv(lo[1]); by <= floorDiv(hi[1]); ++by)
+      for (int bx = floorDiv(lo[0]); bx <= floorDiv(hi[0]); ++bx)
+      {
+        // ブロックがなければ飛ばす
+        const auto block(blocks.find(makeKey(bx, by, bz)));
+        if (block == blocks.end()) continue;
+
+        // ブロック内のすべてのボクセルについて
+        for (int i = 0; i < blockVolume; ++i)
+        {
+          // 占有されていなければ飛ばす
+          if (!isOccupied(block->second.stamp[i])) continue;
+
+          // ボクセルの中心
+          const GLfloat cx((bx * blockSize + i % blockSize + 0.5f) * voxelSize);
+          const GLfloat cy((by * blockSize + i / blockSize % blockSize + 0.5f) * voxelSize);
+          const GLfloat cz((bz * blockSize + i / (blockSize * blockSize) + 0.5f) * voxelSize);
+
+          // 半径内なら候補にする
+          const GLfloat dx(cx - p[0]), dy(cy - p[1]), dz(cz - p[2]);
+          const GLfloat d(dx * dx + dy * dy + dz * dz);
+          if (d <= limit) result.push_back(GgVector{ cx, cy, cz, d });
+        }
+      }
+
+  // 近い順に k 個を残す
+  const size_t n(std::min(k, result.size()));
+  std::partial_sort(result.begin(), result.begin() + n, result.end(),
+    [](const GgVector &a, const GgVector &b) { return a[3] < b[3]; });
+  result.resize(n);
+
+  // 距離の二乗を距離にする
+  for (auto &r : result) r[3] = sqrt(r[3]);
+
+  return n;
+}
@@ -0,0 +1,206 @@
+﻿#pragma once
+
+//
+// 点群の疎なボクセルハッシュ
+//
+
+// デプスセンサ関連の基底クラス
+#include "DepthCamera.h"
+
+// 標準ライブラリ
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+class VoxelHash
+{
+  // ブロックの一辺のボクセル数
+  static constexpr int blockSize = 8;
+
+  // ブロックあたりのボクセル数
+  static constexpr int blockVolume = blockSize * blockSize * blockSize;
+
+  // GPU 側のボクセルのキーの 1 軸あたりのビット数
+  static constexpr int keyBits = 10;
+
+  // GPU 側のボクセルの座標の原点のオフセット
+  static constexpr int keyOffset = 1 << (keyBits - 1);
+
+  // ハッシュテーブルの線形探査の最大回数
+  static constexpr int maxProbe = 32;
+
+  // ブロックのキーの 1 軸あたりのビット数
+  static constexpr int blockKeyBits = 21;
+
+  // ブロックのキーのデータ型
+  using BlockKey = std::uint64_t;
+
+  // ボクセルのブロック
+  struct Block
+  {
+    // 各ボクセルが最後に観測されたフレーム番号 (0 なら未観測)
+    std::array<unsigned int, blockVolume> stamp;
+
+    // このブロックが最後に観測されたフレーム番号
+    unsigned int lastSeen;
+
+    // LRU リスト上の位置
+    std::list<BlockKey>::iterator lru;
+  };
+
+  // ボクセルの一辺の長さ
+  const GLfloat voxelSize;
+
+  // ボクセルに登録する点のセンサからの最大距離
+  const GLfloat maxDistance;
+
+  // 保持するブロックの最大数
+  const size_t maxBlocks;
+
+  // 観測されなくなったボクセルを保持するフレーム数
+  const unsigned int lifetime;
+
+  // ブロックのハッシュ
+  std::unordered_map<BlockKey, Block> blocks;
+
+  // 最近観測された順に並べたブロックのキー
+  std::list<BlockKey> lru;
+
+  // 現在のフレーム番号
+  unsigned int frame;
+
+  // 点群からボクセルを求めるシェーダ
+  const Compute shader;
+
+  // シェーダの uniform 変数の場所
+  const GLint pointLoc, attitudeLoc, voxelSizeLoc, strideLoc, maxDistanceLoc;
+
+  // フレーム内で重複するボクセルを取り除くハッシュテーブルのバッファオブジェクト
+  GLuint tableBuffer;
+
+  // ハッシュテーブルの要素数
+  const GLsizei tableSize;
+
+  // フレームごとに求めたボクセルのキーを格納するバッファオブジェクト
+  std::array<GLuint, 2> voxelBuffer;
+
+  // ボクセルのキーの格納先の要素数
+  const GLsizei voxelCapacity;
+
+  // ボクセルのキーの格納先のフェンス
+  std::array<GLsync, 2> fence;
+
+  // 現在書き込んでいるボクセルのキーの格納先
+  int current;
+
+  // このフレームのボクセルの抽出を開始していれば true
+  bool started;
+
+  // ボクセルの抽出に使う画素の間隔
+  int stride;
+
+  // ブロックの座標からブロックのキーを求める
+  static BlockKey makeKey(int bx, int by, int bz)
+  {
+    constexpr BlockKey mask((1 << blockKeyBits) - 1);
+    return (static_cast<BlockKey>(bx) & mask)
+      | ((static_cast<BlockKey>(by) & mask) << blockKeyBits)
+      | ((static_cast<BlockKey>(bz) & mask) << blockKeyBits * 2);
+  }
+
+  // ブロックのキーからブロックの座標を求める
+  static void splitKey(BlockKey key, int *b)
+  {
+    constexpr int mask((1 << blockKeyBits) - 1), sign(1 << (blockKeyBits - 1));
+    for (int i = 0; i < 3; ++i)
+    {
+      const int c(static_cast<int>((key >> blockKeyBits * i) & mask));
+      b[i] = c >= sign ? c - (mask + 1) : c;
+    }
+  }
+
+  // 整数を切り捨てでブロック単位に割る
+  static int floorDiv(int v)
+  {
+    return v >= 0 ? v / blockSize : (v - blockSize + 1) / blockSize;
+  }
+
+  // ワールド座標からボクセルの座標を求める
+  void toVoxel(const GLfloat *p, int *v) const
+  {
+    for (int i = 0; i < 3; ++i) v[i] = static_cast<int>(floor(p[i] / voxelSize));
+  }
+
+  // ボクセルが占有されていれば true を返す
+  bool isOccupied(unsigned int stamp) const
+  {
+    return stamp > 0 && frame - stamp <= lifetime;
+  }
+
+  // ボクセルを占有状態にする
+  void touch(int x, int y, int z);
+
+  // ボクセルの抽出を開始する
+  void start();
+
+  // GPU で求めたボクセルのキーをハッシュに取り込む
+  void merge(int slot);
+
+  // 古いブロックと容量を超えたブロックを削除する
+  void evict();
+
+public:
+
+  // コンストラクタ
+  //   voxelSize ボクセルの一辺の長さ (m)
+  //   maxDistance ボクセルに登録する点のセンサからの最大距離 (m)
+  //   maxBlocks 保持するブロックの最大数
+  //   lifetime 観測されなくなったボクセルを保持するフレーム数
+  VoxelHash(GLfloat voxelSize = 0.02f, GLfloat maxDistance = 5.0f,
+    size_t maxBlocks = 16384, unsigned int lifetime = 30);
+
+  // コピーコンストラクタ (コピー禁止)
+  VoxelHash(const VoxelHash &v) = delete;
+
+  // 代入 (代入禁止)
+  VoxelHash &operator=(const VoxelHash &v) = delete;
+
+  // デストラクタ
+  virtual ~VoxelHash();
+
+  // ボクセルの抽出に使う画素の間隔を設定する
+  void setStride(int stride)
+  {
+    this->stride = std::max(stride, 1);
+  }
+
+  // デプスセンサのカメラ座標のテクスチャを姿勢で変換してボクセルを登録する
+  void insert(const DepthCamera &sensor);
+
+  // このフレームで登録したボクセルをハッシュに反映する
+  void update();
+
+  // ワールド座標の点を含むボクセルが占有されていれば true を返す
+  bool occupied(const GLfloat *p) const;
+
+  // ワールド座標の直方体の領域に含まれる占有ボクセルの数を返す
+  size_t count(const GLfloat *lower, const GLfloat *upper) const;
+
+  // ワールド座標の点から半径 radius 以内にある占有ボクセルの中心を近い順に最大 k 個求める
+  //   result の各要素の w にはボクセルの中心までの距離を格納する
+  size_t nearest(const GLfloat *p, size_t k, GLfloat radius, std::vector<GgVector> &result) const;
+
+  // 保持しているブロックの数を得る
+  size_t getBlockCount() const
+  {
+    return blocks.size();
+  }
+
+  // ブロックが使用している CPU 側のメモリのバイト数を得る
+  size_t getMemoryUsage() const
+  {
+    return blocks.size() * (sizeof (Block) + sizeof (BlockKey) * 2);
+  }
+};
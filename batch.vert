@@ -0,0 +1,113 @@
+#version 430 core
+
+// 疑似カラー処理を行う場合は 1
+#ifndef PSEUDO_COLOR
+#  define PSEUDO_COLOR 1
+#endif
+
+// 光源
+layout (std140) uniform Light
+{
+  vec4 lamb;                                                // 環境光成分
+  vec4 ldiff;                                               // 拡散反射光成分
+  vec4 lspec;                                               // 鏡面反射光成分
+  vec4 lpos;                                                // 位置
+};
+
+// 材質
+layout (std140) uniform Material
+{
+  vec4 kamb;                                                // 環境光の反射係数
+  vec4 kdiff;                                               // 拡散反射係数
+  vec4 kspec;                                               // 鏡面反射係数
+  float kshi;                                               // 輝き係数
+};
+
+// 変換行列
+uniform mat4 mp;                                            // 投影変換行列
+
+// テクスチャ
+uniform sampler2DArray point;                               // すべてのセンサの頂点位置のテクスチャ
+uniform sampler2DArray foreground;                          // すべてのセンサの前景のテクスチャ (背景は 0)
+
+// 前景だけを描くなら true
+uniform bool foregroundOnly = false;
+
+// バッファオブジェクト
+layout (std430) readonly buffer Normal
+{
+  vec4 normal[];                                            // すべてのセンサの法線ベクトル
+};
+
+// センサごとのデータ
+struct Instance
+{
+  mat4 mv;                                                  // モデルビュー変換行列
+  mat4 mn;                                                  // 法線ベクトルの変換行列
+  vec2 range;                                               // 疑似カラー処理の範囲
+  ivec2 size;                                               // デプスセンサの解像度
+  int offset;                                               // 法線ベクトルの先頭の位置
+  int row;                                                  // 描画する範囲の下端の行
+};
+layout (std430) readonly buffer Instances
+{
+  Instance instance[];
+};
+
+// センサの番号 (描画コマンドの baseInstance)
+layout (location = 0) in int sensor;
+
+// ラスタライザに送る頂点属性
+out vec4 idiff;                                             // 拡散反射光強度
+out vec4 ispec;                                             // 鏡面反射光強度
+out vec2 texcoord;                                          // テクスチャ座標
+out float visible;                                          // 描くなら 1
+
+void main(void)
+{
+  // このセンサのデータ
+  const Instance s = instance[sensor];
+
+  // 頂点位置のテクスチャのサンプリング位置 (simple.vert と同じ)
+  const int x = gl_VertexID >> 1;
+  const int y = s.row + gl_InstanceID + 1 - (gl_VertexID & 1);
+
+  // 頂点位置のサンプリング (テクスチャ配列はセンサの解像度より大きいことがある)
+  const vec4 pv = texelFetch(point, ivec3(x, y, sensor), 0);
+
+  // 前景だけを描くときは背景の頂点を見えなくする
+  visible = foregroundOnly && texelFetch(foreground, ivec3(x, y, sensor), 0).r == 0.0 ? 0.0 : 1.0;
+
+  // 座標計算
+  const vec4 p = s.mv * pv;                                 // 視点座標系の頂点の位置
+
+  // クリッピング座標系における座標値
+  gl_Position = mp * p;
+
+  // カラーのテクスチャは使わない
+  texcoord = vec2(0.0);
+
+  // 法線ベクトルの取り出し
+  vec3 nv = vec3(normal[s.offset + y * s.size.x + x]);
+
+  // 陰影計算
+  const vec3 v = normalize(vec3(p));                        // 視線ベクトル
+  const vec3 l = normalize(vec3(lpos * p.w - p * lpos.w));  // 光線ベクトル
+  const vec3 n = normalize(mat3(s.mn) * nv);                // 法線ベクトル
+  const vec3 h = normalize(l - v);                          // 中間ベクトル
+
+#if PSEUDO_COLOR
+  // 疑似カラー処理
+  const float z = -6.0 * (pv.z + s.range.s) / (s.range.t - s.range.s);
+  const vec4 c = clamp(vec4(z - 2.0, 2.0 - abs(z - 2.0), 2.0 - z, 1.0), 0.0, 1.0);
+
+  // 拡散反射光強度
+  idiff = c * max(dot(n, l), 0.0) * kdiff * ldiff + kamb * lamb;
+#else
+  // 拡散反射光強度
+  idiff = max(dot(n, l), 0.0) * kdiff * ldiff + kamb * lamb;
+#endif
+
+  // 鏡面反射光強度
+  ispec = pow(max(dot(n, h), 0.0), kshi) * kspec * lspec;
+}
@@ -7,41 +7,71 @@
 #include <Windows.h>
 #endif
 #include <algorithm>
-
-// OpenCV
-#include <opencv2/highgui/highgui.hpp>
-#ifdef _WIN32
-#  define CV_VERSION_STR CVAUX_STR(CV_MAJOR_VERSION) CVAUX_STR(CV_MINOR_VERSION) CVAUX_STR(CV_SUBMINOR_VERSION)
-#  ifdef _DEBUG
-#    define CV_EXT_STR "d.lib"
-#  else
-#    define CV_EXT_STR ".lib"
-#  endif
-#  pragma comment(lib, "opencv_core" CV_VERSION_STR CV_EXT_STR)
-#  pragma comment(lib, "opencv_highgui" CV_VERSION_STR CV_EXT_STR)
-#  pragma comment(lib, "opencv_videoio" CV_VERSION_STR CV_EXT_STR)
-#endif
+#include <chrono>
+#include <thread>
 
 // ウィンドウ関連の処理
 #include "GgApplication.h"
 
-// センサ関連の処理
-//#include "KinectV1.h"
-//#include "KinectV2.h"
-//#include "Ds325.h"
+// 実行時の設定
+#include "Config.h"
+
+// 設定に従ったセンサの生成
+#include "SensorFactory.h"
+
+// シェーダプログラムのバイナリのキャッシュ
+#include "ProgramCache.h"
+
+// すべてのセンサの点群の一括描画
+#include "SensorBatch.h"
+
+// 透明人間の背景画像のキャプチャ
+#include "BackgroundCapture.h"
+
+// RealSense 固有の処理
 #include "Rs400.h"
 
-// センサの数
-constexpr int sensorCount(3);
+// 点群の疎なボクセルハッシュ
+#include "VoxelHash.h"
+
+// センサ間のフレームの同期
+#include "FrameSync.h"
+
+// 点群のファイルへの書き出し
+#include "PointExporter.h"
+
+// 点群を統合したメッシュの抽出と書き出し
+#include "MeshExtractor.h"
+
+// OBJ ファイルの高速な読み込み
+#include "ObjLoader.h"
+
+// 点群のネットワーク配信
+#include "DepthStream.h"
 
-// OpenCV によるビデオキャプチャに使うカメラ
-#define CAPTURE_DEVICE 2
+// ビューポートの非同期の読み出しと連続書き出し
+#include "ViewportCapture.h"
 
-// 頂点位置の生成をシェーダで行うなら 1
-#define USE_SHADER 1
+// 点群をボクセルハッシュに登録するなら 1
+#define USE_VOXEL_HASH 0
 
-// 透明人間にするなら 1
-#define USE_REFRACTION 0
+// センサ間でフレームのタイムスタンプを同期するなら 1 (RealSense のみ)
+#define USE_FRAME_SYNC 0
+
+// P キーで点群のファイルへの書き出しを開始／停止するなら 1
+#define USE_POINT_EXPORT 0
+
+// M キーで点群を統合した符号付き距離場からメッシュを抽出して書き出すなら 1
+#define USE_MESH_EXPORT 0
+
+// デプスとカラーをネットワークに配信するなら 1
+#define USE_DEPTH_STREAM 0
+
+// 受け取ったフレームを共有メモリで他のプロセスに配布するなら 1 (RealSense のみ)
+#define USE_FRAME_RING 0
+
+// V キーで画面の連続書き出しを開始／停止するなら 1
+#define USE_VIEWPORT_CAPTURE 0
 
 // カメラパラメータ
 constexpr GLfloat cameraFovy(0.7f);                     // 画角
@@ -72,24 +102,93 @@ constexpr GgSimpleShader::Material materialData =
 // 背景色
 constexpr GLfloat background[] = { 0.2f, 0.3f, 0.4f, 0.0f };
 
-// バイラテラルフィルタのデフォルトの位置の標準偏差
-constexpr float deviation1(2.0f);
+// ボクセルハッシュのボクセルの一辺の長さ
+constexpr GLfloat voxelSize(0.02f);
+
+// ボクセルハッシュが保持するブロックの最大数
+constexpr size_t voxelBlocks(16384);
+
+// 同じ組とみなすフレームのタイムスタンプの差の最大値 (ms)
+constexpr double syncTolerance(10.0);
+
+// フレームの同期のためにセンサごとに保持するフレームの数
+constexpr size_t syncWindow(4);
+
+// 点群を書き出すファイル名の先頭
+constexpr char exportPrefix[] = "points";
+
+// 点群を書き出すファイルの形式
+constexpr PointExporter::Format exportFormat(PointExporter::PlyFormat);
+
+// メッシュを書き出すファイル名の先頭
+constexpr char meshPrefix[] = "mesh";
+
+// メッシュを書き出すファイルの形式
+constexpr MeshExtractor::Format meshFormat(MeshExtractor::PlyFormat);
 
-// バイラテラルフィルタのデフォルトの明度の標準偏差
-constexpr float deviation2(10.0f);
+// メッシュを抽出する領域の中心と一辺の長さ
+constexpr GLfloat meshCenter[] = { 0.0f, 0.0f, -1.5f };
+constexpr GLfloat meshSize(3.0f);
 
-// すべてのバイラテラルフィルタの分散を設定するコールバック関数
+// メッシュを抽出する領域の一辺の格子点の数
+constexpr GLint meshResolution(128);
+
+// メッシュを抽出する前に点群を統合するセンサあたりのフレーム数 (新しいデプスを受け取ったフレームだけを数える)
+constexpr int meshFrames(30);
+
+// OBJ ファイルの読み込みの性能を計測するときの繰り返し回数
+constexpr int objRepeat(5);
+
+// 配信に使うポート番号
+constexpr int streamPort(5599);
+
+// 復号の性能を計測するときに接続する配信サーバのホスト名
+constexpr char streamHost[] = "localhost";
+
+// 配信するデプスの量子化の単位 (m)
+constexpr GLfloat streamDepthScale(0.001f);
+
+// フレームを配布する共有メモリの名前の先頭 (後ろにセンサの番号を付ける)
+constexpr char ringName[] = "getdepth";
+
+// フレームを配布する共有メモリのスロットの数
+constexpr std::uint32_t ringSlots(4);
+
+// 画面を書き出すファイル名の先頭
+constexpr char recordPrefix[] = "frame";
+
+// 画面を書き出すファイルの形式
+constexpr ViewportCapture::Format recordFormat(ViewportCapture::TgaFormat);
+
+// キーボード操作でバイラテラルフィルタの分散を設定する対象
+struct FilterTarget
+{
+  // デプスセンサのリスト
+  std::vector<std::unique_ptr<DepthCamera>> &sensors;
+
+  // バイラテラルフィルタのデフォルトの位置と明度の標準偏差
+  const float deviation1, deviation2;
+};
+
+// すべてのバイラテラルフィルタの分散を設定するコールバック関数 (B キーなら背景を学習し直す)
 static void updateVariance(const GgApplication::Window *window, int key, int scancode, int action, int mods)
 {
-  // センサのリストを取り出す
-  void *const sensors(window->getUserPointer());
+  // 設定する対象を取り出す
+  const FilterTarget *const target(static_cast<const FilterTarget *>(window->getUserPointer()));
 
-  // センサのリストが有効のときにキー操作が行われたら
-  if (sensors && action)
+  // 設定する対象が有効のときにキー操作が行われたら
+  if (target && action)
   {
+    // B キーを押したらすべてのセンサの背景を学習し直す
+    if (key == GLFW_KEY_B)
+    {
+      if (action == GLFW_PRESS) for (auto &sensor : target->sensors) sensor->resetBackground();
+      return;
+    }
+
     // バイラテラルフィルタの分散を求める
-    const GLfloat sd1(window->getArrowX() * deviation1 * 0.1f + deviation1);
-    const GLfloat sd2(window->getArrowY() * deviation2 * 0.1f + deviation2);
+    const GLfloat sd1(window->getArrowX() * target->deviation1 * 0.1f + target->deviation1);
+    const GLfloat sd2(window->getArrowY() * target->deviation2 * 0.1f + target->deviation2);
     const GLfloat variance1(sd1 * sd1), variance2(sd2 * sd2);
 
 #if defined(_DEBUG)
@@ -97,7 +196,7 @@ static void updateVariance(const GgApplication::Window *window, int key, int sca
 #endif
 
     // すべてのバイラテラルフィルタの分散を設定する
-    for (auto &sensor : *static_cast<std::vector<std::unique_ptr<SENSOR>> *>(sensors))
+    for (auto &sensor : target->sensors)
     {
       sensor->setVariance(variance1, variance1, variance2);
     }
@@ -107,8 +206,31 @@ static void updateVariance(const GgApplication::Window *window, int key, int sca
 //
 // アプリケーションの実行
 //
-void GgApplication::run()
+void GgApplication::run(int argc, const char *const *argv)
 {
+  // 設定ファイルとコマンドライン引数から設定を読み込む
+  const Config config(argc, argv);
+
+  // OBJ ファイルの読み込みの性能を計測するときはそれだけで終了する
+  if (!config.objbenchmark.empty())
+  {
+    if (!ObjLoader::benchmark(config.objbenchmark.c_str(), objRepeat, std::cerr))
+    {
+      throw std::runtime_error("OBJ ファイルが読み込めません: " + config.objbenchmark);
+    }
+    return;
+  }
+
+  // 配信の受信と復号の性能を計測するときはそれだけで終了する (別に起動した配信サーバに接続する)
+  if (config.streambenchmark > 0)
+  {
+    if (!DepthStreamClient::benchmark(streamHost, streamPort, config.streambenchmark, std::cerr))
+    {
+      throw std::runtime_error("配信サーバからフレームを受け取れません");
+    }
+    return;
+  }
+
   // ウィンドウを開く
   Window window("Depth Map Viewer", 1280, 720);
   if (!window.get())
@@ -116,24 +238,63 @@ void GgApplication::run()
     throw std::runtime_error("GLFW のウィンドウが開けません");
   }
 
+  // シェーダプログラムのバイナリをキャッシュしてすべてのシェーダにマクロ定義を埋め込む
+  ProgramCache::setDirectory(config.cache);
+  ProgramCache::setDefines(config.defines);
+
+  // 記録がなければ最初のフレームでワークグループのサイズを自動調整する
+  Autotuner::setEnabled(config.autotune);
+
+#if defined(_DEBUG)
+  // 接続されているデバイスを表示する
+  for (const auto &device : SensorFactory::getDevices())
+  {
+    std::cerr << device.backend << ": " << device.serial << " (" << device.name << ")\n";
+  }
+#endif
+
   // デプスセンサのリスト
-  std::vector<std::unique_ptr<SENSOR>> sensors;
+  std::vector<std::unique_ptr<DepthCamera>> sensors;
 
   // センサの数の分だけ
-  for (int i = 0; i < sensorCount; ++i)
+  for (int i = 0; i < config.count; ++i)
   {
-    // センサを起動する
-    std::unique_ptr<SENSOR> sensor(std::make_unique<SENSOR>());
+    // センサを設定に従って起動する
+    const SensorConfig sensorConfig(config.getSensor(i));
+    std::unique_ptr<DepthCamera> sensor(SensorFactory::create(sensorConfig));
 
-    // センサが起動できなかったら終わる
-    if (!sensor->isOpend()) break;
+    // センサが起動できなかったとき
+    if (!sensor->isOpend())
+    {
+      // デバイスを指定していればエラーにする
+      if (!sensorConfig.serial.empty()) throw std::runtime_error(sensor->getMessage());
+
+      // そうでなければ終わる
+      break;
+    }
 
     // バイラテラルフィルタの初期値を設定する
-    sensor->setVariance(deviation1 * deviation1, deviation1 * deviation1, deviation2 * deviation2);
+    sensor->setVariance(config.deviation1 * config.deviation1, config.deviation1 * config.deviation1,
+      config.deviation2 * config.deviation2);
 
     // センサの姿勢を設定する
-    sensor->attitude = ggRotateY(6.2831853f * i / sensorCount) * ggTranslate(origin);
-    //sensor->attitude = ggTranslate(origin[0] + 2.0f * (i - sensorCount / 2), origin[1], origin[2]);
+    sensor->attitude = ggRotateY(6.2831853f * i / config.count) * ggTranslate(origin);
+    //sensor->attitude = ggTranslate(origin[0] + 2.0f * (i - config.count / 2), origin[1], origin[2]);
+
+#if USE_FRAME_RING
+    // 受け取ったフレームを共有メモリに書き込む (RealSense のみ)
+    Rs400 *const realsense(dynamic_cast<Rs400 *>(sensor.get()));
+    if (!realsense || !realsense->setPublisher(ringName + std::to_string(i), ringSlots))
+    {
+      throw std::runtime_error("フレームを配布する共有メモリが作れません");
+    }
+#endif
+
+    // 背景を学習して前景を抽出する
+    if (config.foreground) sensor->enableForeground();
+
+    // 境界ボックスで視錐台カリングを行う
+    if (config.culling) sensor->enableCulling();
 
     // センサを追加する
     sensors.emplace_back(std::move(sensor));
@@ -145,52 +306,60 @@ void GgApplication::run()
     throw std::runtime_error("センサが起動できません");
   }
 
+#if defined(_DEBUG)
+  // センサごとの GPU のメモリ量と資源プール全体で確保したメモリ量を表示する
+  for (size_t i = 0; i < sensors.size(); ++i)
+  {
+    std::cerr << "sensor " << i << ": memory = " << sensors[i]->getMemory() / 1048576.0 << " MB\n";
+  }
+  std::cerr << "pool: allocated = " << ResourcePool::getAllocated() / 1048576.0
+    << " MB, pooled = " << ResourcePool::getPooled() / 1048576.0
+    << " MB, reused = " << ResourcePool::getReused() << "\n";
+#endif
+
   // キーボード操作のコールバック関数を登録する
-  window.setUserPointer(&sensors);
+  FilterTarget target{ sensors, config.deviation1, config.deviation2 };
+  window.setUserPointer(&target);
   window.setKeyboardFunc(updateVariance);
 
-#if USE_REFRACTION
-  // 背景画像のキャプチャに使う OpenCV のビデオキャプチャを初期化する
-  cv::VideoCapture camera(CAPTURE_DEVICE);
-  if (!camera.isOpened())
-  {
-    throw std::runtime_error("ビデオカメラが見つかりません");
-  }
+  // 透明人間にするなら背景画像を別のスレッドでキャプチャする
+  std::unique_ptr<BackgroundCapture> capture;
+  if (config.refraction) capture.reset(new BackgroundCapture(config.capture));
 
-  // カメラの初期設定
-  camera.grab();
-  const GLsizei capture_env_width(GLsizei(camera.get(cv::CAP_PROP_FRAME_WIDTH)));
-  const GLsizei capture_env_height(GLsizei(camera.get(cv::CAP_PROP_FRAME_HEIGHT)));
-
-  // 背景画像のテクスチャ
-  GLuint bmap;
-  glGenTextures(1, &bmap);
-  glBindTexture(GL_TEXTURE_2D, bmap);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, capture_env_width, capture_env_height, 0, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-  // 透明人間用のシェーダ
-  const GgSimpleShader simple("refraction.vert", "refraction.frag");
+  // 描画用のシェーダ (透明人間にするなら透明人間用のシェーダ)
+  const GgSimpleShader simple(ProgramCache::load(config.refraction ? "refraction.vert" : "simple.vert",
+    config.refraction ? "refraction.frag" : "simple.frag"));
   const GLint pointLoc(glGetUniformLocation(simple.get(), "point"));
   const GLint colorLoc(glGetUniformLocation(simple.get(), "color"));
   const GLint backLoc(glGetUniformLocation(simple.get(), "back"));
   const GLint alphaLoc(glGetUniformLocation(simple.get(), "alpha"));
   const GLint windowSizeLoc(glGetUniformLocation(simple.get(), "windowSize"));
-#else
-  // 描画用のシェーダ
-  const GgSimpleShader simple("simple.vert", "simple.frag");
-  const GLint pointLoc(glGetUniformLocation(simple.get(), "point"));
-  const GLint colorLoc(glGetUniformLocation(simple.get(), "color"));
   const GLint rangeLoc(glGetUniformLocation(simple.get(), "range"));
-#endif
   const GLuint uvmapIndex(glGetProgramResourceIndex(simple.get(), GL_SHADER_STORAGE_BLOCK, "Uvmap"));
   glShaderStorageBlockBinding(simple.get(), uvmapIndex, DepthCamera::UvmapBinding);
   const GLuint normalIndex(glGetProgramResourceIndex(simple.get(), GL_SHADER_STORAGE_BLOCK, "Normal"));
   glShaderStorageBlockBinding(simple.get(), normalIndex, DepthCamera::NormalBinding);
 
+  // 前景だけを描くなら前景のテクスチャを参照する
+  const GLint foregroundLoc(glGetUniformLocation(simple.get(), "foreground"));
+  glProgramUniform1i(simple.get(), glGetUniformLocation(simple.get(), "foregroundOnly"), config.foreground);
+
+  // 透明人間にしないならすべてのセンサを一回の呼び出しで描画する
+  std::unique_ptr<GgSimpleShader> batchShader;
+  std::unique_ptr<SensorBatch> batch;
+  if (config.batch && !config.refraction)
+  {
+    batchShader.reset(new GgSimpleShader(ProgramCache::load("batch.vert", "simple.frag")));
+    glProgramUniform1i(batchShader->get(), glGetUniformLocation(batchShader->get(), "point"), 0);
+    glProgramUniform1i(batchShader->get(), glGetUniformLocation(batchShader->get(), "foreground"), 1);
+    glProgramUniform1i(batchShader->get(), glGetUniformLocation(batchShader->get(), "foregroundOnly"), config.foreground);
+    const GLuint batchNormalIndex(glGetProgramResourceIndex(batchShader->get(), GL_SHADER_STORAGE_BLOCK, "Normal"));
+    glShaderStorageBlockBinding(batchShader->get(), batchNormalIndex, DepthCamera::NormalBinding);
+    const GLuint instanceIndex(glGetProgramResourceIndex(batchShader->get(), GL_SHADER_STORAGE_BLOCK, "Instances"));
+    glShaderStorageBlockBinding(batchShader->get(), instanceIndex, DepthCamera::InstanceBinding);
+    batch.reset(new SensorBatch(sensors));
+  }
+
   // 光源データ
   const GgSimpleShader::LightBuffer light(lightData);
 
@@ -204,42 +373,257 @@ void GgApplication::run()
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
 
+  // すべてのセンサの疑似カラー処理の範囲の最大値
+  GLfloat maxRange(0.0f);
+  for (const auto &sensor : sensors) maxRange = std::max(maxRange, sensor->getRange()[1]);
+
+#if USE_VOXEL_HASH
+  // 点群を登録するボクセルハッシュ
+  VoxelHash voxel(voxelSize, maxRange, voxelBlocks);
+#endif
+
+#if USE_FRAME_SYNC
+  // センサ間でフレームを同期する
+  FrameSync<rs2::frameset> sync(sensors.size(), syncTolerance, syncWindow);
+
+  // 同期する RealSense のリスト
+  std::vector<Rs400 *> realsense;
+
+  // 各センサはフレームを同期したものを受け取る
+  for (auto &sensor : sensors)
+  {
+    Rs400 *const rs(dynamic_cast<Rs400 *>(sensor.get()));
+    if (!rs)
+    {
+      throw std::runtime_error("フレームの同期は RealSense でなければ使えません");
+    }
+    rs->setSynchronized(true);
+    realsense.push_back(rs);
+  }
+
+  // タイムスタンプのそろったフレームの組
+  std::vector<rs2::frameset> frameSet;
+#endif
+
+#if USE_POINT_EXPORT
+  // 点群をファイルに書き出す
+  PointExporter exporter(exportPrefix, exportFormat, maxRange);
+
+  // 点群を書き出している間は true
+  bool exporting(false);
+
+  // 直前のフレームで P キーが押されていたら true
+  bool exportKey(false);
+#endif
+
+#if USE_MESH_EXPORT
+  // 点群を統合してメッシュを書き出す
+  MeshExtractor mesher(meshPrefix, meshFormat, meshCenter, meshSize, meshResolution, 0.0f, maxRange);
+
+  // 点群を統合している間は true
+  bool fusing(false);
+
+  // メッシュを抽出するときの統合したフレーム数 (すべてのセンサの合計)
+  unsigned long long fuseTarget(0);
+
+  // 直前のフレームで M キーが押されていたら true
+  bool meshKey(false);
+#endif
+
+#if USE_DEPTH_STREAM
+  // デプスとカラーを配信する
+  DepthStream stream(streamPort, streamDepthScale, maxRange);
+#endif
+
+#if USE_VIEWPORT_CAPTURE
+  // 画面を連続して書き出す
+  ViewportCapture recorder(recordPrefix, recordFormat);
+
+  // 画面を書き出している間は true
+  bool recording(false);
+
+  // 直前のフレームで V キーが押されていたら true
+  bool recordKey(false);
+#endif
+
+  // 性能の計測に使うタイマクエリ (前のフレームの結果を読み出すので二つ使う)
+  GLuint timer[2] = { 0, 0 };
+  if (config.benchmark > 0) glGenQueries(2, timer);
+
+  // タイマクエリを発行したフレームで新しいデプスデータを処理していたら true
+  bool timedWork[2] = { false, false };
+
+  // 計測したフレーム数と GPU の処理時間を累積したフレーム数
+  int measured(0), timed(0);
+
+  // 計測したフレーム時間と GPU の処理時間の合計 (ms)
+  double frameTime(0.0), gpuTime(0.0);
+
+  // 前のフレームを表示した時刻
+  auto last(std::chrono::steady_clock::now());
+
+  // センサごとに処理したデプスデータのフレーム数
+  std::vector<unsigned long long> processed(sensors.size(), 0);
+
+  // 前に描画したときのモデル変換行列と投影変換行列と不透明度とウィンドウサイズ
+  GgMatrix drawnModel, drawnProjection;
+  GLfloat drawnAlpha(0.0f);
+  GLsizei drawnSize[2] = { 0, 0 };
+
+  // まだ一度も描画していなければ false
+  bool drawn(false);
+
   // ウィンドウが開いている間くり返し描画する
   while (window)
   {
-#if USE_REFRACTION
-    // 画像のキャプチャ
-    if (camera.grab())
+    // 新しいデータを受け取ったセンサと背景画像の数
+    int updated(0);
+
+    // 透明人間にするときはキャプチャした最新の背景画像をテクスチャに転送する
+    if (capture && capture->update()) ++updated;
+
+    // ソースファイルが更新されたコンピュートシェーダを読み込み直す
+    if (config.reload) updated += Compute::reload();
+
+#if USE_FRAME_SYNC
+    // すべてのセンサについて
+    for (size_t i = 0; i < sensors.size(); ++i)
     {
-      // キャプチャ映像から画像を切り出す
-      cv::Mat frame;
-      camera.retrieve(frame, 3);
-
-      // 切り出した画像をテクスチャに転送する
-      cv::Mat flipped;
-      cv::flip(frame, flipped, 0);
-      glBindTexture(GL_TEXTURE_2D, bmap);
-      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.cols, flipped.rows, GL_BGR, GL_UNSIGNED_BYTE, flipped.data);
+      // 到着したフレームを同期用の待ち行列に入れる
+      rs2::frameset frames;
+      while (realsense[i]->pollFrames(frames)) sync.push(i, Rs400::getTimestamp(frames), frames);
+    }
+
+    // タイムスタンプのそろったフレームの組があれば
+    if (sync.match(frameSet))
+    {
+      // それぞれのセンサのテクスチャに転送する
+      for (size_t i = 0; i < sensors.size(); ++i) realsense[i]->setFrames(frameSet[i]);
     }
 #endif
 
-    // すべてのセンサについて
-    for (auto &sensor : sensors)
+#if USE_POINT_EXPORT
+    // P キーを押すたびに点群の書き出しを開始／停止する
+    const bool key(window.getKey(GLFW_KEY_P));
+    if (key && !exportKey) exporting = !exporting;
+    exportKey = key;
+#endif
+
+#if USE_MESH_EXPORT
+    // M キーを押したら符号付き距離場を空にして点群の統合を開始する (前のメッシュの書き出し中は無視する)
+    const bool mesh(window.getKey(GLFW_KEY_M));
+    if (mesh && !meshKey && !fusing && !mesher.isBusy())
     {
-      // 頂点位置の取得
-#if USE_SHADER
-      sensor->getPosition();
-#else
-      sensor->getPoint();
+      mesher.reset();
+      fusing = true;
+      fuseTarget = mesher.getFused() + meshFrames * sensors.size();
+    }
+    meshKey = mesh;
+#endif
+
+#if USE_VIEWPORT_CAPTURE
+    // V キーを押すたびに画面の書き出しを開始／停止する
+    const bool record(window.getKey(GLFW_KEY_V));
+    if (record && !recordKey) recording = !recording;
+    recordKey = record;
 #endif
 
+    // センサのデータの処理にかかる GPU の時間の計測を開始する
+    if (config.benchmark > 0) glBeginQuery(GL_TIME_ELAPSED, timer[measured & 1]);
+
+    // センサのデータを処理する前に更新されていたものの数
+    const int received(updated);
+
+    // すべてのセンサについて
+    for (size_t i = 0; i < sensors.size(); ++i)
+    {
+      // センサ
+      auto &sensor(sensors[i]);
+
+      // 頂点位置の取得 (シェーダを使わなければ CPU で計算する)
+      if (config.shader)
+        sensor->getPosition();
+      else
+        sensor->getPoint();
+
       // カラーデータの取得
       sensor->getColor();
 
+      // 新しいデプスデータを受け取っていなければカメラ座標は変わらないので以降の処理を省く
+      if (sensor->getDepthFrame() == processed[i]) continue;
+      processed[i] = sensor->getDepthFrame();
+      ++updated;
+
       // 法線ベクトルの計算
       sensor->getNormal();
+
+      // 背景モデルの更新と前景の抽出
+      sensor->getForeground();
+
+      // 視錐台カリングに使う境界ボックスを求める
+      sensor->getBounds();
+
+      // 一括描画用のテクスチャ配列とバッファオブジェクトに取り込む
+      if (batch) batch->update(i, *sensor);
+
+#if USE_VOXEL_HASH
+      // 点群をボクセルハッシュに登録する
+      voxel.insert(*sensor);
+#endif
+
+#if USE_POINT_EXPORT
+      // 点群の読み出しを開始する
+      if (exporting) exporter.capture(*sensor, static_cast<int>(i));
+#endif
+
+#if USE_MESH_EXPORT
+      // 点群を符号付き距離場に統合する
+      if (fusing) mesher.integrate(*sensor);
+#endif
+
+#if USE_DEPTH_STREAM
+      // デプスとカラーの読み出しを開始する
+      stream.capture(*sensor, static_cast<int>(i));
+#endif
     }
 
+#if USE_VOXEL_HASH
+    // 登録した点群をボクセルハッシュに反映する
+    voxel.update();
+#endif
+
+    // センサのデータの処理にかかる GPU の時間の計測を終了する (描画を間引いて次のフレームで同じクエリを使い直すときは上書きされる)
+    if (config.benchmark > 0)
+    {
+      glEndQuery(GL_TIME_ELAPSED);
+      timedWork[measured & 1] = updated > received;
+    }
+
+#if USE_POINT_EXPORT
+    // 読み出しの完了した点群を書き出す
+    exporter.update();
+#endif
+
+#if USE_MESH_EXPORT
+    // センサごとに meshFrames フレームの新しいデプスを統合したらメッシュを抽出し, 読み出しの完了したメッシュを書き出す
+    if (fusing && mesher.getFused() >= fuseTarget)
+    {
+      mesher.extract();
+      fusing = false;
+    }
+    mesher.update();
+#endif
+
+#if USE_DEPTH_STREAM
+    // 読み出しの完了したデプスとカラーを配信する
+    stream.update();
+#endif
+
+#if USE_VIEWPORT_CAPTURE
+    // 読み出しの完了した画面を書き出す
+    recorder.update();
+#endif
+
     // 不透明度
     const GLfloat alpha(std::max(std::min(1.0f - window.getArrowY() * 0.05f, 1.0f), -1.0f));
 
@@ -249,53 +633,194 @@ void GgApplication::run()
     // 投影変換行列
     const GgMatrix mp(ggPerspective(cameraFovy, window.getAspect(), cameraNear, cameraFar));
 
+    // 描画を間引くとき
+    if (config.pacing)
+    {
+      // 新しいデータがなく視点もウィンドウも変わっていなければ描画しない
+      const GLsizei *const size(window.getSize());
+      if (drawn && updated == 0 && alpha == drawnAlpha
+        && std::equal(mm.get(), mm.get() + 16, drawnModel.get())
+        && std::equal(mp.get(), mp.get() + 16, drawnProjection.get())
+        && std::equal(size, size + 2, drawnSize))
+      {
+        // 少し待ってからイベントと新しいデータを調べ直す
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+
+      // 描画したときの状態を記録する
+      drawnModel = mm;
+      drawnProjection = mp;
+      drawnAlpha = alpha;
+      std::copy(size, size + 2, drawnSize);
+      drawn = true;
+    }
+
     // 画面消去
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // すべてのセンサについて
-    for (auto &sensor : sensors)
+    // 一括描画するとき
+    if (batch)
     {
-      // 描画用のシェーダプログラムの使用開始
-      simple.use(mp, sensor->attitude * mm, light);
+      // 一括描画用のシェーダプログラムの使用開始 (モデルビュー変換行列はセンサごとに与える)
+      batchShader->use(mp, mm, light);
       material.select();
 
-      // カメラ座標のテクスチャ
-      glUniform1i(pointLoc, 0);
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, sensor->getPointTexture());
-
-      // 前景テクスチャ
-      glUniform1i(colorLoc, 1);
-      glActiveTexture(GL_TEXTURE1);
-      glBindTexture(GL_TEXTURE_2D, sensor->getColorTexture());
-
-#if USE_REFRACTION
-      // 背景テクスチャ
-      glUniform1i(backLoc, 2);
-      glActiveTexture(GL_TEXTURE2);
-      glBindTexture(GL_TEXTURE_2D, bmap);
-
-      // 不透明度
-      glUniform1f(alphaLoc, alpha);
-
-      // ウィンドウサイズ
-      glUniform2iv(windowSizeLoc, 1, window.getSize());
-#else
-      // 疑似カラー処理
-      glUniform2fv(rangeLoc, 1, sensor->range);
-#endif
+      // すべてのセンサを描画する
+      batch->draw(sensors, mp, mm);
+    }
+    else
+    {
+      // すべてのセンサについて
+      for (auto &sensor : sensors)
+      {
+        // 視野に入っていなければ描かない (入っていれば見える行だけを描く描画コマンドを作る)
+        const GgMatrix mv(sensor->attitude * mm);
+        if (!sensor->cull(mp * mv)) continue;
+
+        // 描画用のシェーダプログラムの使用開始
+        simple.use(mp, mv, light);
+        material.select();
+
+        // カメラ座標のテクスチャ
+        glUniform1i(pointLoc, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, sensor->getPointTexture());
+
+        // 前景テクスチャ
+        glUniform1i(colorLoc, 1);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, sensor->getColorTexture());
+
+        if (capture)
+        {
+          // 背景テクスチャ
+          glUniform1i(backLoc, 2);
+          glActiveTexture(GL_TEXTURE2);
+          glBindTexture(GL_TEXTURE_2D, capture->getTexture());
+
+          // 不透明度
+          glUniform1f(alphaLoc, alpha);
+
+          // ウィンドウサイズ
+          glUniform2iv(windowSizeLoc, 1, window.getSize());
+        }
+        else
+        {
+          // 疑似カラー処理
+          glUniform2fv(rangeLoc, 1, sensor->getRange());
+
+          // 前景のテクスチャ
+          glUniform1i(foregroundLoc, 3);
+          glActiveTexture(GL_TEXTURE3);
+          glBindTexture(GL_TEXTURE_2D, sensor->getForegroundTexture());
+        }
+
+        // テクスチャ座標のシェーダストレージバッファオブジェクト
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::UvmapBinding, sensor->getUvmapBuffer());
+
+        // 法線ベクトルののシェーダストレージバッファオブジェクト
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::NormalBinding, sensor->getNormalBuffer());
+
+        // 図形描画
+        sensor->draw();
+      }
+    }
 
-      // テクスチャ座標のシェーダストレージバッファオブジェクト
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::UvmapBinding, sensor->getUvmapBuffer());
+#if USE_VIEWPORT_CAPTURE
+    // 描画した画面の読み出しを開始する (完了は待たない)
+    if (recording) recorder.capture();
+#endif
 
-      // 法線ベクトルののシェーダストレージバッファオブジェクト
-      glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DepthCamera::NormalBinding, sensor->getNormalBuffer());
+    // バッファを入れ替える
+    window.swapBuffers();
 
-      // 図形描画
-      sensor->draw();
+    // 性能を計測するなら
+    if (config.benchmark > 0)
+    {
+      // フレーム時間を累積する
+      const auto now(std::chrono::steady_clock::now());
+      frameTime += std::chrono::duration<double, std::milli>(now - last).count();
+      last = now;
+
+      // 前のフレームで新しいデプスデータを処理していれば GPU の処理時間を累積する
+      if (measured > 0 && timedWork[(measured - 1) & 1])
+      {
+        GLuint64 elapsed(0);
+        glGetQueryObjectui64v(timer[(measured - 1) & 1], GL_QUERY_RESULT, &elapsed);
+        gpuTime += elapsed * 1.0e-6;
+        ++timed;
+      }
+
+      // 指定したフレーム数を計測したら結果を表示して終了する
+      if (++measured > config.benchmark)
+      {
+        std::cerr << "frames = " << config.benchmark
+          << ", frame = " << frameTime / measured << " ms"
+          << ", gpu = " << (timed > 0 ? gpuTime / timed : 0.0) << " ms (" << timed << " frames)\n";
+        for (size_t i = 0; i < sensors.size(); ++i)
+        {
+          int width, height;
+          sensors[i]->getDepthResolution(&width, &height);
+          std::cerr << "sensor " << i << ": depth = " << width << "x" << height;
+          const Rs400 *const rs(dynamic_cast<const Rs400 *>(sensors[i].get()));
+          if (rs) std::cerr << ", filter = " << rs->getProcessingTime() << " ms";
+          const auto &statistics(sensors[i]->getStatistics());
+          std::cerr << ", position = " << statistics.positionExecuted << " / " << statistics.positionSkipped
+            << ", normal = " << statistics.normalExecuted << " / " << statistics.normalSkipped;
+          std::cerr << ", memory = " << sensors[i]->getMemory() / 1048576.0 << " MB";
+          std::cerr << "\n";
+        }
+        window.setClose(true);
+      }
     }
+  }
 
-    // バッファを入れ替える
-    window.swapBuffers();
+  // タイマクエリを削除する
+  if (config.benchmark > 0) glDeleteQueries(2, timer);
+
+#if defined(_DEBUG)
+  // センサごとの処理の実行と省略の回数を表示する
+  for (size_t i = 0; i < sensors.size(); ++i)
+  {
+    const auto &statistics(sensors[i]->getStatistics());
+    std::cerr << "sensor " << i << ": position = " << statistics.positionExecuted << " / " << statistics.positionSkipped
+      << ", normal = " << statistics.normalExecuted << " / " << statistics.normalSkipped << "\n";
+  }
+#endif
+
+#if USE_FRAME_SYNC && defined(_DEBUG)
+  // フレームの同期の統計を表示する
+  const auto &statistics(sync.getStatistics());
+  std::cerr << "matched = " << statistics.matched << ", skipped = " << statistics.skipped
+    << ", skew = " << statistics.meanSkew() << " / " << statistics.maxSkew << " ms\n";
+  for (size_t i = 0; i < statistics.dropped.size(); ++i)
+  {
+    std::cerr << "sensor " << i << ": dropped = " << statistics.dropped[i] << "\n";
   }
+#endif
+
+#if USE_POINT_EXPORT && defined(_DEBUG)
+  // 点群の書き出しの統計を表示する
+  std::cerr << "exported = " << exporter.getWritten() << " / " << exporter.getCaptured()
+    << ", dropped = " << exporter.getDropped() << "\n";
+#endif
+
+#if USE_MESH_EXPORT && defined(_DEBUG)
+  // メッシュの書き出しの統計を表示する
+  std::cerr << "meshes = " << mesher.getWritten() << " / " << mesher.getExtracted()
+    << ", fused = " << mesher.getFused() << "\n";
+#endif
+
+#if USE_DEPTH_STREAM && defined(_DEBUG)
+  // 配信の統計を表示する
+  std::cerr << "streamed = " << stream.getSent() << " / " << stream.getCaptured()
+    << ", dropped = " << stream.getDropped() << "\n";
+#endif
+
+#if USE_VIEWPORT_CAPTURE && defined(_DEBUG)
+  // 画面の書き出しの統計を表示する
+  std::cerr << "recorded = " << recorder.getWritten() << " / " << recorder.getCaptured()
+    << ", dropped = " << recorder.getDropped() << "\n";
+#endif
 }
@@ -5652,6 +5652,19 @@ gg::GgSimpleShader::GgSimpleShader(const char *vert, const char *frag,
   glUniformBlockBinding(get(), lightIndex, 0);
 }
 
+/*
+** 三角形に単純な陰影付けを行うシェーダ：作成済みのプログラムからのコンストラクタ
+*/
+gg::GgSimpleShader::GgSimpleShader(GLuint program)
+  : GgPointShader(program)
+  , materialIndex(glGetUniformBlockIndex(get(), "Material"))
+  , lightIndex(glGetUniformBlockIndex(get(), "Light"))
+  , mnLoc(glGetUniformLocation(get(), "mn"))
+{
+  glUniformBlockBinding(get(), materialIndex, 1);
+  glUniformBlockBinding(get(), lightIndex, 0);
+}
+
 /*
 ** Wavefront OBJ 形式のデータ：コンストラクタ
 */
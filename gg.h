@@ -4925,6 +4925,12 @@ namespace gg
       : program(ggLoadShader(vert, frag, geom, nvarying, varyings))
     {}
 
+    //! \brief コンストラクタ.
+    //!   \param program 作成済みのシェーダのプログラム名 (このオブジェクトが削除する).
+    explicit GgShader(GLuint program)
+      : program(program)
+    {}
+
     //! \brief デストラクタ.
     virtual ~GgShader()
     {
@@ -4998,6 +5004,16 @@ namespace gg
       mvLoc = glGetUniformLocation(program, "mv");
     }
 
+    //! \brief コンストラクタ
+    //!   \param program 作成済みのシェーダのプログラム名 (このオブジェクトが削除する).
+    explicit GgPointShader(GLuint program)
+      : shader(new GgShader(program))
+    {
+      // 変換行列の uniform 変数の場所
+      mpLoc = glGetUniformLocation(program, "mp");
+      mvLoc = glGetUniformLocation(program, "mv");
+    }
+
     //! \brief デストラクタ.
     virtual ~GgPointShader() {}
 
@@ -5127,6 +5143,10 @@ namespace gg
     GgSimpleShader(const char *vert, const char *frag = 0,
       const char *geom = 0, GLint nvarying = 0, const char **varyings = 0);
 
+    //! \brief コンストラクタ
+    //!   \param program 作成済みのシェーダのプログラム名 (このオブジェクトが削除する).
+    explicit GgSimpleShader(GLuint program);
+
     //! \brief コピーコンストラクタ.
     GgSimpleShader(const GgSimpleShader &o)
       : GgPointShader(o)
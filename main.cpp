@@ -14,13 +14,13 @@
 //
 // メインプログラム
 //
-int main() try
+int main(int argc, char *argv[]) try
 {
   // アプリケーション本体
   GgApplication app(4, 3);
 
   // アプリケーションを実行する
-  app.run();
+  app.run(argc, argv);
 }
 catch (const std::exception &e)
 {
@@ -15,16 +15,22 @@ in vec2 tc;                                                 // メッシュの
 // フレームバッファに出力するデータ
 layout (location = 0) out vec4 fc;                          // フラグメントの色
 
+// 背景のテクスチャは上下を反転せずに転送しているのでテクスチャ座標を反転する
+vec2 flip(const vec2 t)
+{
+  return vec2(t.x, 1.0 - t.y);
+}
+
 void main(void)
 {
   // 屈折方向のテクスチャ座標
   if (gl_FragCoord.z < 0.99) {
     const vec2 offset = refract(vec3(0.0, 0.0, -1.0), normalize(nv), 0.8).xy * 0.2;
-    fc = mix(texture(back, tc + offset) + ispec, texture(color, texcoord), alpha);
+    fc = mix(texture(back, flip(tc + offset)) + ispec, texture(color, texcoord), alpha);
   }
   else
   {
-    fc = texture(back, tc);
+    fc = texture(back, flip(tc));
   }
 
   //fc = texture(back, tc);
@@ -38,6 +38,9 @@ layout (std430) readonly buffer Normal
   vec4 normal[];                                            // 法線ベクトル
 };
 
+// インスタンスごとの行の番号 (Mesh の頂点配列オブジェクトの 1 番の頂点属性)
+layout (location = 1) in int row;
+
 // ラスタライザに送る頂点属性
 out vec3 nv;                                                // 法線ベクトル
 out vec4 idiff;                                             // 拡散反射光強度
@@ -52,10 +55,11 @@ void main(void)
   //     x = gl_VertexID >> 1      = 0, 0, 1, 1, 2, 2, 3, 3, ...
   //     y = 1 - (gl_VertexID & 1) = 1, 0, 1, 0, 1, 0, 1, 0, ...
   //   のように GL_TRIANGLE_STRIP 向けの頂点座標値が得られる。
-  //   y に gl_InstaceID を足せば glDrawArrayInstanced() のインスタンスごとに y が変化する。
+  //   y に row を足せば glDrawArrayInstanced() のインスタンスごとに y が変化する。
   //   これをメッシュのサイズで割れば縦横 (0, 1) の範囲の点群が得られる。
+  //   row は gl_InstanceID に baseInstance を足したもので, 途中の行から描くときに使う。
   const int x = gl_VertexID >> 1;
-  const int y = gl_InstanceID + 1 - (gl_VertexID & 1);
+  const int y = row + 1 - (gl_VertexID & 1);
 
   // メッシュのテクスチャ座標
   tc = (vec2(x, y) + 0.5) / vec2(textureSize(point, 0));
@@ -7,12 +7,16 @@ uniform sampler2D color;                                    // カラーのテ
 in vec4 idiff;                                              // 拡散反射光強度
 in vec4 ispec;                                              // 鏡面反射光強度
 in vec2 texcoord;                                           // テクスチャ座標
+in float visible;                                           // 描くなら 1
 
 // フレームバッファに出力するデータ
 layout (location = 0) out vec4 fc;                          // フラグメントの色
 
 void main(void)
 {
+  // 背景の頂点を含む三角形は背景に近い側を描かない
+  if (visible < 0.5) discard;
+
   // テクスチャマッピングを行って陰影を求める
   fc = idiff + ispec;
   //fc = texture(color, texcoord);
@@ -1,7 +1,9 @@
 #version 430 core
 
 // 疑似カラー処理を行う場合は 1
-#define PSEUDO_COLOR 1
+#ifndef PSEUDO_COLOR
+#  define PSEUDO_COLOR 1
+#endif
 
 // 光源
 layout (std140) uniform Light
@@ -29,6 +31,10 @@ uniform mat4 mn;                                            // 法線ベクト
 // テクスチャ
 uniform sampler2D point;                                    // 頂点位置のテクスチャ
 uniform sampler2D color;                                    // カラーのテクスチャ
+uniform sampler2D foreground;                               // 前景のテクスチャ (背景は 0)
+
+// 前景だけを描くなら true
+uniform bool foregroundOnly = false;
 
 // バッファオブジェクト
 layout (std430) readonly buffer Uvmap
@@ -43,10 +49,14 @@ layout (std430) readonly buffer Normal
 // 疑似カラー処理
 uniform vec2 range = vec2(0.3, 6.0);
 
+// インスタンスごとの行の番号 (Mesh の頂点配列オブジェクトの 1 番の頂点属性)
+layout (location = 1) in int row;
+
 // ラスタライザに送る頂点属性
 out vec4 idiff;                                             // 拡散反射光強度
 out vec4 ispec;                                             // 鏡面反射光強度
 out vec2 texcoord;                                          // テクスチャ座標
+out float visible;                                          // 描くなら 1
 
 void main(void)
 {
@@ -55,15 +65,19 @@ void main(void)
   //     x = gl_VertexID >> 1      = 0, 0, 1, 1, 2, 2, 3, 3, ...
   //     y = 1 - (gl_VertexID & 1) = 1, 0, 1, 0, 1, 0, 1, 0, ...
   //   のように GL_TRIANGLE_STRIP 向けの頂点座標値が得られる。
-  //   y に gl_InstaceID を足せば glDrawArrayInstanced() のインスタンスごとに y が変化する。
+  //   y に row を足せば glDrawArrayInstanced() のインスタンスごとに y が変化する。
   //   これをメッシュのサイズで割れば縦横 (0, 1) の範囲の点群が得られる。
+  //   row は gl_InstanceID に baseInstance を足したもので, 途中の行から描くときに使う。
   const int x = gl_VertexID >> 1;
-  const int y = gl_InstanceID + 1 - (gl_VertexID & 1);
+  const int y = row + 1 - (gl_VertexID & 1);
   const vec2 pc = (vec2(x, y) + 0.5) / vec2(textureSize(point, 0));
 
   // 頂点位置のサンプリング
   const vec4 pv = texture(point, pc);
 
+  // 前景だけを描くときは背景の頂点を見えなくする
+  visible = foregroundOnly && texelFetch(foreground, ivec2(x, y), 0).r == 0.0 ? 0.0 : 1.0;
+
   // 座標計算
   const vec4 p = mv * pv;                                   // 視点座標系の頂点の位置
 